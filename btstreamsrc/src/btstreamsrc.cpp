@@ -59,6 +59,10 @@ enum {
 	PROP_ALGORITHM,
 	PROP_STREAM_LENGTH,
 	PROP_SAVE_PATH,
+	PROP_BUFFER_SIZE,
+	PROP_BUFFER_TIME,
+	PROP_ADAPTIVE_BUFFER,
+	PROP_PREFETCH_PIECES,
 	PROP_DOWNLOAD_RATE,
 	PROP_UPLOAD_RATE,
 	PROP_DOWNLOAD_PROGRESS,
@@ -73,6 +77,13 @@ enum {
 	PROP_NEXT_ANNOUNCE
 };
 
+/* limits of the data pushed by each create call */
+static const int MAX_BATCH_PIECES = 16;
+static const long MAX_BATCH_BYTES = 4 * 1024 * 1024;
+
+/* how often the playback position is reported */
+static const GstClockTime REPORT_INTERVAL = GST_SECOND;
+
 GST_BOILERPLATE(GstBTStreamSrc, gst_btstream_src, GstPushSrc,
 		GST_TYPE_PUSH_SRC);
 
@@ -101,6 +112,8 @@ static gboolean gst_btstream_src_start(GstBaseSrc * basesrc) {
 			algorithm = btstream::SEQUENTIAL;
 		} else if (g_strcmp0(src->m_algorithm, "deadline") == 0) {
 			algorithm = btstream::DEADLINE;
+		} else if (g_strcmp0(src->m_algorithm, "adaptive") == 0) {
+			algorithm = btstream::ADAPTIVE;
 		}
 	}
 
@@ -110,14 +123,89 @@ static gboolean gst_btstream_src_start(GstBaseSrc * basesrc) {
 		save_path = src->m_save_path;
 	}
 
-	src->m_btstream = new btstream::BTStream(torrent_path, save_path,
-			algorithm, stream_length);
+	// The streaming thread is the only one reading pieces.
+	btstream::BufferSettings buffer_settings;
+	buffer_settings.mode = btstream::SPSC;
+	buffer_settings.capacity_bytes = src->m_buffer_size;
+	buffer_settings.capacity_ms = src->m_buffer_time;
+	buffer_settings.adaptive = src->m_adaptive_buffer;
+	buffer_settings.prefetch_pieces = src->m_prefetch_pieces;
+
+	src->m_btstream = new btstream::BTStream();
+	src->m_btstream->set_buffer_settings(buffer_settings);
+	src->m_btstream->add_torrent(torrent_path, save_path, algorithm,
+			stream_length);
 
 	GST_INFO("Creating BTStreamSrc and starting torrent download.");
 
 	return (src->m_btstream != 0);
 }
 
+/* returns the top level bin that holds the element, with a reference */
+static GstElement* gst_btstream_src_get_pipeline(GstBTStreamSrc* src) {
+	GstObject* top = GST_OBJECT(gst_object_ref(src));
+	GstObject* parent;
+
+	while ((parent = gst_object_get_parent(top)) != NULL) {
+		gst_object_unref(top);
+		top = parent;
+	}
+
+	return GST_ELEMENT(top);
+}
+
+/* reports the playback position, which is the stream time given by the
+ * pipeline's sinks, so that deadlines follow what is being played even
+ * after seeks; the source's own segment is in bytes */
+static void gst_btstream_src_report_position(GstBTStreamSrc* src) {
+	if (GST_STATE(src) != GST_STATE_PLAYING) {
+		return;
+	}
+
+	GstClock* clock = gst_element_get_clock(GST_ELEMENT(src));
+	if (!clock) {
+		return;
+	}
+
+	GstClockTime now = gst_clock_get_time(clock);
+	gst_object_unref(clock);
+
+	if (src->m_last_report != 0 && now - src->m_last_report < REPORT_INTERVAL) {
+		return;
+	}
+
+	GstElement* pipeline = gst_btstream_src_get_pipeline(src);
+	GstFormat format = GST_FORMAT_TIME;
+	gint64 position = -1;
+	gboolean queried = gst_element_query_position(pipeline, &format,
+			&position);
+
+	// The rate of the time segment, if the sinks know it.
+	gdouble rate = GST_BASE_SRC(src)->segment.rate;
+	GstQuery* query = gst_query_new_segment(GST_FORMAT_TIME);
+
+	if (gst_element_query(pipeline, query)) {
+		gst_query_parse_segment(query, &rate, NULL, NULL, NULL);
+	}
+
+	gst_query_unref(query);
+	gst_object_unref(pipeline);
+
+	if (!queried || format != GST_FORMAT_TIME || position < 0) {
+		return;
+	}
+
+	src->m_last_report = now;
+
+	src->m_btstream->report_position(position / GST_MSECOND,
+			boost::posix_time::microsec_clock::universal_time(), rate);
+}
+
+/* releases the piece referenced by a buffer */
+static void free_piece(gpointer data) {
+	delete (btstream::PieceHandle*) data;
+}
+
 static GstFlowReturn gst_btstream_src_create(GstPushSrc* psrc,
 		GstBuffer** buffer) {
 	GstBTStreamSrc* src;
@@ -125,23 +213,58 @@ static GstFlowReturn gst_btstream_src_create(GstPushSrc* psrc,
 
 	src = GST_BTSTREAM_SRC(psrc);
 
+	gst_btstream_src_report_position(src);
+
 	GST_LOG("Requesting buffer from piece %d.", src->piece_number);
 
-	boost::shared_ptr<btstream::Piece> piece;
+	// Every piece that is already available is moved out of the buffer
+	// at once, without touching its reference count.
+	btstream::PieceHandle handles[MAX_BATCH_PIECES];
+	int count = src->m_btstream->get_next_handles(handles, MAX_BATCH_PIECES,
+			MAX_BATCH_BYTES);
+
+	if (count == 1) {
+		// A single piece is pushed without copying. The buffer owns the
+		// handle, which is released by free_piece.
+		btstream::PieceHandle* owner = new btstream::PieceHandle(
+				boost::move(handles[0]));
+
+		*buffer = gst_buffer_new();
 
-	piece = src->m_btstream->get_next_piece();
+		GST_BUFFER_DATA(*buffer) = (guint8*) owner->data();
+		GST_BUFFER_SIZE(*buffer) = owner->size();
+		GST_BUFFER_MALLOCDATA(*buffer) = (guint8*) owner;
+		GST_BUFFER_FREE_FUNC(*buffer) = free_piece;
+
+		// Piece memory may be shared with other readers.
+		GST_BUFFER_FLAG_SET(*buffer, GST_BUFFER_FLAG_READONLY);
+		gst_buffer_set_caps(*buffer, GST_PAD_CAPS(GST_BASE_SRC_PAD(psrc)));
+
+		GST_LOG("Buffer from piece %d created.", src->piece_number++);
+		res = GST_FLOW_OK;
+
+	} else if (count > 1) {
+		guint size = 0;
+		for (int i = 0; i < count; i++) {
+			size += handles[i].size();
+		}
 
-	if (piece) {
 		res = gst_pad_alloc_buffer(GST_BASE_SRC_PAD(psrc),
-				GST_BUFFER_OFFSET_NONE, piece->size,
+				GST_BUFFER_OFFSET_NONE, size,
 				GST_PAD_CAPS(GST_BASE_SRC_PAD(psrc)), buffer);
 
 		if (res == GST_FLOW_OK) {
 			unsigned char* data = GST_BUFFER_DATA(*buffer);
 
-			mempcpy(data, piece->data.get(), piece->size);
+			for (int i = 0; i < count; i++) {
+				data = (unsigned char*) mempcpy(data, handles[i].data(),
+						handles[i].size());
+			}
+
+			GST_LOG("Buffer from pieces %d to %d created.", src->piece_number,
+					src->piece_number + count - 1);
 
-			GST_LOG("Buffer from piece %d created.", src->piece_number++);
+			src->piece_number += count;
 
 		} else {
 			GST_WARNING("Flow error when creating buffer: %d.", res);
@@ -242,6 +365,22 @@ static void gst_btstream_src_set_property(GObject * object, guint prop_id,
 		src->m_save_path = g_value_dup_string(value);
 		break;
 
+	case PROP_BUFFER_SIZE:
+		src->m_buffer_size = g_value_get_int(value);
+		break;
+
+	case PROP_BUFFER_TIME:
+		src->m_buffer_time = g_value_get_int(value);
+		break;
+
+	case PROP_ADAPTIVE_BUFFER:
+		src->m_adaptive_buffer = g_value_get_boolean(value);
+		break;
+
+	case PROP_PREFETCH_PIECES:
+		src->m_prefetch_pieces = g_value_get_int(value);
+		break;
+
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -269,6 +408,22 @@ static void gst_btstream_src_get_property(GObject * object, guint prop_id,
 		g_value_set_string(value, src->m_save_path);
 		break;
 
+	case PROP_BUFFER_SIZE:
+		g_value_set_int(value, src->m_buffer_size);
+		break;
+
+	case PROP_BUFFER_TIME:
+		g_value_set_int(value, src->m_buffer_time);
+		break;
+
+	case PROP_ADAPTIVE_BUFFER:
+		g_value_set_boolean(value, src->m_adaptive_buffer);
+		break;
+
+	case PROP_PREFETCH_PIECES:
+		g_value_set_int(value, src->m_prefetch_pieces);
+		break;
+
 	case PROP_DOWNLOAD_RATE:
 		if (src->m_btstream) {
 			g_value_set_int(value, src->m_btstream->get_status().download_rate);
@@ -398,13 +553,27 @@ static void gst_btstream_src_class_init(GstBTStreamSrcClass * klass) {
 	installer.install_string(PROP_TORRENT, "torrent", "Torrent",
 			"Torrent file path.", "", true);
 	installer.install_string(PROP_ALGORITHM, "algorithm", "Algorithm",
-			"Piece picking algorithm: rarest-first, sequential or deadline.",
+			"Piece picking algorithm: rarest-first, sequential, deadline or adaptive.",
 			"rarest-first", true);
 	installer.install_int(PROP_STREAM_LENGTH, "stream_length", "Stream Length",
-			"Estimation of decoded stream's length in milliseconds. Used by deadline algorithm.",
+			"Estimation of decoded stream's length in milliseconds. Used by deadline and adaptive algorithms.",
 			0, 999999999, 0, true);
 	installer.install_string(PROP_SAVE_PATH, "save_path", "Save Path",
 			"Where to save downloaded files.", "./", true);
+	installer.install_int(PROP_BUFFER_SIZE, "buffer_size", "Buffer Size",
+			"Maximum amount of piece data kept in memory, in bytes. 0 means no limit.",
+			0, G_MAXINT, 0, true);
+	installer.install_int(PROP_BUFFER_TIME, "buffer_time", "Buffer Time",
+			"Amount of media kept in memory, in milliseconds. 0 disables it.",
+			0, G_MAXINT, 0, true);
+	installer.install_bool(PROP_ADAPTIVE_BUFFER, "adaptive_buffer",
+			"Adaptive Buffer",
+			"Resize the buffer according to consume and download rates.",
+			false, true);
+	installer.install_int(PROP_PREFETCH_PIECES, "prefetch_pieces",
+			"Prefetch Pieces",
+			"If greater than 0, only this many pieces ahead of playback are kept in memory and the others are read from disk when needed.",
+			0, G_MAXINT, 0, true);
 
 	// Read-only properties
 	installer.install_int(PROP_DOWNLOAD_RATE, "download_rate", "Download Rate",
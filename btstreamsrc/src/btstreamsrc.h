@@ -50,12 +50,17 @@ struct _GstBTStreamSrc {
 
 	btstream::BTStream* m_btstream;
 	int piece_number;
+	GstClockTime m_last_report;
 
 	// Writable properties
 	gchar* m_torrent;
 	gchar* m_algorithm;
 	int m_stream_length;
 	gchar* m_save_path;
+	int m_buffer_size;
+	int m_buffer_time;
+	gboolean m_adaptive_buffer;
+	int m_prefetch_pieces;
 };
 
 struct _GstBTStreamSrcClass {
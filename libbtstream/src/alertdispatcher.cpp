@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * AlertDispatcher.cpp
+ */
+
+#include "alertdispatcher.h"
+
+#include <libtorrent/alert_types.hpp>
+
+namespace btstream {
+
+/*
+ * How long the dispatcher thread waits for alerts before checking if it
+ * should stop.
+ */
+static const int ALERT_WAIT_MS = 100;
+
+AlertDispatcher::AlertDispatcher(libtorrent::session& session) :
+		m_session(session), m_next_id(0) {
+}
+
+AlertDispatcher::~AlertDispatcher() {
+	stop();
+}
+
+void AlertDispatcher::start() {
+	if (!m_thread) {
+		m_thread = boost::shared_ptr<boost::thread>(
+				new boost::thread(&AlertDispatcher::run, this));
+	}
+}
+
+void AlertDispatcher::stop() {
+	if (m_thread) {
+		m_thread->interrupt();
+		m_thread->join();
+		m_thread.reset();
+	}
+}
+
+int AlertDispatcher::add_handler(AlertHandler handler, int alert_type,
+		libtorrent::torrent_handle handle) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	Registration registration;
+	registration.id = m_next_id++;
+	registration.alert_type = alert_type;
+	registration.any_torrent = !handle.is_valid();
+	registration.handle = handle;
+	registration.handler = handler;
+
+	m_registrations.push_back(registration);
+
+	return registration.id;
+}
+
+void AlertDispatcher::remove_handler(int id) {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+
+		for (size_t i = 0; i < m_registrations.size(); i++) {
+			if (m_registrations[i].id == id) {
+				m_registrations.erase(m_registrations.begin() + i);
+				break;
+			}
+		}
+	} // Releasing lock.
+
+	// Waits for the batch being dispatched, which may still use the
+	// handler.
+	boost::lock_guard<boost::recursive_mutex> dispatch_lock(m_dispatch_mutex);
+}
+
+void AlertDispatcher::run() {
+	try {
+		while (true) {
+			boost::this_thread::interruption_point();
+
+			if (!m_session.wait_for_alert(
+					libtorrent::milliseconds(ALERT_WAIT_MS))) {
+				continue;
+			}
+
+			// Takes every queued alert at once. Ownership is transferred,
+			// so they are wrapped before any handler runs.
+			std::deque<libtorrent::alert*> popped;
+			m_session.pop_alerts(&popped);
+
+			std::vector<boost::shared_ptr<libtorrent::alert> > alerts;
+			alerts.reserve(popped.size());
+
+			for (size_t i = 0; i < popped.size(); i++) {
+				alerts.push_back(boost::shared_ptr<libtorrent::alert>(popped[i]));
+			}
+
+			boost::lock_guard<boost::recursive_mutex> dispatch_lock(
+					m_dispatch_mutex);
+
+			// Handlers run without m_mutex, so they may add or remove
+			// handlers.
+			std::vector<Registration> registrations;
+			{
+				boost::lock_guard<boost::mutex> lock(m_mutex);
+				registrations = m_registrations;
+			} // Releasing lock.
+
+			for (size_t i = 0; i < alerts.size(); i++) {
+				dispatch(alerts[i], registrations);
+			}
+		}
+	} catch (boost::thread_interrupted& e) {
+		// Thread will stop.
+	}
+}
+
+void AlertDispatcher::dispatch(boost::shared_ptr<libtorrent::alert> alert,
+		const std::vector<Registration>& registrations) {
+
+	const libtorrent::torrent_alert* torrent_alert =
+			dynamic_cast<const libtorrent::torrent_alert*>(alert.get());
+
+	for (size_t i = 0; i < registrations.size(); i++) {
+		const Registration& registration = registrations[i];
+
+		if (registration.alert_type != ANY_ALERT
+				&& registration.alert_type != alert->type()) {
+			continue;
+		}
+
+		if (!registration.any_torrent
+				&& (!torrent_alert
+						|| torrent_alert->handle != registration.handle)) {
+			continue;
+		}
+
+		registration.handler(alert);
+	}
+}
+
+AlertQueue::AlertQueue() :
+		m_woken(false) {
+}
+
+void AlertQueue::push(boost::shared_ptr<libtorrent::alert> alert) {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_alerts.push_back(alert);
+	} // Releasing lock.
+
+	m_alert_available.notify_one();
+}
+
+void AlertQueue::wake() {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_woken = true;
+	} // Releasing lock.
+
+	m_alert_available.notify_one();
+}
+
+bool AlertQueue::pop_all(
+		std::deque<boost::shared_ptr<libtorrent::alert> >& alerts,
+		const boost::posix_time::time_duration& timeout) {
+
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+
+	boost::system_time deadline = boost::get_system_time() + timeout;
+
+	while (m_alerts.empty() && !m_woken) {
+		if (!m_alert_available.timed_wait(lock, deadline)
+				&& m_alerts.empty() && !m_woken) {
+			return false;
+		}
+	}
+
+	m_woken = false;
+
+	if (alerts.empty()) {
+		alerts.swap(m_alerts);
+	} else {
+		alerts.insert(alerts.end(), m_alerts.begin(), m_alerts.end());
+		m_alerts.clear();
+	}
+
+	return true;
+}
+
+} /* namespace btstream */
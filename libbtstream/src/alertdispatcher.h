@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * AlertDispatcher.h
+ */
+
+#ifndef ALERTDISPATCHER_H_
+#define ALERTDISPATCHER_H_
+
+#include <deque>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <libtorrent/session.hpp>
+#include <libtorrent/alert.hpp>
+
+namespace btstream {
+
+/**
+ * Alert type that matches every alert in AlertDispatcher::add_handler().
+ */
+const int ANY_ALERT = -1;
+
+/**
+ * Function that handles an alert. The alert may be kept after the call.
+ */
+typedef boost::function<void(boost::shared_ptr<libtorrent::alert>)> AlertHandler;
+
+/**
+ * Reads every alert of a session and routes it to registered handlers.
+ *
+ * Alerts are drained in batches by a single thread, so consumers that
+ * share the session (stream feeders, resume data savers, statistics)
+ * never pop each other's alerts. Handlers are called from the
+ * dispatcher thread and should not block; a consumer that needs its own
+ * thread may push alerts to an AlertQueue.
+ */
+class AlertDispatcher {
+public:
+
+	/**
+	 * Constructor. The session must outlive the dispatcher.
+	 */
+	AlertDispatcher(libtorrent::session& session);
+
+	/**
+	 * Destructor. Stops the dispatcher thread.
+	 */
+	~AlertDispatcher();
+
+	/**
+	 * Starts the dispatcher thread, if it isn't running.
+	 */
+	void start();
+
+	/**
+	 * Stops the dispatcher thread. Alerts are no longer read.
+	 */
+	void stop();
+
+	/**
+	 * Registers a handler for the alerts of a given type (the alert's
+	 * alert_type constant, or ANY_ALERT) about the given torrent. An
+	 * invalid (default constructed) handle matches alerts about any
+	 * torrent and alerts that aren't about torrents.
+	 * @return an id to be passed to remove_handler().
+	 */
+	int add_handler(AlertHandler handler, int alert_type = ANY_ALERT,
+			libtorrent::torrent_handle handle = libtorrent::torrent_handle());
+
+	/**
+	 * Unregisters a handler. It won't be called after this method
+	 * returns, unless it is called from the handler itself.
+	 */
+	void remove_handler(int id);
+
+private:
+	struct Registration {
+		int id;
+		int alert_type;
+		bool any_torrent;
+		libtorrent::torrent_handle handle;
+		AlertHandler handler;
+	};
+
+	void run();
+	void dispatch(boost::shared_ptr<libtorrent::alert> alert,
+			const std::vector<Registration>& registrations);
+
+	libtorrent::session& m_session;
+	std::vector<Registration> m_registrations;
+	int m_next_id;
+
+	boost::shared_ptr<boost::thread> m_thread;
+
+	// Guards m_registrations. m_dispatch_mutex is held while handlers
+	// run, so that remove_handler() can wait for them.
+	boost::mutex m_mutex;
+	boost::recursive_mutex m_dispatch_mutex;
+};
+
+/**
+ * Thread-safe queue of alerts, filled by AlertDispatcher handlers and
+ * drained by a consumer thread.
+ */
+class AlertQueue {
+public:
+
+	/**
+	 * Constructor.
+	 */
+	AlertQueue();
+
+	/**
+	 * Appends an alert and wakes up the consumer. Can be bound as an
+	 * AlertHandler.
+	 */
+	void push(boost::shared_ptr<libtorrent::alert> alert);
+
+	/**
+	 * Wakes up the consumer without an alert, so it can handle other
+	 * events.
+	 */
+	void wake();
+
+	/**
+	 * Moves every queued alert to alerts, waiting up to timeout for the
+	 * first one or a wake() call. Returns false if the timeout expired.
+	 */
+	bool pop_all(std::deque<boost::shared_ptr<libtorrent::alert> >& alerts,
+			const boost::posix_time::time_duration& timeout);
+
+private:
+	std::deque<boost::shared_ptr<libtorrent::alert> > m_alerts;
+	bool m_woken;
+
+	boost::mutex m_mutex;
+	boost::condition_variable m_alert_available;
+};
+
+} /* namespace btstream */
+
+#endif /* ALERTDISPATCHER_H_ */
@@ -59,10 +59,112 @@ void BTStream::add_torrent(const std::string& torrent_path,
 			piece_picker, save_path);
 }
 
+void BTStream::switch_torrent(const std::string& torrent_path,
+		const std::string& save_path, Algorithm algorithm, int stream_length) {
+
+	m_video_buffer = m_video_torrent_manager->switch_torrent(torrent_path,
+			save_path, algorithm, stream_length);
+}
+
+void BTStream::switch_torrent(const std::string& torrent_path,
+		PiecePicker* piece_picker, const std::string& save_path) {
+
+	m_video_buffer = m_video_torrent_manager->switch_torrent(torrent_path,
+			piece_picker, save_path);
+}
+
+boost::posix_time::time_duration BTStream::last_switch_duration() {
+	return m_video_torrent_manager->last_switch_duration();
+}
+
+void BTStream::set_buffer_mode(BufferMode mode) {
+	m_video_torrent_manager->set_buffer_mode(mode);
+}
+
+void BTStream::set_buffer_settings(const BufferSettings& settings) {
+	m_video_torrent_manager->set_buffer_settings(settings);
+}
+
+boost::shared_ptr<PieceCursor> BTStream::create_cursor(int start_piece) {
+	return m_video_torrent_manager->create_cursor(start_piece);
+}
+
+boost::shared_ptr<RangeReader> BTStream::create_reader(
+		boost::int64_t start_offset) {
+
+	return m_video_torrent_manager->create_reader(start_offset);
+}
+
+void BTStream::set_read_ahead(int depth) {
+	m_video_torrent_manager->set_read_ahead(depth);
+}
+
+void BTStream::set_read_engine(ReadEngine engine) {
+	m_video_torrent_manager->set_read_engine(engine);
+}
+
+void BTStream::set_startup_mode(StartupMode mode) {
+	m_video_torrent_manager->set_startup_mode(mode);
+}
+
+void BTStream::set_index_first(bool enabled) {
+	m_video_torrent_manager->set_index_first(enabled);
+}
+
+boost::int64_t BTStream::index_offset() {
+	return m_video_torrent_manager->index_offset();
+}
+
+void BTStream::set_slack_thresholds(int low, int high) {
+	m_video_torrent_manager->set_slack_thresholds(low, high);
+}
+
+void BTStream::set_store_capacity(long capacity) {
+	m_video_torrent_manager->set_store_capacity(capacity);
+}
+
+void BTStream::set_deadline_horizon(int horizon) {
+	m_video_torrent_manager->set_deadline_horizon(horizon);
+}
+
+void BTStream::set_checkpoint_interval(int seconds) {
+	m_video_torrent_manager->set_checkpoint_interval(seconds);
+}
+
 boost::shared_ptr<Piece> BTStream::get_next_piece() {
 	return m_video_buffer->get_next_piece();
 }
 
+boost::shared_ptr<Piece> BTStream::try_get_next_piece() {
+	return m_video_buffer->try_get_next_piece();
+}
+
+boost::shared_ptr<Piece> BTStream::get_next_piece_for(
+		const boost::posix_time::time_duration& timeout) {
+
+	return m_video_buffer->get_next_piece_for(timeout);
+}
+
+int BTStream::get_event_fd() {
+	return m_video_buffer->get_event_fd();
+}
+
+PieceHandle BTStream::get_next_handle() {
+	return m_video_buffer->get_next_handle();
+}
+
+std::vector<boost::shared_ptr<Piece> > BTStream::get_next_pieces(
+		int max_count, long max_bytes) {
+
+	return m_video_buffer->get_next_pieces(max_count, max_bytes);
+}
+
+int BTStream::get_next_handles(PieceHandle* handles, int max_count,
+		long max_bytes) {
+
+	return m_video_buffer->get_next_handles(handles, max_count, max_bytes);
+}
+
 Status BTStream::get_status() {
 	return m_video_torrent_manager->get_status();
 }
@@ -75,6 +177,12 @@ void BTStream::notify_stall() {
 	m_video_torrent_manager->notify_stall();
 }
 
+void BTStream::report_position(int media_time,
+		const boost::posix_time::ptime& wall_time, double rate) {
+
+	m_video_torrent_manager->report_position(media_time, wall_time, rate);
+}
+
 void BTStream::unlock() {
 	m_video_buffer->unlock();
 }
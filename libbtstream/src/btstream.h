@@ -63,7 +63,8 @@ public:
 	 * 			Built-in piece picking algorithm that will be used.
 	 * @param stream_length
 	 * 			Length of the decoded stream in milliseconds.
-	 * 			It must be provided when using the DEADLINE algorithm.
+	 * 			With the DEADLINE and ADAPTIVE algorithms, it is read from
+	 * 			the video's container index if zero.
 	 */
 	BTStream(const std::string& torrent_path,
 			const std::string& save_path = ".", Algorithm algorithm =
@@ -91,7 +92,8 @@ public:
 	 * 			Built-in piece picking algorithm that will be used.
 	 * @param stream_length
 	 * 			Length of the decoded stream in milliseconds.
-	 * 			It must be provided when using the DEADLINE algorithm.
+	 * 			With the DEADLINE and ADAPTIVE algorithms, it is read from
+	 * 			the video's container index if zero.
 	 */
 	void add_torrent(const std::string& torrent_path,
 			const std::string& save_path = ".", Algorithm algorithm =
@@ -109,6 +111,134 @@ public:
 	void add_torrent(const std::string& torrent_path, PiecePicker* piece_picker,
 			const std::string& save_path = ".");
 
+	/**
+	 * Replaces the torrent being streamed. Pending get_next_piece calls
+	 * return NULL, the previous torrent is paused and its resume data is
+	 * saved in the background.
+	 * @param torrent_path
+	 * 			Path to a valid torrent file.
+	 * @param save_path
+	 * 			Path where the downloaded file will be stored.
+	 * @param algorithm
+	 * 			Built-in piece picking algorithm that will be used.
+	 * @param stream_length
+	 * 			Length of the decoded stream in milliseconds.
+	 * 			With the DEADLINE and ADAPTIVE algorithms, it is read from
+	 * 			the video's container index if zero.
+	 */
+	void switch_torrent(const std::string& torrent_path,
+			const std::string& save_path = ".", Algorithm algorithm =
+					RAREST_FIRST, int stream_length = 0);
+
+	/**
+	 * Replaces the torrent being streamed, with a custom piece picker.
+	 * @param torrent_path
+	 * 			Path to a valid torrent file.
+	 * @param piece picker
+	 * 			Pointer to a custom PiecePicker.
+	 * @param save_path
+	 * 			Path where the downloaded file will be stored.
+	 */
+	void switch_torrent(const std::string& torrent_path,
+			PiecePicker* piece_picker, const std::string& save_path = ".");
+
+	/**
+	 * Returns how long the last switch_torrent call took.
+	 */
+	boost::posix_time::time_duration last_switch_duration();
+
+	/**
+	 * Sets the synchronization strategy of the buffers created by the
+	 * following add_torrent calls. SPSC avoids locking when a single
+	 * thread calls get_next_piece.
+	 */
+	void set_buffer_mode(BufferMode mode);
+
+	/**
+	 * Sets the capacity and synchronization settings of the buffers
+	 * created by the following add_torrent calls. The capacity can be
+	 * given in bytes and/or milliseconds of media, and may adapt to the
+	 * observed consume and download rates.
+	 */
+	void set_buffer_settings(const BufferSettings& settings);
+
+	/**
+	 * Creates an additional reader of the current torrent, positioned at
+	 * start_piece. Readers share piece memory, so several consumers can
+	 * play or record the same download at different positions.
+	 */
+	boost::shared_ptr<PieceCursor> create_cursor(int start_piece = 0);
+
+	/**
+	 * Creates a reader of byte ranges of the current torrent, starting
+	 * near start_offset. Ranges are returned as spans into piece memory,
+	 * without copying.
+	 */
+	boost::shared_ptr<RangeReader> create_reader(
+			boost::int64_t start_offset = 0);
+
+	/**
+	 * Sets how many already downloaded pieces may be read from disk at
+	 * once, ahead of the playback position. Zero means no limit other
+	 * than the buffer window.
+	 */
+	void set_read_ahead(int depth);
+
+	/**
+	 * Sets how the following add_torrent calls read pieces that are
+	 * already on disk. DIRECT_READS reads them straight from the files,
+	 * which makes replaying local content independent of libtorrent's
+	 * disk thread.
+	 */
+	void set_read_engine(ReadEngine engine);
+
+	/**
+	 * Sets how the following add_torrent calls verify pieces that are
+	 * already on disk. FAST_START starts streaming as soon as the first
+	 * pieces are hashed, instead of after the whole files were checked.
+	 */
+	void set_startup_mode(StartupMode mode);
+
+	/**
+	 * Makes the following add_torrent calls download the index of videos
+	 * that keep it after the media data (like MP4 files with the moov
+	 * box at the end) before the rest of the file.
+	 */
+	void set_index_first(bool enabled);
+
+	/**
+	 * Returns the offset of the current video's trailing index, or -1 if
+	 * none was found. Pass it to create_reader() to demux the index while
+	 * pieces are played from the head.
+	 */
+	boost::int64_t index_offset();
+
+	/**
+	 * Sets how much media, in milliseconds, has to be buffered ahead of
+	 * playback for the ADAPTIVE algorithm to stop downloading
+	 * sequentially (low) and to pick pieces rarest first (high).
+	 */
+	void set_slack_thresholds(int low, int high);
+
+	/**
+	 * Sets the maximum amount of data, in bytes, kept for the readers
+	 * created by create_cursor(). Zero means no limit besides the
+	 * readers' windows.
+	 */
+	void set_store_capacity(long capacity);
+
+	/**
+	 * Sets how far ahead of playback, in milliseconds, pieces are given
+	 * deadlines by the DEADLINE and ADAPTIVE algorithms.
+	 */
+	void set_deadline_horizon(int horizon);
+
+	/**
+	 * Sets how often, in seconds, the resume data of torrents that
+	 * changed is saved in the background.
+	 */
+	void set_checkpoint_interval(int seconds);
+
 	/**
 	 * Returns a pointer to the next piece that should be played.
 	 *
@@ -120,6 +250,48 @@ public:
 	 */
 	boost::shared_ptr<Piece> get_next_piece();
 
+	/**
+	 * Returns the next piece if it is already available, or NULL
+	 * otherwise. Never blocks.
+	 */
+	boost::shared_ptr<Piece> try_get_next_piece();
+
+	/**
+	 * Same as get_next_piece(), but returns NULL if the piece isn't
+	 * available within the given time.
+	 */
+	boost::shared_ptr<Piece> get_next_piece_for(
+			const boost::posix_time::time_duration& timeout);
+
+	/**
+	 * Returns a file descriptor that becomes readable when
+	 * get_next_piece() wouldn't block, so the stream can be watched by a
+	 * poll/epoll or GLib main loop. See VideoBuffer::get_event_fd().
+	 */
+	int get_event_fd();
+
+	/**
+	 * Same as get_next_piece(), but returns a move-only PieceHandle that
+	 * is empty instead of NULL. See VideoBuffer::get_next_handle().
+	 */
+	PieceHandle get_next_handle();
+
+	/**
+	 * Returns the next consecutive pieces that are available, up to
+	 * max_count pieces and max_bytes bytes, blocking only until the
+	 * first one is. Returns an empty vector when get_next_piece() would
+	 * return NULL. See VideoBuffer::get_next_pieces().
+	 */
+	std::vector<boost::shared_ptr<Piece> > get_next_pieces(int max_count,
+			long max_bytes = 0);
+
+	/**
+	 * Same as get_next_pieces(), but moves the pieces into handles and
+	 * returns how many were filled. See VideoBuffer::get_next_handles().
+	 */
+	int get_next_handles(PieceHandle* handles, int max_count,
+			long max_bytes = 0);
+
 	/**
 	 * Returns a Status object with data like download rate, upload
 	 * rate and progress.
@@ -140,6 +312,16 @@ public:
 	 */
 	void notify_stall();
 
+	/**
+	 * Reports the player's position: media_time milliseconds of the
+	 * stream were played at wall_time (universal time), and playback
+	 * goes on at the given rate. Should be called regularly while
+	 * playing, so that piece deadlines follow the real playback clock.
+	 * A rate of zero means playback is paused.
+	 */
+	void report_position(int media_time,
+			const boost::posix_time::ptime& wall_time, double rate = 1.0);
+
 	/**
 	 * Unlocks any blocked calls to get_next_piece().
 	 */
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DeadlineScheduler.cpp
+ */
+
+#include "deadlinescheduler.h"
+
+#include <algorithm>
+
+namespace btstream {
+
+DeadlineScheduler::DeadlineScheduler(int horizon) :
+		m_num_pieces(0), m_piece_duration(0), m_stream_length(0),
+		m_horizon(boost::posix_time::milliseconds(horizon)),
+		m_playing(false), m_head(0), m_clock_time(0), m_rate(1), m_end(0) {
+}
+
+void DeadlineScheduler::start(int num_pieces, float piece_duration,
+		DeadlineSetter setter, DeadlineResetter resetter) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	m_num_pieces = num_pieces;
+	m_piece_duration = piece_duration;
+	m_piece_times.clear();
+	m_setter = setter;
+	m_resetter = resetter;
+	m_playing = false;
+	m_head = 0;
+	m_end = 0;
+	m_deadlines.clear();
+}
+
+void DeadlineScheduler::play(int head, int buffer_time,
+		const boost::posix_time::ptime& now) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if (!m_setter || (m_piece_times.empty() && m_piece_duration <= 0)) {
+		return;
+	}
+
+	m_head = std::max(0, std::min(head, m_num_pieces));
+	m_clock_time = time(m_head);
+	m_clock_wall_time = now + boost::posix_time::milliseconds(buffer_time);
+	m_rate = 1;
+
+	reschedule(now);
+}
+
+void DeadlineScheduler::report_position(int media_time,
+		const boost::posix_time::ptime& wall_time, double rate) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if (!m_setter || (m_piece_times.empty() && m_piece_duration <= 0)) {
+		return;
+	}
+
+	// Paused or rewinding: deadlines are kept until playback goes on.
+	if (rate <= 0) {
+		m_head = piece_at(media_time);
+		m_clock_time = media_time;
+		m_clock_wall_time = wall_time;
+		m_playing = false;
+		return;
+	}
+
+	m_head = piece_at(media_time);
+	m_clock_time = media_time;
+	m_clock_wall_time = wall_time;
+	m_rate = rate;
+
+	reschedule(wall_time);
+}
+
+/*
+ * Sets the deadlines of the pieces inside the horizon after the playback
+ * clock changed. Only the ones that moved are set again.
+ */
+void DeadlineScheduler::reschedule(const boost::posix_time::ptime& now) {
+	m_playing = true;
+
+	// The head is always scheduled, even if it is due after the horizon.
+	int end = std::min(m_head + 1, m_num_pieces);
+	while (end < m_num_pieces && deadline(end) <= now + m_horizon) {
+		end++;
+	}
+
+	// Pieces that left the horizon, after a seek or a longer buffer.
+	std::map<int, boost::posix_time::ptime>::iterator it = m_deadlines.begin();
+	while (it != m_deadlines.end()) {
+		if (it->first < m_head || it->first >= end) {
+			m_resetter(it->first);
+			m_deadlines.erase(it++);
+		} else {
+			it++;
+		}
+	}
+
+	for (int i = m_head; i < end; i++) {
+		schedule(i, now);
+	}
+
+	m_end = end;
+}
+
+void DeadlineScheduler::set_piece_times(const std::vector<int>& times,
+		int stream_length) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if ((int) times.size() == m_num_pieces) {
+		m_piece_times = times;
+		m_stream_length = stream_length;
+	}
+}
+
+int DeadlineScheduler::duration(int first, int last) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	first = std::max(0, std::min(first, m_num_pieces));
+	last = std::max(first, std::min(last, m_num_pieces));
+
+	return time(last) - time(first);
+}
+
+void DeadlineScheduler::advance(const boost::posix_time::ptime& now) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if (!m_playing) {
+		return;
+	}
+
+	// Deadlines that were reached are left to libtorrent.
+	while (!m_deadlines.empty() && m_deadlines.begin()->second < now) {
+		m_deadlines.erase(m_deadlines.begin());
+	}
+
+	while (m_end < m_num_pieces && deadline(m_end) <= now + m_horizon) {
+		schedule(m_end, now);
+		m_end++;
+	}
+}
+
+void DeadlineScheduler::stop(const boost::posix_time::ptime& now) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if (m_playing) {
+		m_clock_time = position(now);
+		m_clock_wall_time = now;
+	}
+
+	m_playing = false;
+}
+
+void DeadlineScheduler::set_horizon(int horizon,
+		const boost::posix_time::ptime& now) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_horizon = boost::posix_time::milliseconds(horizon);
+
+	// Pieces past the new horizon enter it again through advance(). The
+	// head keeps its deadline. While stopped, play() resets them.
+	if (!m_playing) {
+		return;
+	}
+
+	std::map<int, boost::posix_time::ptime>::iterator it = m_deadlines.begin();
+	while (it != m_deadlines.end()) {
+		if (it->first != m_head && it->second > now + m_horizon) {
+			m_resetter(it->first);
+			m_end = std::min(m_end, it->first);
+			m_deadlines.erase(it++);
+		} else {
+			it++;
+		}
+	}
+}
+
+int DeadlineScheduler::scheduled() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_deadlines.size();
+}
+
+int DeadlineScheduler::slack(const boost::dynamic_bitset<>& have,
+		const boost::posix_time::ptime& now) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if (m_piece_times.empty() && m_piece_duration <= 0) {
+		return -1;
+	}
+
+	int played = position(now);
+	int num_pieces = std::min(m_num_pieces, (int) have.size());
+
+	int end = piece_at(played);
+	while (end < num_pieces && have[end]) {
+		end++;
+	}
+
+	return std::max(0, time(end) - played);
+}
+
+/*
+ * Returns the media time being played now, by the playback clock. The
+ * clock doesn't move before playback starts or while it is stopped.
+ */
+int DeadlineScheduler::position(const boost::posix_time::ptime& now) const {
+	if (!m_playing || now <= m_clock_wall_time) {
+		return m_clock_time;
+	}
+
+	return m_clock_time
+			+ (int) ((now - m_clock_wall_time).total_milliseconds() * m_rate);
+}
+
+/*
+ * Returns when a piece starts playing, from the start of the stream. The
+ * end of the stream is piece m_num_pieces.
+ */
+int DeadlineScheduler::time(int piece) const {
+	if (piece < (int) m_piece_times.size()) {
+		return m_piece_times[piece];
+	}
+
+	if (!m_piece_times.empty()) {
+		return std::max(m_stream_length, m_piece_times.back());
+	}
+
+	return piece * m_piece_duration;
+}
+
+/*
+ * Returns the piece being played at the given media time.
+ */
+int DeadlineScheduler::piece_at(int media_time) const {
+	if (m_num_pieces == 0) {
+		return 0;
+	}
+
+	int piece;
+
+	if (!m_piece_times.empty()) {
+		piece = std::upper_bound(m_piece_times.begin(), m_piece_times.end(),
+				media_time) - m_piece_times.begin() - 1;
+	} else {
+		piece = media_time / m_piece_duration;
+	}
+
+	return std::max(0, std::min(piece, m_num_pieces - 1));
+}
+
+/*
+ * Returns when a piece should be played, by the playback clock.
+ */
+boost::posix_time::ptime DeadlineScheduler::deadline(int piece) const {
+	return m_clock_wall_time
+			+ boost::posix_time::milliseconds(
+					(long) ((time(piece) - m_clock_time) / m_rate));
+}
+
+/*
+ * Sets the deadline of a piece, unless it barely moved since it was last
+ * set.
+ */
+void DeadlineScheduler::schedule(int piece,
+		const boost::posix_time::ptime& now) {
+
+	boost::posix_time::ptime due = deadline(piece);
+
+	std::map<int, boost::posix_time::ptime>::iterator it = m_deadlines.find(
+			piece);
+
+	if (it != m_deadlines.end()) {
+		boost::posix_time::time_duration moved = due - it->second;
+
+		if (moved.abs() < boost::posix_time::milliseconds(
+				DEADLINE_TOLERANCE_MS)) {
+			return;
+		}
+	}
+
+	m_deadlines[piece] = due;
+	m_setter(piece, std::max(0L, (long) (due - now).total_milliseconds()));
+}
+
+} /* namespace btstream */
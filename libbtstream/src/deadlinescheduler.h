@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DeadlineScheduler.h
+ */
+
+#ifndef DEADLINESCHEDULER_H_
+#define DEADLINESCHEDULER_H_
+
+#include <map>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/dynamic_bitset.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace btstream {
+
+/**
+ * Default time span covered by piece deadlines, in milliseconds.
+ */
+const int DEFAULT_DEADLINE_HORIZON_MS = 30000;
+
+/**
+ * Deadlines that move less than this, in milliseconds, are not set
+ * again.
+ */
+const int DEADLINE_TOLERANCE_MS = 500;
+
+/**
+ * Function that sets the deadline of a piece, in milliseconds from now.
+ */
+typedef boost::function<void(int piece, int deadline)> DeadlineSetter;
+
+/**
+ * Function that removes the deadline of a piece.
+ */
+typedef boost::function<void(int piece)> DeadlineResetter;
+
+/**
+ * Keeps piece deadlines for the next few seconds of playback.
+ *
+ * Deadlines are computed from the playback clock, which is set when
+ * playback (re)starts and may be corrected by the player as it goes.
+ * While the clock holds, deadlines don't change: as time
+ * passes, only the pieces entering the horizon are given deadlines.
+ * Pieces are timed by their presentation times if they are known, or
+ * as if the stream had a constant bit rate otherwise. When
+ * playback restarts, only the pieces inside the horizon whose deadlines
+ * moved are set again, and pieces that left it are reset.
+ */
+class DeadlineScheduler {
+public:
+
+	/**
+	 * Constructor.
+	 */
+	DeadlineScheduler(int horizon = DEFAULT_DEADLINE_HORIZON_MS);
+
+	/**
+	 * Sets up the scheduler for a torrent whose pieces play for
+	 * piece_duration milliseconds each. Previous deadlines are
+	 * forgotten, not reset.
+	 */
+	void start(int num_pieces, float piece_duration, DeadlineSetter setter,
+			DeadlineResetter resetter);
+
+	/**
+	 * Sets the presentation time of every piece and the length of the
+	 * stream, in milliseconds. They replace the piece duration from the
+	 * next play() call on.
+	 */
+	void set_piece_times(const std::vector<int>& times, int stream_length);
+
+	/**
+	 * Returns how long pieces first to last (exclusive) play, in
+	 * milliseconds.
+	 */
+	int duration(int first, int last);
+
+	/**
+	 * Playback (re)starts: piece head is due buffer_time milliseconds
+	 * after now, and the following pieces as they are timed. Does
+	 * nothing while pieces can't be timed.
+	 */
+	void play(int head, int buffer_time,
+			const boost::posix_time::ptime& now =
+					boost::posix_time::microsec_clock::universal_time());
+
+	/**
+	 * Sets the playback clock: media_time milliseconds of the stream were
+	 * played at wall_time, and playback goes on at the given rate. The
+	 * pieces whose deadlines drifted are re-timed. A rate of zero or
+	 * less stops playback, as stop() does.
+	 */
+	void report_position(int media_time,
+			const boost::posix_time::ptime& wall_time, double rate = 1.0);
+
+	/**
+	 * Gives deadlines to the pieces that entered the horizon since the
+	 * last call. Does nothing if playback is stopped.
+	 */
+	void advance(
+			const boost::posix_time::ptime& now =
+					boost::posix_time::microsec_clock::universal_time());
+
+	/**
+	 * Playback stalled. Deadlines already set are kept, but the horizon
+	 * stops moving until play() is called. The playback clock is held
+	 * where it is now.
+	 */
+	void stop(
+			const boost::posix_time::ptime& now =
+					boost::posix_time::microsec_clock::universal_time());
+
+	/**
+	 * Sets the time span covered by deadlines, in milliseconds. If it
+	 * shrinks during playback, the deadlines due after the new horizon
+	 * are reset.
+	 */
+	void set_horizon(int horizon,
+			const boost::posix_time::ptime& now =
+					boost::posix_time::microsec_clock::universal_time());
+
+	/**
+	 * Returns the number of pieces whose deadlines weren't reached yet.
+	 */
+	int scheduled();
+
+	/**
+	 * Returns how much media, in milliseconds, is buffered ahead of the
+	 * playback clock: the time until the first piece after it that is
+	 * not in have. Returns -1 while pieces can't be timed.
+	 */
+	int slack(const boost::dynamic_bitset<>& have,
+			const boost::posix_time::ptime& now =
+					boost::posix_time::microsec_clock::universal_time());
+
+private:
+	void reschedule(const boost::posix_time::ptime& now);
+	int time(int piece) const;
+	int piece_at(int media_time) const;
+	int position(const boost::posix_time::ptime& now) const;
+	boost::posix_time::ptime deadline(int piece) const;
+	void schedule(int piece, const boost::posix_time::ptime& now);
+
+	int m_num_pieces;
+	float m_piece_duration;
+	std::vector<int> m_piece_times;
+	int m_stream_length;
+	boost::posix_time::time_duration m_horizon;
+	DeadlineSetter m_setter;
+	DeadlineResetter m_resetter;
+
+	bool m_playing;
+	int m_head;
+
+	// Playback clock: media time m_clock_time is played at
+	// m_clock_wall_time.
+	int m_clock_time;
+	boost::posix_time::ptime m_clock_wall_time;
+	double m_rate;
+
+	// First piece after the horizon.
+	int m_end;
+
+	// Absolute deadlines given to pieces.
+	std::map<int, boost::posix_time::ptime> m_deadlines;
+
+	boost::mutex m_mutex;
+};
+
+} /* namespace btstream */
+
+#endif /* DEADLINESCHEDULER_H_ */
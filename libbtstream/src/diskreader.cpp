@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DiskReader.cpp
+ */
+
+#include "diskreader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace btstream {
+
+/*
+ * Maximum number of files kept open. Torrents with many small files
+ * reopen them as needed.
+ */
+static const size_t MAX_OPEN_FILES = 64;
+
+FileCache::~FileCache() {
+	close_files();
+}
+
+int FileCache::open_file(const std::string& path) {
+	std::map<std::string, int>::iterator it = m_files.find(path);
+	if (it != m_files.end()) {
+		return it->second;
+	}
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	// Pieces are mostly read in order, so a larger read-ahead window
+	// pays off.
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	if (m_files.size() >= MAX_OPEN_FILES) {
+		close_files();
+	}
+
+	m_files[path] = fd;
+
+	return fd;
+}
+
+void FileCache::close_files() {
+	std::map<std::string, int>::iterator it;
+	for (it = m_files.begin(); it != m_files.end(); it++) {
+		close(it->second);
+	}
+
+	m_files.clear();
+}
+
+int read_slices(FileCache& files, const std::vector<FileSlice>& slices,
+		char* buffer) {
+
+	int total = 0;
+
+	for (size_t i = 0; i < slices.size(); i++) {
+		const FileSlice& slice = slices[i];
+
+		int fd = files.open_file(slice.path);
+		if (fd < 0) {
+			return -1;
+		}
+
+		int done = 0;
+		while (done < slice.size) {
+			ssize_t n = pread(fd, buffer + total + done, slice.size - done,
+					slice.offset + done);
+
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+
+			// Errors and short files.
+			if (n <= 0) {
+				return -1;
+			}
+
+			done += n;
+		}
+
+		total += done;
+	}
+
+	return total;
+}
+
+DiskReader::DiskReader() {
+	m_thread = boost::shared_ptr<boost::thread>(
+			new boost::thread(&DiskReader::run, this));
+}
+
+DiskReader::~DiskReader() {
+	m_thread->interrupt();
+	m_thread->join();
+}
+
+void DiskReader::read(int piece, const std::vector<FileSlice>& slices,
+		boost::shared_array<char> buffer, ReadCallback callback,
+		ReadCheck check) {
+
+	Request request;
+	request.piece = piece;
+	request.slices = slices;
+	request.buffer = buffer;
+	request.callback = callback;
+	request.check = check;
+
+	push(request);
+}
+
+void DiskReader::advise(const std::vector<FileSlice>& slices) {
+	// Advice is given by the worker thread, which owns the descriptors.
+	Request request;
+	request.piece = -1;
+	request.slices = slices;
+
+	push(request);
+}
+
+void DiskReader::push(const Request& request) {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_requests.push_back(request);
+	} // Releasing lock.
+
+	m_request_available.notify_one();
+}
+
+void DiskReader::run() {
+	try {
+		while (true) {
+			Request request;
+
+			{
+				boost::unique_lock<boost::mutex> lock(m_mutex);
+
+				while (m_requests.empty()) {
+					m_request_available.wait(lock);
+				}
+
+				request = m_requests.front();
+				m_requests.pop_front();
+			} // Releasing lock.
+
+			if (!request.buffer) {
+				advise_slices(request.slices);
+				continue;
+			}
+
+			int size = read_slices(m_files, request.slices,
+					request.buffer.get());
+
+			if (size >= 0 && request.check
+					&& !request.check(request.piece, request.buffer.get(),
+							size)) {
+				size = -1;
+			}
+
+			if (size < 0) {
+				request.callback(request.piece, boost::shared_array<char>(), 0);
+			} else {
+				request.callback(request.piece, request.buffer, size);
+			}
+		}
+	} catch (boost::thread_interrupted& e) {
+		// Thread will stop.
+	}
+}
+
+void DiskReader::advise_slices(const std::vector<FileSlice>& slices) {
+#ifdef HAVE_POSIX_FADVISE
+	for (size_t i = 0; i < slices.size(); i++) {
+		int fd = m_files.open_file(slices[i].path);
+
+		if (fd >= 0) {
+			posix_fadvise(fd, slices[i].offset, slices[i].size,
+					POSIX_FADV_WILLNEED);
+		}
+	}
+#endif
+}
+
+} /* namespace btstream */
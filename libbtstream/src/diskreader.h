@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DiskReader.h
+ */
+
+#ifndef DISKREADER_H_
+#define DISKREADER_H_
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+namespace btstream {
+
+/**
+ * Part of a piece stored in a file.
+ */
+struct FileSlice {
+	std::string path;
+	boost::int64_t offset;
+	int size;
+};
+
+/**
+ * Read-only file descriptors kept open between reads. Not thread-safe:
+ * each reading thread has its own cache.
+ */
+class FileCache {
+public:
+
+	/**
+	 * Destructor. Closes the files.
+	 */
+	~FileCache();
+
+	/**
+	 * Returns a descriptor for path, opening it if needed, or -1 if it
+	 * can't be opened.
+	 */
+	int open_file(const std::string& path);
+
+	/**
+	 * Closes every file.
+	 */
+	void close_files();
+
+private:
+	std::map<std::string, int> m_files;
+};
+
+/**
+ * Reads every slice in sequence into buffer. Returns the number of bytes
+ * read, or -1 if a file couldn't be read completely.
+ */
+int read_slices(FileCache& files, const std::vector<FileSlice>& slices,
+		char* buffer);
+
+/**
+ * Function called when a read finishes. data is NULL if the read failed.
+ */
+typedef boost::function<void(int piece, boost::shared_array<char> data,
+		int size)> ReadCallback;
+
+/**
+ * Function that checks the data of a piece after it is read, returning
+ * false if it is corrupt.
+ */
+typedef boost::function<bool(int piece, const char* data, int size)> ReadCheck;
+
+/**
+ * Reads pieces straight from the files they are stored in.
+ *
+ * Requests are served in order by a worker thread with pread(), into
+ * buffers given by the caller. Files are kept open between reads and
+ * the kernel is told about sequential access and upcoming reads, so
+ * local content is read at disk speed.
+ */
+class DiskReader {
+public:
+
+	/**
+	 * Constructor. Starts the worker thread.
+	 */
+	DiskReader();
+
+	/**
+	 * Destructor. Pending reads are dropped and files are closed.
+	 */
+	~DiskReader();
+
+	/**
+	 * Queues the read of a piece made of the given slices into buffer,
+	 * which must hold their total size. callback is called from the
+	 * worker thread. If check is given, data it rejects is reported as
+	 * a failed read.
+	 */
+	void read(int piece, const std::vector<FileSlice>& slices,
+			boost::shared_array<char> buffer, ReadCallback callback,
+			ReadCheck check = ReadCheck());
+
+	/**
+	 * Tells the kernel that the given slices will be read soon, so they
+	 * can be read ahead.
+	 */
+	void advise(const std::vector<FileSlice>& slices);
+
+private:
+	struct Request {
+		int piece;
+		std::vector<FileSlice> slices;
+		boost::shared_array<char> buffer;
+		ReadCallback callback;
+		ReadCheck check;
+	};
+
+	void push(const Request& request);
+	void run();
+	void advise_slices(const std::vector<FileSlice>& slices);
+
+	// Only used by the worker thread.
+	FileCache m_files;
+
+	std::deque<Request> m_requests;
+	boost::shared_ptr<boost::thread> m_thread;
+
+	boost::mutex m_mutex;
+	boost::condition_variable m_request_available;
+};
+
+} /* namespace btstream */
+
+#endif /* DISKREADER_H_ */
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MappedFile.cpp
+ */
+
+#include "mappedfile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace btstream {
+
+MappedFile::MappedFile(const std::string& path) throw (Exception) :
+		m_size(0) {
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw Exception("Could not open file " + path);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0
+			|| (boost::uint64_t) st.st_size > (size_t) -1) {
+		close(fd);
+		throw Exception("Could not map file " + path);
+	}
+
+	void* data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	// The mapping keeps the file referenced.
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		throw Exception("Could not map file " + path);
+	}
+
+	// Pieces are mostly read in order.
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	m_data = boost::shared_array<char>((char*) data, Unmapper(st.st_size));
+	m_size = st.st_size;
+}
+
+boost::int64_t MappedFile::size() const {
+	return m_size;
+}
+
+boost::shared_array<char> MappedFile::view(boost::int64_t offset,
+		int size) const {
+
+	if (offset < 0 || size <= 0 || offset + size > m_size) {
+		return boost::shared_array<char>();
+	}
+
+	// Shares the mapping's reference count.
+	return boost::shared_array<char>(m_data, m_data.get() + offset);
+}
+
+MappedFile::Unmapper::Unmapper(size_t size) :
+		m_size(size) {
+}
+
+void MappedFile::Unmapper::operator()(char* data) {
+	munmap(data, m_size);
+}
+
+} /* namespace btstream */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MappedFile.h
+ */
+
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_array.hpp>
+
+#include "exception.h"
+
+namespace btstream {
+
+/**
+ * Read-only memory mapping of a whole file.
+ *
+ * Views share ownership of the mapping, so pieces can point straight
+ * into it: no memory is allocated or copied per view, and the file stays
+ * mapped until the last view and the MappedFile are gone.
+ */
+class MappedFile {
+public:
+
+	/**
+	 * Maps the given file.
+	 * @throw Exception if the file can't be opened or mapped.
+	 */
+	MappedFile(const std::string& path) throw (Exception);
+
+	/**
+	 * Returns the size of the file, in bytes.
+	 */
+	boost::int64_t size() const;
+
+	/**
+	 * Returns a view of the file starting at offset, or a NULL array if
+	 * [offset, offset + size) isn't inside the file.
+	 */
+	boost::shared_array<char> view(boost::int64_t offset, int size) const;
+
+private:
+
+	/*
+	 * Unmaps the file when the last reference is gone.
+	 */
+	class Unmapper {
+	public:
+		Unmapper(size_t size);
+		void operator()(char* data);
+
+	private:
+		size_t m_size;
+	};
+
+	boost::shared_array<char> m_data;
+	boost::int64_t m_size;
+};
+
+} /* namespace btstream */
+
+#endif /* MAPPEDFILE_H_ */
@@ -0,0 +1,992 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MediaIndex.cpp
+ */
+
+#include "mediaindex.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace btstream {
+
+static const int TS_PACKET_SIZE = 188;
+
+/*
+ * Size of the data scanned for a PCR at each MPEG-TS sample.
+ */
+static const int TS_SCAN_SIZE = 256 * TS_PACKET_SIZE;
+
+/*
+ * Time after which the 33 bit PCR base wraps, in milliseconds.
+ */
+static const boost::int64_t PCR_WRAP_MS = ((boost::int64_t) 1 << 33) / 90;
+
+// Matroska element IDs.
+static const boost::uint64_t EBML_HEADER = 0x1A45DFA3;
+static const boost::uint64_t SEGMENT = 0x18538067;
+static const boost::uint64_t SEEK_HEAD = 0x114D9B74;
+static const boost::uint64_t SEEK = 0x4DBB;
+static const boost::uint64_t SEEK_ID = 0x53AB;
+static const boost::uint64_t SEEK_POSITION = 0x53AC;
+static const boost::uint64_t INFO = 0x1549A966;
+static const boost::uint64_t TIMECODE_SCALE = 0x2AD7B1;
+static const boost::uint64_t DURATION = 0x4489;
+static const boost::uint64_t CLUSTER = 0x1F43B675;
+static const boost::uint64_t CUES = 0x1C53BB6B;
+static const boost::uint64_t CUE_POINT = 0xBB;
+static const boost::uint64_t CUE_TIME = 0xB3;
+static const boost::uint64_t CUE_TRACK_POSITIONS = 0xB7;
+static const boost::uint64_t CUE_CLUSTER_POSITION = 0xF1;
+
+static boost::uint32_t read_u32(const char* data) {
+	const unsigned char* bytes = (const unsigned char*) data;
+
+	return ((boost::uint32_t) bytes[0] << 24) | ((boost::uint32_t) bytes[1] << 16)
+			| ((boost::uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+static boost::uint64_t read_u64(const char* data) {
+	return ((boost::uint64_t) read_u32(data) << 32) | read_u32(data + 4);
+}
+
+/*
+ * An MP4 box or a Matroska element inside a buffer.
+ */
+struct Box {
+	boost::uint64_t type;
+	const char* body;
+	size_t size;
+};
+
+/*
+ * Splits the body of an MP4 container box into its children.
+ */
+static std::vector<Box> child_boxes(const char* data, size_t size) {
+	std::vector<Box> boxes;
+	size_t offset = 0;
+
+	while (offset + 8 <= size) {
+		boost::uint64_t box_size = read_u32(data + offset);
+		size_t header = 8;
+
+		if (box_size == 1) {
+			if (offset + 16 > size) {
+				break;
+			}
+
+			box_size = read_u64(data + offset + 8);
+			header = 16;
+
+		} else if (box_size == 0) {
+			// Extends to the end of its parent.
+			box_size = size - offset;
+		}
+
+		if (box_size < header || box_size > size - offset) {
+			break;
+		}
+
+		Box box;
+		box.type = read_u32(data + offset + 4);
+		box.body = data + offset + header;
+		box.size = box_size - header;
+		boxes.push_back(box);
+
+		offset += box_size;
+	}
+
+	return boxes;
+}
+
+/*
+ * Returns the four character code of an MP4 box type.
+ */
+static boost::uint64_t box_type(const char* name) {
+	return read_u32(name);
+}
+
+/*
+ * Finds the first child of the given type inside an MP4 box body.
+ */
+static bool find_box(const char* data, size_t size, const char* type,
+		Box& box) {
+
+	std::vector<Box> boxes = child_boxes(data, size);
+
+	for (size_t i = 0; i < boxes.size(); i++) {
+		if (boxes[i].type == box_type(type)) {
+			box = boxes[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Reads an EBML variable size integer. The length marker is kept in IDs
+ * and removed from sizes. Returns its length, or 0 if it is invalid.
+ */
+static int read_vint(const char* data, size_t size, bool keep_marker,
+		boost::uint64_t& value) {
+
+	if (size == 0) {
+		return 0;
+	}
+
+	unsigned char first = data[0];
+	unsigned char mask = 0x80;
+	int length = 1;
+
+	while (length <= 8 && !(first & mask)) {
+		mask >>= 1;
+		length++;
+	}
+
+	if (length > 8 || (size_t) length > size) {
+		return 0;
+	}
+
+	value = keep_marker ? first : (first & (mask - 1));
+	for (int i = 1; i < length; i++) {
+		value = (value << 8) | (unsigned char) data[i];
+	}
+
+	return length;
+}
+
+/*
+ * Reads the ID and size of the Matroska element at the start of data.
+ * unknown is set if the element doesn't declare its size.
+ */
+static int read_element_header(const char* data, size_t size,
+		boost::uint64_t& id, boost::uint64_t& length, bool& unknown) {
+
+	int id_length = read_vint(data, size, true, id);
+	if (id_length == 0) {
+		return 0;
+	}
+
+	int size_length = read_vint(data + id_length, size - id_length, false,
+			length);
+	if (size_length == 0) {
+		return 0;
+	}
+
+	unknown = length == ((boost::uint64_t) 1 << (7 * size_length)) - 1;
+
+	return id_length + size_length;
+}
+
+/*
+ * Splits the body of a Matroska master element into its children.
+ */
+static std::vector<Box> child_elements(const char* data, size_t size) {
+	std::vector<Box> elements;
+	size_t offset = 0;
+
+	while (offset < size) {
+		Box element;
+		boost::uint64_t length;
+		bool unknown;
+
+		int header = read_element_header(data + offset, size - offset,
+				element.type, length, unknown);
+
+		if (header == 0 || unknown || length > size - offset - header) {
+			break;
+		}
+
+		element.body = data + offset + header;
+		element.size = length;
+		elements.push_back(element);
+
+		offset += header + length;
+	}
+
+	return elements;
+}
+
+static boost::uint64_t read_uint(const char* data, size_t size) {
+	boost::uint64_t value = 0;
+
+	for (size_t i = 0; i < size && i < 8; i++) {
+		value = (value << 8) | (unsigned char) data[i];
+	}
+
+	return value;
+}
+
+static double read_float(const char* data, size_t size) {
+	if (size == 4) {
+		boost::uint32_t bits = read_u32(data);
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+
+		return value;
+
+	} else if (size == 8) {
+		boost::uint64_t bits = read_u64(data);
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+
+		return value;
+	}
+
+	return 0;
+}
+
+static bool offset_before(boost::int64_t offset, const IndexPoint& point) {
+	return offset < point.offset;
+}
+
+static bool point_before(const IndexPoint& a, const IndexPoint& b) {
+	return a.offset < b.offset;
+}
+
+/*
+ * Returns the Cues position, relative to the segment data, in the
+ * children of a SeekHead. Returns -1 if there is none.
+ */
+static boost::int64_t find_cues_position(const char* data, size_t size) {
+	boost::int64_t cues_position = -1;
+	std::vector<Box> seeks = child_elements(data, size);
+
+	for (size_t i = 0; i < seeks.size(); i++) {
+		if (seeks[i].type != SEEK) {
+			continue;
+		}
+
+		std::vector<Box> fields = child_elements(seeks[i].body, seeks[i].size);
+
+		boost::uint64_t seek_id = 0;
+		boost::int64_t position = -1;
+
+		for (size_t j = 0; j < fields.size(); j++) {
+			if (fields[j].type == SEEK_ID) {
+				seek_id = read_uint(fields[j].body, fields[j].size);
+			} else if (fields[j].type == SEEK_POSITION) {
+				position = read_uint(fields[j].body, fields[j].size);
+			}
+		}
+
+		if (seek_id == CUES) {
+			cues_position = position;
+		}
+	}
+
+	return cues_position;
+}
+
+bool find_trailing_index(const char* head, int size, boost::int64_t file_size,
+		boost::int64_t& index_offset) {
+
+	if (size < 8) {
+		return false;
+	}
+
+	boost::uint64_t id;
+	boost::uint64_t length;
+	bool unknown;
+
+	if (read_u32(head) == EBML_HEADER) {
+		// EBML header, then the segment and its first children.
+		// The Segment header must start inside the head.
+		int header = read_element_header(head, size, id, length, unknown);
+		if (header == 0 || unknown
+				|| header + length >= (boost::uint64_t) size) {
+			return false;
+		}
+
+		size_t offset = header + length;
+		header = read_element_header(head + offset, size - offset, id, length,
+				unknown);
+		if (header == 0 || id != SEGMENT) {
+			return false;
+		}
+
+		boost::int64_t segment_start = offset + header;
+		offset = segment_start;
+
+		while ((int) offset < size) {
+			header = read_element_header(head + offset, size - offset, id,
+					length, unknown);
+			if (header == 0 || unknown || id == CLUSTER
+					|| length > size - offset - header) {
+				return false;
+			}
+
+			if (id == SEEK_HEAD) {
+				boost::int64_t cues = find_cues_position(head + offset + header,
+						length);
+
+				if (cues < 0 || segment_start + cues < size) {
+					return false;
+				}
+
+				index_offset = segment_start + cues;
+				return index_offset < file_size;
+			}
+
+			offset += header + length;
+		}
+
+		return false;
+	}
+
+	// MP4 top level boxes.
+	boost::int64_t offset = 0;
+
+	while (offset + 8 <= size) {
+		boost::uint64_t box_size = read_u32(head + offset);
+		boost::uint64_t type = read_u32(head + offset + 4);
+
+		if (box_size == 1) {
+			if (offset + 16 > size) {
+				return false;
+			}
+
+			box_size = read_u64(head + offset + 8);
+
+		} else if (box_size == 0) {
+			box_size = file_size - offset;
+		}
+
+		if (type == box_type("moov") || box_size < 8) {
+			return false;
+		}
+
+		if (type == box_type("mdat")) {
+			index_offset = offset + box_size;
+			return index_offset < file_size;
+		}
+
+		offset += box_size;
+	}
+
+	return false;
+}
+
+MediaIndex::MediaIndex() :
+		m_size(0), m_container(UNKNOWN_CONTAINER), m_duration(0), m_complete(
+				true) {
+}
+
+bool MediaIndex::parse(ByteSource source, boost::int64_t size,
+		RangeCheck available) {
+	m_source = source;
+	m_available = available;
+	m_size = size;
+	m_container = UNKNOWN_CONTAINER;
+	m_duration = 0;
+	m_complete = true;
+	m_points.clear();
+
+	std::vector<char> head;
+	if (size < 8
+			|| !read(0,
+					(int) std::min<boost::int64_t>(size, TS_PACKET_SIZE + 1),
+					head)) {
+		return false;
+	}
+
+	bool parsed = false;
+
+	if (read_u32(&head[0]) == EBML_HEADER) {
+		m_container = MATROSKA_CONTAINER;
+		parsed = parse_matroska();
+
+	} else if ((unsigned char) head[0] == 0x47
+			&& (head.size() <= (size_t) TS_PACKET_SIZE
+					|| (unsigned char) head[TS_PACKET_SIZE] == 0x47)) {
+		m_container = MPEG_TS_CONTAINER;
+		parsed = parse_mpeg_ts();
+
+	} else {
+		// Files start with one of the top level boxes.
+		boost::uint64_t type = read_u32(&head[4]);
+
+		if (type == box_type("ftyp") || type == box_type("moov")
+				|| type == box_type("mdat") || type == box_type("free")
+				|| type == box_type("skip") || type == box_type("wide")) {
+			m_container = MP4_CONTAINER;
+			parsed = parse_mp4();
+		}
+	}
+
+	if (!parsed || m_points.empty()) {
+		m_points.clear();
+		return false;
+	}
+
+	std::stable_sort(m_points.begin(), m_points.end(), point_before);
+
+	if (m_duration <= 0) {
+		m_duration = m_points.back().time;
+	}
+
+	return true;
+}
+
+bool MediaIndex::complete() const {
+	return m_complete;
+}
+
+Container MediaIndex::container() const {
+	return m_container;
+}
+
+int MediaIndex::duration() const {
+	return m_duration;
+}
+
+const std::vector<IndexPoint>& MediaIndex::points() const {
+	return m_points;
+}
+
+int MediaIndex::time_at(boost::int64_t offset) const {
+	if (m_points.empty()) {
+		return 0;
+	}
+
+	std::vector<IndexPoint>::const_iterator next = std::upper_bound(
+			m_points.begin(), m_points.end(), offset, offset_before);
+
+	if (next == m_points.begin()) {
+		return next->time;
+	}
+
+	const IndexPoint& previous = *(next - 1);
+
+	// After the last point, the stream ends with the file.
+	boost::int64_t next_offset = m_size;
+	int next_time = std::max(m_duration, previous.time);
+
+	if (next != m_points.end()) {
+		next_offset = next->offset;
+		next_time = next->time;
+	}
+
+	if (next_offset <= previous.offset || offset >= next_offset) {
+		return next_offset <= previous.offset ? previous.time : next_time;
+	}
+
+	return previous.time
+			+ (int) ((double) (offset - previous.offset)
+					* (next_time - previous.time)
+					/ (next_offset - previous.offset));
+}
+
+std::vector<int> MediaIndex::piece_times(boost::int64_t file_offset,
+		int piece_length, int num_pieces) const {
+
+	std::vector<int> times(num_pieces);
+
+	for (int i = 0; i < num_pieces; i++) {
+		boost::int64_t offset = (boost::int64_t) i * piece_length
+				- file_offset;
+
+		times[i] = time_at(std::max<boost::int64_t>(0,
+				std::min<boost::int64_t>(offset, m_size)));
+
+		if (i > 0) {
+			times[i] = std::max(times[i], times[i - 1]);
+		}
+	}
+
+	return times;
+}
+
+bool MediaIndex::read(boost::int64_t offset, int size,
+		std::vector<char>& data) {
+
+	if (offset < 0 || size < 0 || offset + size > m_size) {
+		return false;
+	}
+
+	data.resize(size);
+
+	return size == 0 || m_source(offset, size, &data[0]) == size;
+}
+
+/*
+ * Finds the moov box among the top level boxes, which may be after the
+ * media data, and reads the chunk times of its video track. Tracks of
+ * other kinds are used if there is no video.
+ */
+bool MediaIndex::parse_mp4() {
+	boost::int64_t offset = 0;
+	std::vector<char> header;
+
+	while (offset + 8 <= m_size) {
+		int header_size = (int) std::min<boost::int64_t>(16, m_size - offset);
+		if (!read(offset, header_size, header)) {
+			return false;
+		}
+
+		boost::uint64_t size = read_u32(&header[0]);
+		int skip = 8;
+
+		if (size == 1) {
+			if (header_size < 16) {
+				return false;
+			}
+
+			size = read_u64(&header[8]);
+			skip = 16;
+
+		} else if (size == 0) {
+			size = m_size - offset;
+		}
+
+		if (size < (boost::uint64_t) skip) {
+			return false;
+		}
+
+		if (read_u32(&header[4]) != box_type("moov")) {
+			offset += size;
+			continue;
+		}
+
+		if (size - skip > (boost::uint64_t) MAX_INDEX_SIZE) {
+			return false;
+		}
+
+		std::vector<char> moov;
+		if (!read(offset + skip, size - skip, moov) || moov.empty()) {
+			return false;
+		}
+
+		std::vector<Box> boxes = child_boxes(&moov[0], moov.size());
+
+		std::vector<IndexPoint> other_points;
+		int other_duration = 0;
+
+		for (size_t i = 0; i < boxes.size(); i++) {
+			if (boxes[i].type != box_type("trak")) {
+				continue;
+			}
+
+			m_points.clear();
+			bool video;
+
+			if (parse_mp4_track(boxes[i].body, boxes[i].size, video)) {
+				if (video) {
+					return true;
+				}
+
+				if (other_points.empty()) {
+					other_points.swap(m_points);
+					other_duration = m_duration;
+				}
+			}
+		}
+
+		m_points.swap(other_points);
+		m_duration = other_duration;
+
+		return !m_points.empty();
+	}
+
+	return false;
+}
+
+/*
+ * Reads the offset and presentation time of every chunk of a track.
+ */
+bool MediaIndex::parse_mp4_track(const char* data, size_t size,
+		bool& video) {
+
+	Box mdia, mdhd, hdlr, minf, stbl, stts, stsc, chunks;
+
+	if (!find_box(data, size, "mdia", mdia)
+			|| !find_box(mdia.body, mdia.size, "mdhd", mdhd)
+			|| !find_box(mdia.body, mdia.size, "minf", minf)
+			|| !find_box(minf.body, minf.size, "stbl", stbl)
+			|| !find_box(stbl.body, stbl.size, "stts", stts)
+			|| !find_box(stbl.body, stbl.size, "stsc", stsc)) {
+		return false;
+	}
+
+	bool large_offsets = false;
+	if (!find_box(stbl.body, stbl.size, "stco", chunks)) {
+		if (!find_box(stbl.body, stbl.size, "co64", chunks)) {
+			return false;
+		}
+
+		large_offsets = true;
+	}
+
+	video = find_box(mdia.body, mdia.size, "hdlr", hdlr) && hdlr.size >= 12
+			&& read_u32(hdlr.body + 8) == box_type("vide");
+
+	// Version 1 boxes have 64 bit times.
+	boost::uint64_t timescale;
+	boost::uint64_t duration;
+
+	if (mdhd.size >= 1 && mdhd.body[0] == 1) {
+		if (mdhd.size < 32) {
+			return false;
+		}
+
+		timescale = read_u32(mdhd.body + 20);
+		duration = read_u64(mdhd.body + 24);
+
+	} else {
+		if (mdhd.size < 20) {
+			return false;
+		}
+
+		timescale = read_u32(mdhd.body + 12);
+		duration = read_u32(mdhd.body + 16);
+	}
+
+	if (timescale == 0 || stts.size < 8 || stsc.size < 8 || chunks.size < 8) {
+		return false;
+	}
+
+	boost::uint64_t stts_count = read_u32(stts.body + 4);
+	boost::uint64_t stsc_count = read_u32(stsc.body + 4);
+	boost::uint64_t num_chunks = read_u32(chunks.body + 4);
+	int offset_size = large_offsets ? 8 : 4;
+
+	if (stts.size < 8 + stts_count * 8 || stsc.size < 8 + stsc_count * 12
+			|| chunks.size < 8 + num_chunks * offset_size) {
+		return false;
+	}
+
+	size_t stsc_entry = 0;
+	size_t stts_entry = 0;
+	boost::uint32_t stts_used = 0;
+	boost::uint64_t time = 0;
+
+	for (boost::uint64_t chunk = 1; chunk <= num_chunks; chunk++) {
+		// The stsc entry covering this chunk.
+		while (stsc_entry + 1 < stsc_count
+				&& read_u32(stsc.body + 8 + (stsc_entry + 1) * 12) <= chunk) {
+			stsc_entry++;
+		}
+
+		boost::uint32_t samples =
+				stsc_count > 0 ? read_u32(stsc.body + 8 + stsc_entry * 12 + 4) : 0;
+
+		const char* entry = chunks.body + 8 + (chunk - 1) * offset_size;
+
+		IndexPoint point;
+		point.offset = large_offsets ? read_u64(entry) : read_u32(entry);
+		point.time = time * 1000 / timescale;
+		m_points.push_back(point);
+
+		// Moves the time past the samples of this chunk.
+		while (samples > 0 && stts_entry < stts_count) {
+			const char* stts_item = stts.body + 8 + stts_entry * 8;
+			boost::uint32_t count = read_u32(stts_item);
+			boost::uint32_t used = std::min(samples, count - stts_used);
+
+			time += (boost::uint64_t) used * read_u32(stts_item + 4);
+			samples -= used;
+			stts_used += used;
+
+			if (stts_used >= count) {
+				stts_entry++;
+				stts_used = 0;
+			}
+		}
+	}
+
+	m_duration = (duration > 0 ? duration : time) * 1000 / timescale;
+
+	return true;
+}
+
+/*
+ * Reads the Cues of a Matroska segment. The SeekHead is used to jump to
+ * them, so clusters are only walked if it is missing.
+ */
+bool MediaIndex::parse_matroska() {
+	std::vector<char> header;
+	boost::uint64_t id;
+	boost::uint64_t length;
+	bool unknown;
+
+	// EBML header, followed by the segment.
+	boost::int64_t offset = 0;
+	int header_length = 0;
+
+	if (!read(offset, (int) std::min<boost::int64_t>(12, m_size), header)
+			|| (header_length = read_element_header(&header[0], header.size(),
+					id, length, unknown)) == 0 || unknown) {
+		return false;
+	}
+
+	offset = header_length + length;
+
+	if (offset >= m_size
+			|| !read(offset,
+					(int) std::min<boost::int64_t>(12, m_size - offset),
+					header)
+			|| (header_length = read_element_header(&header[0], header.size(),
+					id, length, unknown)) == 0 || id != SEGMENT) {
+		return false;
+	}
+
+	boost::int64_t segment_start = offset + header_length;
+	boost::int64_t segment_end =
+			unknown ? m_size :
+					std::min<boost::int64_t>(m_size, segment_start + length);
+
+	boost::uint64_t scale = 1000000;
+	double duration = 0;
+	boost::int64_t cues_position = -1;
+	std::vector<char> cues;
+
+	offset = segment_start;
+
+	while (offset < segment_end && cues.empty()) {
+		if (!read(offset,
+				(int) std::min<boost::int64_t>(12, segment_end - offset),
+				header)
+				|| (header_length = read_element_header(&header[0],
+						header.size(), id, length, unknown)) == 0) {
+			break;
+		}
+
+		// Clusters make most of the file, so they are skipped when the
+		// Cues position is known.
+		if (id == CLUSTER && cues_position >= 0
+				&& segment_start + cues_position > offset) {
+			offset = segment_start + cues_position;
+			continue;
+		}
+
+		if (unknown) {
+			break;
+		}
+
+		boost::int64_t body = offset + header_length;
+
+		if (id == SEEK_HEAD || id == INFO || id == CUES) {
+			std::vector<char> element;
+
+			if (length == 0 || length > (boost::uint64_t) MAX_INDEX_SIZE
+					|| !read(body, length, element)) {
+				break;
+			}
+
+			if (id == SEEK_HEAD) {
+				cues_position = find_cues_position(&element[0],
+						element.size());
+
+			} else if (id == INFO) {
+				parse_matroska_info(&element[0], element.size(), scale,
+						duration);
+
+			} else {
+				cues.swap(element);
+			}
+		}
+
+		offset = body + length;
+	}
+
+	if (cues.empty()) {
+		return false;
+	}
+
+	parse_matroska_cues(&cues[0], cues.size(), segment_start, scale);
+
+	if (duration > 0) {
+		m_duration = duration * scale / 1000000;
+	}
+
+	return !m_points.empty();
+}
+
+void MediaIndex::parse_matroska_info(const char* data, size_t size,
+		boost::uint64_t& scale, double& duration) {
+
+	std::vector<Box> fields = child_elements(data, size);
+
+	for (size_t i = 0; i < fields.size(); i++) {
+		if (fields[i].type == TIMECODE_SCALE) {
+			scale = read_uint(fields[i].body, fields[i].size);
+		} else if (fields[i].type == DURATION) {
+			duration = read_float(fields[i].body, fields[i].size);
+		}
+	}
+
+	if (scale == 0) {
+		scale = 1000000;
+	}
+}
+
+/*
+ * Adds a point for every cue, at the start of the cluster it refers to.
+ */
+void MediaIndex::parse_matroska_cues(const char* data, size_t size,
+		boost::int64_t segment_start, boost::uint64_t scale) {
+
+	std::vector<Box> cue_points = child_elements(data, size);
+
+	for (size_t i = 0; i < cue_points.size(); i++) {
+		if (cue_points[i].type != CUE_POINT) {
+			continue;
+		}
+
+		std::vector<Box> fields = child_elements(cue_points[i].body,
+				cue_points[i].size);
+
+		boost::uint64_t time = 0;
+		boost::int64_t position = -1;
+
+		for (size_t j = 0; j < fields.size(); j++) {
+			if (fields[j].type == CUE_TIME) {
+				time = read_uint(fields[j].body, fields[j].size);
+
+			} else if (fields[j].type == CUE_TRACK_POSITIONS && position < 0) {
+				std::vector<Box> positions = child_elements(fields[j].body,
+						fields[j].size);
+
+				for (size_t k = 0; k < positions.size(); k++) {
+					if (positions[k].type == CUE_CLUSTER_POSITION) {
+						position = read_uint(positions[k].body,
+								positions[k].size);
+					}
+				}
+			}
+		}
+
+		if (position >= 0) {
+			IndexPoint point;
+			point.offset = segment_start + position;
+			point.time = time * scale / 1000000;
+			m_points.push_back(point);
+		}
+	}
+}
+
+/*
+ * Samples the file at regular intervals and reads the first PCR of the
+ * program clock's PID at each place.
+ */
+bool MediaIndex::parse_mpeg_ts() {
+	boost::int64_t packets = std::max<boost::int64_t>(0,
+			m_size - TS_SCAN_SIZE) / TS_PACKET_SIZE;
+
+	int pcr_pid = -1;
+	boost::int64_t first_pcr = -1;
+	boost::int64_t last_offset = -1;
+	std::vector<char> data;
+
+	for (int i = 0; i <= TS_SAMPLES; i++) {
+		boost::int64_t offset = packets * i / TS_SAMPLES * TS_PACKET_SIZE;
+
+		// Small files have fewer places to sample.
+		if (offset == last_offset) {
+			continue;
+		}
+
+		last_offset = offset;
+		int size = (int) std::min<boost::int64_t>(TS_SCAN_SIZE,
+				m_size - offset);
+
+		// The first sample gives the reference PCR, so it is always read.
+		if (i > 0 && m_available && !m_available(offset, size)) {
+			m_complete = false;
+			continue;
+		}
+
+		if (!read(offset, size, data)) {
+			continue;
+		}
+
+		// The last sample ends with the file, so its last PCR is used.
+		bool last_sample = i == TS_SAMPLES;
+		bool found = false;
+
+		for (int p = 0; p + TS_PACKET_SIZE <= size; p += TS_PACKET_SIZE) {
+			const unsigned char* packet = (const unsigned char*) &data[p];
+
+			// Sync was lost.
+			if (packet[0] != 0x47) {
+				break;
+			}
+
+			int pid = ((packet[1] & 0x1f) << 8) | packet[2];
+			bool has_pcr = (packet[3] & 0x20) && packet[4] >= 7
+					&& (packet[5] & 0x10);
+
+			if (!has_pcr || (pcr_pid >= 0 && pid != pcr_pid)) {
+				continue;
+			}
+
+			pcr_pid = pid;
+
+			// 90 kHz base; the 27 MHz extension is below a millisecond.
+			boost::int64_t base = ((boost::int64_t) packet[6] << 25)
+					| (packet[7] << 17) | (packet[8] << 9) | (packet[9] << 1)
+					| (packet[10] >> 7);
+			boost::int64_t pcr = base / 90;
+
+			if (first_pcr < 0) {
+				first_pcr = pcr;
+			}
+
+			boost::int64_t time = pcr - first_pcr;
+			if (time < 0) {
+				time += PCR_WRAP_MS;
+			}
+
+			IndexPoint point;
+			point.offset = offset + p;
+			point.time = time;
+
+			if (found) {
+				m_points.back() = point;
+			} else {
+				m_points.push_back(point);
+				found = true;
+			}
+
+			if (!last_sample) {
+				break;
+			}
+		}
+	}
+
+	if (m_points.size() < 2) {
+		return false;
+	}
+
+	// The rest of the file is assumed to have the rate of the last
+	// interval.
+	const IndexPoint& last = m_points.back();
+	const IndexPoint& previous = m_points[m_points.size() - 2];
+
+	m_duration = last.time;
+	if (last.offset > previous.offset) {
+		m_duration += (double) (m_size - last.offset)
+				* (last.time - previous.time) / (last.offset - previous.offset);
+	}
+
+	return true;
+}
+
+} /* namespace btstream */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MediaIndex.h
+ */
+
+#ifndef MEDIAINDEX_H_
+#define MEDIAINDEX_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+namespace btstream {
+
+/**
+ * Containers understood by MediaIndex.
+ */
+enum Container {
+	UNKNOWN_CONTAINER, MP4_CONTAINER, MATROSKA_CONTAINER, MPEG_TS_CONTAINER
+};
+
+/**
+ * Presentation time, in milliseconds, of the data at a byte offset.
+ */
+struct IndexPoint {
+	boost::int64_t offset;
+	int time;
+};
+
+/**
+ * Function that reads size bytes at offset into buffer, returning the
+ * number of bytes read. May block until the data is available.
+ */
+typedef boost::function<int(boost::int64_t offset, int size, char* buffer)> ByteSource;
+
+/**
+ * Function that tells whether size bytes at offset can be read without
+ * waiting for them.
+ */
+typedef boost::function<bool(boost::int64_t offset, int size)> RangeCheck;
+
+/**
+ * Maximum size of an index (MP4 moov box or Matroska Cues) that is read.
+ */
+const int MAX_INDEX_SIZE = 64 * 1024 * 1024;
+
+/**
+ * Number of places where an MPEG-TS file is sampled for PCRs.
+ */
+const int TS_SAMPLES = 64;
+
+/**
+ * Looks at the first size bytes of a media file for an index stored
+ * after the media data: an MP4 moov box following the mdat box, or
+ * Matroska Cues that the SeekHead places past these bytes. If there is
+ * one, sets index_offset to where the index (or the data after the
+ * media) starts and returns true.
+ */
+bool find_trailing_index(const char* head, int size, boost::int64_t file_size,
+		boost::int64_t& index_offset);
+
+/**
+ * Maps byte offsets of a media file to presentation times.
+ *
+ * The table is read from the container's own index: the chunk offsets
+ * and sample times of an MP4 video track, the Cues of a Matroska file,
+ * or PCRs sampled along an MPEG-TS file. Only the bytes holding the
+ * index are read, so pieces can be timed before they are downloaded.
+ */
+class MediaIndex {
+public:
+
+	/**
+	 * Constructor. The index is empty.
+	 */
+	MediaIndex();
+
+	/**
+	 * Reads the index of the file of the given size. Returns false if
+	 * the container isn't known or its index couldn't be read.
+	 *
+	 * If available is set, MPEG-TS samples past the first one are only
+	 * read when available returns true for them; the others are skipped
+	 * and complete() returns false.
+	 */
+	bool parse(ByteSource source, boost::int64_t size,
+			RangeCheck available = RangeCheck());
+
+	/**
+	 * Returns false if samples were skipped by the last parse, in which
+	 * case parsing again once more data is available refines the index.
+	 */
+	bool complete() const;
+
+	/**
+	 * Returns the container of the parsed file.
+	 */
+	Container container() const;
+
+	/**
+	 * Returns the length of the stream, in milliseconds.
+	 */
+	int duration() const;
+
+	/**
+	 * Returns the index points, sorted by offset.
+	 */
+	const std::vector<IndexPoint>& points() const;
+
+	/**
+	 * Returns the presentation time of the data at offset, interpolated
+	 * between index points.
+	 */
+	int time_at(boost::int64_t offset) const;
+
+	/**
+	 * Returns the presentation time at the start of every piece of a
+	 * torrent where the file starts at file_offset. Times never
+	 * decrease.
+	 */
+	std::vector<int> piece_times(boost::int64_t file_offset, int piece_length,
+			int num_pieces) const;
+
+private:
+	bool read(boost::int64_t offset, int size, std::vector<char>& data);
+	bool parse_mp4();
+	bool parse_mp4_track(const char* data, size_t size, bool& video);
+	bool parse_matroska();
+	void parse_matroska_info(const char* data, size_t size,
+			boost::uint64_t& scale, double& duration);
+	void parse_matroska_cues(const char* data, size_t size,
+			boost::int64_t segment_start, boost::uint64_t scale);
+	bool parse_mpeg_ts();
+
+	ByteSource m_source;
+	RangeCheck m_available;
+	boost::int64_t m_size;
+	Container m_container;
+	int m_duration;
+	bool m_complete;
+	std::vector<IndexPoint> m_points;
+};
+
+} /* namespace btstream */
+
+#endif /* MEDIAINDEX_H_ */
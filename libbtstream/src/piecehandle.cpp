@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PieceHandle.cpp
+ */
+
+#include "piecehandle.h"
+
+#include <algorithm>
+
+#include "piecepool.h"
+
+namespace btstream {
+
+PieceHandle::PieceHandle() :
+		m_index(0), m_size(0) {
+}
+
+PieceHandle::PieceHandle(boost::shared_ptr<Piece>& piece,
+		const boost::shared_ptr<const ReleaseHook>& hook) :
+		m_index(0), m_size(0), m_hook(hook) {
+
+	if (!piece) {
+		return;
+	}
+
+	m_index = piece->index;
+	m_size = piece->size;
+
+	// Nobody else can see the piece, so its data is taken as is.
+	if (piece.unique()) {
+		m_data.swap(piece->data);
+	} else {
+		m_data = piece->data;
+	}
+
+	piece.reset();
+}
+
+PieceHandle::PieceHandle(BOOST_RV_REF(PieceHandle) other) :
+		m_index(0), m_size(0) {
+
+	swap(other);
+}
+
+PieceHandle& PieceHandle::operator=(BOOST_RV_REF(PieceHandle) other) {
+	if (this != &other) {
+		release();
+		swap(other);
+	}
+
+	return *this;
+}
+
+PieceHandle::~PieceHandle() {
+	release();
+}
+
+bool PieceHandle::empty() const {
+	return !m_data;
+}
+
+int PieceHandle::index() const {
+	return m_index;
+}
+
+const char* PieceHandle::data() const {
+	return m_data.get();
+}
+
+int PieceHandle::size() const {
+	return m_size;
+}
+
+void PieceHandle::release() {
+	if (!m_data) {
+		return;
+	}
+
+	Piece piece(m_index, boost::shared_array<char>(), m_size);
+	piece.data.swap(m_data);
+
+	boost::shared_ptr<const ReleaseHook> hook;
+	hook.swap(m_hook);
+
+	if (hook && *hook) {
+		(*hook)(piece);
+	}
+}
+
+boost::shared_ptr<Piece> PieceHandle::share() {
+	if (!m_data) {
+		return boost::shared_ptr<Piece>();
+	}
+
+	boost::shared_ptr<Piece> piece = make_piece(m_index,
+			boost::shared_array<char>(), m_size);
+	piece->data.swap(m_data);
+	m_hook.reset();
+
+	return piece;
+}
+
+void PieceHandle::swap(PieceHandle& other) {
+	std::swap(m_index, other.m_index);
+	m_data.swap(other.m_data);
+	std::swap(m_size, other.m_size);
+	m_hook.swap(other.m_hook);
+}
+
+} /* namespace btstream */
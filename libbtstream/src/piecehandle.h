@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PieceHandle.h
+ */
+
+#ifndef PIECEHANDLE_H_
+#define PIECEHANDLE_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/function.hpp>
+#include <boost/move/move.hpp>
+
+namespace btstream {
+
+struct Piece;
+
+/**
+ * Function called when a PieceHandle releases its piece. Handles share
+ * ownership of it, so it lives as long as they do.
+ */
+typedef boost::function<void(const Piece&)> ReleaseHook;
+
+/**
+ * Move-only owner of a piece.
+ *
+ * A handle can't be copied, only moved (with boost::move), so passing it
+ * to another thread or function never touches a reference count. It
+ * holds the piece's data directly instead of a shared Piece, so only the
+ * data buffer is reference counted. The piece is released, and the
+ * release hook called, when the handle is destroyed or release() is
+ * called.
+ */
+class PieceHandle {
+	BOOST_MOVABLE_BUT_NOT_COPYABLE(PieceHandle)
+
+public:
+
+	/**
+	 * Creates an empty handle.
+	 */
+	PieceHandle();
+
+	/**
+	 * Takes ownership of the given reference to a piece, which is reset.
+	 * If it was the only reference, the data is moved out of the piece
+	 * without touching its reference count.
+	 * @param piece Reference to the piece, or NULL for an empty handle.
+	 * @param hook Function called when the piece is released, or NULL.
+	 */
+	explicit PieceHandle(boost::shared_ptr<Piece>& piece,
+			const boost::shared_ptr<const ReleaseHook>& hook =
+					boost::shared_ptr<const ReleaseHook>());
+
+	/**
+	 * Move constructor. other becomes empty.
+	 */
+	PieceHandle(BOOST_RV_REF(PieceHandle) other);
+
+	/**
+	 * Move assignment. Releases the current piece; other becomes empty.
+	 */
+	PieceHandle& operator=(BOOST_RV_REF(PieceHandle) other);
+
+	/**
+	 * Destructor. Releases the piece.
+	 */
+	~PieceHandle();
+
+	/**
+	 * Returns true if the handle doesn't own a piece.
+	 */
+	bool empty() const;
+
+	/**
+	 * Returns the piece index. The handle must not be empty.
+	 */
+	int index() const;
+
+	/**
+	 * Returns the piece data. The handle must not be empty.
+	 */
+	const char* data() const;
+
+	/**
+	 * Returns the piece size, in bytes. The handle must not be empty.
+	 */
+	int size() const;
+
+	/**
+	 * Releases the piece, calling the release hook. The handle becomes
+	 * empty.
+	 */
+	void release();
+
+	/**
+	 * Converts the handle into a new shared piece, for code that uses
+	 * the shared_ptr API. The release hook isn't called. The handle
+	 * becomes empty.
+	 */
+	boost::shared_ptr<Piece> share();
+
+	/**
+	 * Swaps the contents of two handles.
+	 */
+	void swap(PieceHandle& other);
+
+private:
+	int m_index;
+	boost::shared_array<char> m_data;
+	int m_size;
+	boost::shared_ptr<const ReleaseHook> m_hook;
+};
+
+} /* namespace btstream */
+
+#endif /* PIECEHANDLE_H_ */
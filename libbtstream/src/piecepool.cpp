@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PiecePool.cpp
+ */
+
+#include "piecepool.h"
+
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <boost/pool/pool_alloc.hpp>
+
+namespace btstream {
+
+boost::shared_ptr<Piece> make_piece(int index,
+		boost::shared_array<char> data, int size) {
+
+	return boost::allocate_shared<Piece>(boost::fast_pool_allocator<Piece>(),
+			index, data, size);
+}
+
+PiecePool::PiecePool(int piece_length, int max_free) throw (Exception) :
+		m_piece_length(piece_length), m_max_free(max_free),
+		m_num_allocated(0) {
+
+	if (piece_length <= 0 || max_free < 0) {
+		throw Exception("Invalid pool settings.");
+	}
+}
+
+PiecePool::~PiecePool() {
+	for (size_t i = 0; i < m_free.size(); i++) {
+		delete[] m_free[i];
+	}
+}
+
+boost::shared_array<char> PiecePool::get_buffer() {
+	char* buffer = 0;
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+
+		if (m_free.empty()) {
+			m_num_allocated++;
+		} else {
+			buffer = m_free.back();
+			m_free.pop_back();
+		}
+	} // Releasing lock.
+
+	if (!buffer) {
+		buffer = new char[m_piece_length];
+	}
+
+	return boost::shared_array<char>(buffer, Releaser(shared_from_this()));
+}
+
+void PiecePool::set_max_free(int max_free) {
+	std::vector<char*> excess;
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_max_free = std::max(0, max_free);
+
+		while ((int) m_free.size() > m_max_free) {
+			excess.push_back(m_free.back());
+			m_free.pop_back();
+		}
+	} // Releasing lock.
+
+	for (size_t i = 0; i < excess.size(); i++) {
+		delete[] excess[i];
+	}
+}
+
+int PiecePool::piece_length() const {
+	return m_piece_length;
+}
+
+int PiecePool::num_free() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_free.size();
+}
+
+long PiecePool::num_allocated() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_num_allocated;
+}
+
+void PiecePool::release(char* buffer) {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+
+		if ((int) m_free.size() < m_max_free) {
+			m_free.push_back(buffer);
+			return;
+		}
+	} // Releasing lock.
+
+	delete[] buffer;
+}
+
+PiecePool::Releaser::Releaser(boost::weak_ptr<PiecePool> pool) :
+		m_pool(pool) {
+}
+
+void PiecePool::Releaser::operator()(char* buffer) {
+	boost::shared_ptr<PiecePool> pool = m_pool.lock();
+
+	if (pool) {
+		pool->release(buffer);
+	} else {
+		delete[] buffer;
+	}
+}
+
+} /* namespace btstream */
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PiecePool.h
+ */
+
+#ifndef PIECEPOOL_H_
+#define PIECEPOOL_H_
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread.hpp>
+
+#include "videobuffer.h"
+#include "exception.h"
+
+namespace btstream {
+
+/**
+ * Creates a Piece with a single allocation for the object and its
+ * reference count, taken from a process-wide pool of recycled blocks.
+ */
+boost::shared_ptr<Piece> make_piece(int index,
+		boost::shared_array<char> data, int size);
+
+/**
+ * Recycles piece memory.
+ *
+ * Buffers have the torrent's piece length. When the last reference to a
+ * buffer is released it goes back to the pool, which keeps up to
+ * max_free buffers for later get_buffer() calls and frees the rest. This
+ * keeps memory usage flat and avoids allocating a piece-sized block for
+ * every piece read.
+ *
+ * PiecePool must be created with boost::shared_ptr, since released
+ * buffers return to it. Buffers may outlive the pool.
+ */
+class PiecePool: public boost::enable_shared_from_this<PiecePool> {
+public:
+
+	/**
+	 * Constructor.
+	 * @param piece_length Size of the buffers, in bytes.
+	 * @param max_free Maximum number of released buffers kept for reuse.
+	 */
+	PiecePool(int piece_length, int max_free = DEFAULT_CAPACITY_PIECES)
+			throw (Exception);
+
+	/**
+	 * Destructor. Frees the buffers that aren't in use.
+	 */
+	~PiecePool();
+
+	/**
+	 * Returns a buffer of piece_length() bytes, reusing a released one
+	 * if possible. Its contents are undefined.
+	 */
+	boost::shared_array<char> get_buffer();
+
+	/**
+	 * Sets the maximum number of released buffers kept for reuse. It is
+	 * usually the number of pieces the buffers can hold.
+	 */
+	void set_max_free(int max_free);
+
+	/**
+	 * Returns the size of the buffers, in bytes.
+	 */
+	int piece_length() const;
+
+	/**
+	 * Returns the number of released buffers ready for reuse.
+	 */
+	int num_free();
+
+	/**
+	 * Returns the number of buffers that were allocated, as opposed to
+	 * reused, since the pool was created.
+	 */
+	long num_allocated();
+
+private:
+	void release(char* buffer);
+
+	/*
+	 * Returns a buffer to its pool, or frees it if the pool no longer
+	 * exists.
+	 */
+	class Releaser {
+	public:
+		Releaser(boost::weak_ptr<PiecePool> pool);
+		void operator()(char* buffer);
+
+	private:
+		boost::weak_ptr<PiecePool> m_pool;
+	};
+
+	int m_piece_length;
+	int m_max_free;
+	long m_num_allocated;
+	std::vector<char*> m_free;
+
+	boost::mutex m_mutex;
+};
+
+} /* namespace btstream */
+
+#endif /* PIECEPOOL_H_ */
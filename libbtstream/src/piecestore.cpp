@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PieceStore.cpp
+ */
+
+#include "piecestore.h"
+
+#include <algorithm>
+
+#include "piecepool.h"
+
+namespace btstream {
+
+PieceStore::PieceStore(int num_pieces, int window, long capacity)
+		throw (Exception) :
+		m_num_pieces(num_pieces), m_window(window), m_capacity(capacity),
+		m_stored_bytes(0), m_generation(0), m_unlocked(false) {
+
+	if (num_pieces <= 0) {
+		throw Exception("Invalid number of pieces.");
+	}
+
+	if (window <= 0 || capacity < 0) {
+		throw Exception("Invalid store settings.");
+	}
+}
+
+PieceStore::~PieceStore() {
+	unlock();
+}
+
+bool PieceStore::add_piece(int index, boost::shared_array<char> data,
+		int size) {
+
+	if (!data || size <= 0) {
+		return false;
+	}
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if (!is_wanted(index)) {
+		return false;
+	}
+
+	boost::shared_ptr<Piece> piece = make_piece(index, data, size);
+	m_pieces[index] = piece;
+	m_stored_bytes += size;
+
+	// Makes room for the new piece, which may be evicted itself if it is
+	// the least urgent one.
+	if (m_capacity > 0) {
+		while (m_stored_bytes > m_capacity && evict_farthest()) {
+		}
+	}
+
+	if (m_pieces.find(index) == m_pieces.end()) {
+		return false;
+	}
+
+	m_piece_available.notify_all();
+
+	return true;
+}
+
+bool PieceStore::wanted(int index) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return is_wanted(index);
+}
+
+std::vector<int> PieceStore::wanted_pieces() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	std::vector<int> pieces;
+	for (size_t i = 0; i < m_cursors.size(); i++) {
+		int begin = m_cursors[i]->m_position;
+		int end = std::min(begin + m_window, m_num_pieces);
+
+		for (int index = begin; index < end; index++) {
+			if (m_pieces.find(index) == m_pieces.end()) {
+				pieces.push_back(index);
+			}
+		}
+	}
+
+	std::sort(pieces.begin(), pieces.end());
+	pieces.erase(std::unique(pieces.begin(), pieces.end()), pieces.end());
+
+	return pieces;
+}
+
+boost::shared_ptr<PieceCursor> PieceStore::create_cursor(int start_index)
+		throw (Exception) {
+
+	if (start_index < 0 || start_index > m_num_pieces) {
+		throw Exception("Invalid cursor position.");
+	}
+
+	boost::shared_ptr<PieceCursor> cursor(
+			new PieceCursor(shared_from_this(), start_index));
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_cursors.push_back(cursor.get());
+	m_generation++;
+
+	return cursor;
+}
+
+void PieceStore::set_request_callback(boost::function<void(int)> callback) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_request_callback = callback;
+}
+
+int PieceStore::num_cursors() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_cursors.size();
+}
+
+long PieceStore::stored_bytes() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_stored_bytes;
+}
+
+int PieceStore::generation() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_generation;
+}
+
+void PieceStore::unlock() {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_unlocked = true;
+	} // Releasing lock.
+
+	m_piece_available.notify_all();
+}
+
+bool PieceStore::unlocked() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_unlocked;
+}
+
+boost::shared_ptr<Piece> PieceStore::get_next_piece(PieceCursor* cursor,
+		bool wait) {
+	boost::shared_ptr<Piece> piece;
+
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	if (cursor->m_position >= m_num_pieces) {
+		return piece;
+	}
+
+	bool requested = false;
+	std::map<int, boost::shared_ptr<Piece> >::iterator it;
+
+	while ((it = m_pieces.find(cursor->m_position)) == m_pieces.end()
+			&& !m_unlocked && !cursor->m_unlocked) {
+
+		if (!wait) {
+			return piece;
+		}
+
+		// Asks for the missing piece once, without holding the lock.
+		if (!requested && m_request_callback) {
+			boost::function<void(int)> callback = m_request_callback;
+			int index = cursor->m_position;
+
+			lock.unlock();
+			callback(index);
+			lock.lock();
+
+			requested = true;
+			continue;
+		}
+
+		m_piece_available.wait(lock);
+	}
+
+	if (m_unlocked || cursor->m_unlocked) {
+		return piece;
+	}
+
+	piece = it->second;
+
+	cursor->m_position++;
+	m_generation++;
+
+	evict_passed();
+
+	return piece;
+}
+
+void PieceStore::seek(PieceCursor* cursor, int index) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	cursor->m_position = std::max(0, std::min(index, m_num_pieces));
+	m_generation++;
+
+	evict_passed();
+}
+
+void PieceStore::unlock(PieceCursor* cursor) {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		cursor->m_unlocked = true;
+	} // Releasing lock.
+
+	m_piece_available.notify_all();
+}
+
+void PieceStore::remove_cursor(PieceCursor* cursor) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	m_cursors.erase(std::remove(m_cursors.begin(), m_cursors.end(), cursor),
+			m_cursors.end());
+	m_generation++;
+
+	evict_passed();
+}
+
+bool PieceStore::is_wanted(int index) const {
+	if (index < 0 || index >= m_num_pieces
+			|| m_pieces.find(index) != m_pieces.end()) {
+		return false;
+	}
+
+	for (size_t i = 0; i < m_cursors.size(); i++) {
+		int position = m_cursors[i]->m_position;
+
+		if (index >= position && index < position + m_window) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Evicts pieces that won't be read by any cursor.
+ */
+void PieceStore::evict_passed() {
+	std::map<int, boost::shared_ptr<Piece> >::iterator it = m_pieces.begin();
+
+	while (it != m_pieces.end()) {
+		bool needed = false;
+
+		for (size_t i = 0; i < m_cursors.size() && !needed; i++) {
+			needed = it->first >= m_cursors[i]->m_position;
+		}
+
+		if (needed) {
+			++it;
+		} else {
+			m_stored_bytes -= it->second->size;
+			m_pieces.erase(it++);
+		}
+	}
+}
+
+/*
+ * Evicts the stored piece that is farthest ahead of the closest cursor
+ * behind it. Pieces about to be read by a cursor are never evicted.
+ * Returns false if there is nothing that can be evicted.
+ */
+bool PieceStore::evict_farthest() {
+	std::map<int, boost::shared_ptr<Piece> >::iterator victim = m_pieces.end();
+	int victim_distance = 0;
+
+	std::map<int, boost::shared_ptr<Piece> >::iterator it;
+	for (it = m_pieces.begin(); it != m_pieces.end(); ++it) {
+		int distance = m_num_pieces;
+
+		for (size_t i = 0; i < m_cursors.size(); i++) {
+			int position = m_cursors[i]->m_position;
+
+			if (it->first >= position) {
+				distance = std::min(distance, it->first - position);
+			}
+		}
+
+		if (distance > victim_distance) {
+			victim = it;
+			victim_distance = distance;
+		}
+	}
+
+	if (victim == m_pieces.end()) {
+		return false;
+	}
+
+	m_stored_bytes -= victim->second->size;
+	m_pieces.erase(victim);
+
+	return true;
+}
+
+PieceCursor::PieceCursor(boost::shared_ptr<PieceStore> store, int position) :
+		m_store(store), m_position(position), m_unlocked(false) {
+}
+
+PieceCursor::~PieceCursor() {
+	m_store->remove_cursor(this);
+}
+
+boost::shared_ptr<Piece> PieceCursor::get_next_piece() {
+	return m_store->get_next_piece(this, true);
+}
+
+boost::shared_ptr<Piece> PieceCursor::try_get_next_piece() {
+	return m_store->get_next_piece(this, false);
+}
+
+int PieceCursor::get_next_piece_index() {
+	boost::lock_guard<boost::mutex> lock(m_store->m_mutex);
+	return m_position;
+}
+
+void PieceCursor::seek(int index) {
+	m_store->seek(this, index);
+}
+
+void PieceCursor::unlock() {
+	m_store->unlock(this);
+}
+
+bool PieceCursor::unlocked() {
+	boost::lock_guard<boost::mutex> lock(m_store->m_mutex);
+	return m_unlocked || m_store->m_unlocked;
+}
+
+} /* namespace btstream */
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PieceStore.h
+ */
+
+#ifndef PIECESTORE_H_
+#define PIECESTORE_H_
+
+#include <map>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "videobuffer.h"
+#include "exception.h"
+
+namespace btstream {
+
+class PieceCursor;
+
+/**
+ * Reference-counted piece storage shared by several readers.
+ *
+ * Each reader is a PieceCursor with its own position, so many consumers
+ * can watch or record the same torrent at different points while the
+ * piece memory is downloaded and stored only once.
+ *
+ * A piece is wanted while it is inside the window of some cursor, i.e.
+ * between the cursor position and position + window. Pieces are evicted
+ * once every cursor has passed them or, if a capacity is given, when
+ * stored data exceeds it. In this case the piece farthest ahead of the
+ * cursors is evicted first; it will be wanted (and read) again later.
+ *
+ * PieceStore must be created with boost::shared_ptr, since cursors keep
+ * a reference to it.
+ */
+class PieceStore: public boost::enable_shared_from_this<PieceStore> {
+public:
+
+	/**
+	 * Constructor.
+	 * @param num_pieces Number of pieces in the video file.
+	 * @param window Number of pieces kept ahead of each cursor.
+	 * @param capacity Maximum amount of stored data in bytes. Zero
+	 * 			means that only the cursor windows limit the store.
+	 */
+	PieceStore(int num_pieces, int window = DEFAULT_CAPACITY_PIECES,
+			long capacity = 0) throw (Exception);
+
+	/**
+	 * Destructor.
+	 */
+	~PieceStore();
+
+	/**
+	 * Stores a piece if some cursor wants it. Never blocks.
+	 * @return true if the piece was stored.
+	 */
+	bool add_piece(int index, boost::shared_array<char> data, int size);
+
+	/**
+	 * Returns true if the piece is inside the window of some cursor and
+	 * isn't stored.
+	 */
+	bool wanted(int index);
+
+	/**
+	 * Returns the indices of all wanted pieces.
+	 */
+	std::vector<int> wanted_pieces();
+
+	/**
+	 * Creates a new reader positioned at start_index.
+	 */
+	boost::shared_ptr<PieceCursor> create_cursor(int start_index = 0)
+			throw (Exception);
+
+	/**
+	 * Sets a function that is called, without any lock held, when a
+	 * cursor has to wait for a piece that isn't stored. It may be used
+	 * to load the piece on demand.
+	 */
+	void set_request_callback(boost::function<void(int)> callback);
+
+	/**
+	 * Returns the number of live cursors.
+	 */
+	int num_cursors();
+
+	/**
+	 * Returns the amount of stored piece data, in bytes.
+	 */
+	long stored_bytes();
+
+	/**
+	 * Returns a number that changes whenever the set of wanted pieces
+	 * may have changed (cursors created, moved or destroyed).
+	 */
+	int generation();
+
+	/**
+	 * Unlocks any blocked calls to PieceCursor::get_next_piece(), for
+	 * every cursor.
+	 */
+	void unlock();
+
+	/**
+	 * Returns true if unlock() was called and false otherwise.
+	 */
+	bool unlocked();
+
+private:
+	friend class PieceCursor;
+
+	boost::shared_ptr<Piece> get_next_piece(PieceCursor* cursor, bool wait);
+	void seek(PieceCursor* cursor, int index);
+	void unlock(PieceCursor* cursor);
+	void remove_cursor(PieceCursor* cursor);
+
+	bool is_wanted(int index) const;
+	void evict_passed();
+	bool evict_farthest();
+
+	int m_num_pieces;
+	int m_window;
+	long m_capacity;
+	long m_stored_bytes;
+	int m_generation;
+	bool m_unlocked;
+
+	std::map<int, boost::shared_ptr<Piece> > m_pieces;
+	std::vector<PieceCursor*> m_cursors;
+	boost::function<void(int)> m_request_callback;
+
+	boost::mutex m_mutex;
+	boost::condition_variable m_piece_available;
+};
+
+/**
+ * Independent reader of a PieceStore.
+ * Like a VideoBuffer, a cursor returns pieces sequentially, blocking
+ * until the next one is available.
+ */
+class PieceCursor {
+public:
+
+	/**
+	 * Destructor. Releases the cursor's claim on stored pieces.
+	 */
+	~PieceCursor();
+
+	/**
+	 * Returns a pointer to the next piece that should be played.
+	 *
+	 * If all pieces have already been returned or the unlock() method
+	 * was called, returns a default constructed (NULL) shared_ptr.
+	 *
+	 * This method will block (sleep) until the piece is available or
+	 * the unlock() method is called.
+	 */
+	boost::shared_ptr<Piece> get_next_piece();
+
+	/**
+	 * Returns the next piece if it is already stored, or a NULL
+	 * shared_ptr otherwise. Never blocks.
+	 */
+	boost::shared_ptr<Piece> try_get_next_piece();
+
+	/**
+	 * Returns the index of the next piece that will be returned.
+	 */
+	int get_next_piece_index();
+
+	/**
+	 * Moves the cursor to the given piece.
+	 */
+	void seek(int index);
+
+	/**
+	 * Unlocks any blocked calls to get_next_piece() on this cursor.
+	 */
+	void unlock();
+
+	/**
+	 * Returns true if unlock() was called on this cursor or on its
+	 * PieceStore.
+	 */
+	bool unlocked();
+
+private:
+	friend class PieceStore;
+
+	PieceCursor(boost::shared_ptr<PieceStore> store, int position);
+
+	boost::shared_ptr<PieceStore> m_store;
+	int m_position;
+	bool m_unlocked;
+};
+
+} /* namespace btstream */
+
+#endif /* PIECESTORE_H_ */
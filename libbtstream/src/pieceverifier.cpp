@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PieceVerifier.cpp
+ */
+
+#include "pieceverifier.h"
+
+#include <algorithm>
+#include <boost/shared_array.hpp>
+#include <libtorrent/hasher.hpp>
+
+namespace btstream {
+
+std::vector<FileSlice> map_piece(const libtorrent::torrent_info& info,
+		const std::string& save_path, int index) {
+
+	std::vector<libtorrent::file_slice> files = info.map_block(index, 0,
+			info.piece_size(index));
+
+	std::vector<FileSlice> slices;
+	for (size_t i = 0; i < files.size(); i++) {
+		FileSlice slice;
+		slice.path = save_path + "/" + info.file_at(files[i].file_index).path;
+		slice.offset = files[i].offset;
+		slice.size = files[i].size;
+
+		slices.push_back(slice);
+	}
+
+	return slices;
+}
+
+bool check_piece_hash(boost::intrusive_ptr<libtorrent::torrent_info> info,
+		int piece, const char* data, int size) {
+
+	if (piece < 0 || piece >= info->num_pieces()
+			|| size != info->piece_size(piece)) {
+		return false;
+	}
+
+	return libtorrent::hasher(data, size).final() == info->hash_for_piece(piece);
+}
+
+PieceVerifier::PieceVerifier(
+		boost::intrusive_ptr<libtorrent::torrent_info> info,
+		const std::string& save_path, VerifyCallback callback,
+		int num_threads) :
+		m_info(info), m_save_path(save_path), m_callback(callback),
+		m_num_threads(num_threads), m_claimed(info->num_pieces()),
+		m_head(0) {
+
+	if (m_num_threads <= 0) {
+		m_num_threads = std::max(1u, boost::thread::hardware_concurrency());
+	}
+}
+
+PieceVerifier::~PieceVerifier() {
+	for (size_t i = 0; i < m_threads.size(); i++) {
+		m_threads[i]->interrupt();
+	}
+
+	for (size_t i = 0; i < m_threads.size(); i++) {
+		m_threads[i]->join();
+	}
+}
+
+void PieceVerifier::skip(int piece) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if (piece >= 0 && piece < (int) m_claimed.size()) {
+		m_claimed[piece] = true;
+	}
+}
+
+void PieceVerifier::start(int head) {
+	set_head(head);
+
+	for (int i = 0; i < m_num_threads; i++) {
+		m_threads.push_back(
+				boost::shared_ptr<boost::thread>(
+						new boost::thread(&PieceVerifier::run, this)));
+	}
+}
+
+void PieceVerifier::set_head(int head) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	m_head = std::max(0, std::min(head, (int) m_claimed.size()));
+}
+
+int PieceVerifier::remaining() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	return m_claimed.size() - m_claimed.count();
+}
+
+void PieceVerifier::run() {
+	try {
+		// Each thread has its own descriptors and buffer.
+		FileCache files;
+		boost::shared_array<char> buffer(new char[m_info->piece_length()]);
+
+		int piece;
+		while ((piece = claim_piece()) >= 0) {
+			boost::this_thread::interruption_point();
+
+			int size = read_slices(files, map_piece(*m_info, m_save_path, piece),
+					buffer.get());
+
+			bool valid = size >= 0
+					&& check_piece_hash(m_info, piece, buffer.get(), size);
+
+			boost::this_thread::interruption_point();
+
+			m_callback(piece, valid);
+		}
+	} catch (boost::thread_interrupted& e) {
+		// Thread will stop.
+	}
+}
+
+/*
+ * Returns the first unclaimed piece from the head onwards, or before it
+ * if there are none, and claims it. Returns -1 when every piece was
+ * claimed.
+ */
+int PieceVerifier::claim_piece() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	boost::dynamic_bitset<> unclaimed = ~m_claimed;
+
+	size_t piece = m_head > 0 ?
+			unclaimed.find_next(m_head - 1) : unclaimed.find_first();
+	if (piece == boost::dynamic_bitset<>::npos) {
+		piece = unclaimed.find_first();
+	}
+
+	if (piece == boost::dynamic_bitset<>::npos) {
+		return -1;
+	}
+
+	m_claimed[piece] = true;
+
+	return piece;
+}
+
+} /* namespace btstream */
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PieceVerifier.h
+ */
+
+#ifndef PIECEVERIFIER_H_
+#define PIECEVERIFIER_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/dynamic_bitset.hpp>
+#include <libtorrent/torrent_info.hpp>
+
+#include "diskreader.h"
+
+namespace btstream {
+
+/**
+ * Returns the file regions where a piece of a torrent saved in save_path
+ * is stored.
+ */
+std::vector<FileSlice> map_piece(const libtorrent::torrent_info& info,
+		const std::string& save_path, int index);
+
+/**
+ * Returns true if the SHA-1 hash of data matches the torrent's hash for
+ * the piece.
+ */
+bool check_piece_hash(boost::intrusive_ptr<libtorrent::torrent_info> info,
+		int piece, const char* data, int size);
+
+/**
+ * Function called when a piece was hashed. valid is false if the piece
+ * is missing or corrupt.
+ */
+typedef boost::function<void(int piece, bool valid)> VerifyCallback;
+
+/**
+ * Hashes the pieces of a torrent that are already on disk, using one
+ * thread per core.
+ *
+ * Pieces are claimed in order starting at a head position, which is
+ * moved as playback moves, and wrapping around to the first piece. So
+ * pieces about to be played are verified first while the rest of the
+ * files are checked in the background.
+ */
+class PieceVerifier {
+public:
+
+	/**
+	 * Constructor. num_threads is the number of hashing threads; zero
+	 * uses one per core.
+	 */
+	PieceVerifier(boost::intrusive_ptr<libtorrent::torrent_info> info,
+			const std::string& save_path, VerifyCallback callback,
+			int num_threads = 0);
+
+	/**
+	 * Destructor. Stops hashing; pieces being hashed are dropped.
+	 */
+	~PieceVerifier();
+
+	/**
+	 * Marks a piece as not needing verification. May be called while
+	 * hashing; a piece that was already claimed is still hashed.
+	 */
+	void skip(int piece);
+
+	/**
+	 * Starts the hashing threads at piece head.
+	 */
+	void start(int head);
+
+	/**
+	 * Makes the following pieces be claimed starting at head.
+	 */
+	void set_head(int head);
+
+	/**
+	 * Returns the number of pieces not yet claimed by a thread.
+	 */
+	int remaining();
+
+private:
+	void run();
+	int claim_piece();
+
+	boost::intrusive_ptr<libtorrent::torrent_info> m_info;
+	std::string m_save_path;
+	VerifyCallback m_callback;
+	int m_num_threads;
+
+	boost::dynamic_bitset<> m_claimed;
+	int m_head;
+
+	std::vector<boost::shared_ptr<boost::thread> > m_threads;
+
+	// Guards m_claimed and m_head.
+	boost::mutex m_mutex;
+};
+
+} /* namespace btstream */
+
+#endif /* PIECEVERIFIER_H_ */
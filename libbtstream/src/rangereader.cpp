@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * RangeReader.cpp
+ */
+
+#include "rangereader.h"
+
+#include <algorithm>
+
+namespace btstream {
+
+RangeReader::RangeReader(boost::shared_ptr<PieceCursor> cursor,
+		int piece_length, boost::int64_t total_size) throw (Exception) :
+		m_cursor(cursor), m_piece_length(piece_length),
+		m_total_size(total_size) {
+
+	if (!cursor) {
+		throw Exception("Invalid cursor.");
+	}
+
+	if (piece_length <= 0 || total_size < 0) {
+		throw Exception("Invalid torrent size.");
+	}
+}
+
+int RangeReader::read(boost::int64_t offset, int length,
+		std::vector<ByteSpan>& spans) {
+
+	return read(offset, length, spans, true);
+}
+
+int RangeReader::read_some(boost::int64_t offset, int length,
+		std::vector<ByteSpan>& spans) {
+
+	return read(offset, length, spans, false);
+}
+
+int RangeReader::readv(const std::vector<ByteRange>& ranges,
+		std::vector<ByteSpan>& spans) {
+
+	int total = 0;
+
+	for (size_t i = 0; i < ranges.size(); i++) {
+		int expected = (int) std::max<boost::int64_t>(0,
+				std::min<boost::int64_t>(ranges[i].length,
+						m_total_size - ranges[i].offset));
+
+		int bytes = read(ranges[i].offset, ranges[i].length, spans, true);
+		total += bytes;
+
+		if (bytes < expected) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+boost::int64_t RangeReader::size() const {
+	return m_total_size;
+}
+
+void RangeReader::unlock() {
+	m_cursor->unlock();
+}
+
+int RangeReader::read(boost::int64_t offset, int length,
+		std::vector<ByteSpan>& spans, bool wait_all) {
+
+	if (offset < 0 || length <= 0 || offset >= m_total_size) {
+		return 0;
+	}
+
+	boost::int64_t end = std::min(offset + length, m_total_size);
+	int first = offset / m_piece_length;
+	int last = (end - 1) / m_piece_length;
+
+	last = std::min(last, fetch(first, last, wait_all));
+
+	int bytes = 0;
+	for (size_t i = 0; i < m_pieces.size() && m_pieces[i]->index <= last;
+			i++) {
+
+		boost::shared_ptr<Piece> piece = m_pieces[i];
+		boost::int64_t piece_offset = (boost::int64_t) piece->index
+				* m_piece_length;
+
+		int begin = std::max(offset, piece_offset) - piece_offset;
+		int size = std::min(end, piece_offset + piece->size) - piece_offset
+				- begin;
+
+		if (size <= 0) {
+			break;
+		}
+
+		spans.push_back(ByteSpan(piece, begin, size));
+		bytes += size;
+	}
+
+	return bytes;
+}
+
+/*
+ * Makes m_pieces hold the pieces from first to last, moving the cursor
+ * if the range isn't contiguous with the last read. Returns the index of
+ * the last piece held, which is smaller than first if none is.
+ */
+int RangeReader::fetch(int first, int last, bool wait_all) {
+	while (!m_pieces.empty() && m_pieces.front()->index < first) {
+		m_pieces.pop_front();
+	}
+
+	if (!m_pieces.empty() && m_pieces.front()->index != first) {
+		m_pieces.clear();
+	}
+
+	if (m_pieces.empty() && m_cursor->get_next_piece_index() != first) {
+		m_cursor->seek(first);
+	}
+
+	while (m_pieces.empty() || m_pieces.back()->index < last) {
+
+		// Only the first piece is waited for on partial reads.
+		boost::shared_ptr<Piece> piece;
+		if (wait_all || m_pieces.empty()) {
+			piece = m_cursor->get_next_piece();
+		} else {
+			piece = m_cursor->try_get_next_piece();
+		}
+
+		if (!piece) {
+			break;
+		}
+
+		m_pieces.push_back(piece);
+	}
+
+	return m_pieces.empty() ? first - 1 : m_pieces.back()->index;
+}
+
+} /* namespace btstream */
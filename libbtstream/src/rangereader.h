@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * RangeReader.h
+ */
+
+#ifndef RANGEREADER_H_
+#define RANGEREADER_H_
+
+#include <deque>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+#include "piecestore.h"
+#include "exception.h"
+
+namespace btstream {
+
+/**
+ * Contiguous bytes inside the memory of a piece.
+ * The span keeps a reference to its piece, so data stays valid for as
+ * long as the span exists.
+ */
+struct ByteSpan {
+	ByteSpan(boost::shared_ptr<Piece> piece, int begin, int size) :
+			piece(piece), data(piece->data.get() + begin), size(size) {}
+
+	boost::shared_ptr<Piece> piece;
+	const char* data;
+	int size;
+};
+
+/**
+ * Byte range requested in a RangeReader::readv() call.
+ */
+struct ByteRange {
+	ByteRange(boost::int64_t offset, int length) :
+			offset(offset), length(length) {}
+
+	boost::int64_t offset;
+	int length;
+};
+
+/**
+ * Reads byte ranges of the torrent data through a PieceCursor.
+ *
+ * Ranges are returned as spans into piece memory, without copying. A
+ * RangeReader isn't thread safe; each consumer should have its own.
+ */
+class RangeReader {
+public:
+
+	/**
+	 * Constructor.
+	 * @param cursor Cursor used to fetch pieces.
+	 * @param piece_length Size of every piece but the last one, in bytes.
+	 * @param total_size Size of the torrent data, in bytes.
+	 */
+	RangeReader(boost::shared_ptr<PieceCursor> cursor, int piece_length,
+			boost::int64_t total_size) throw (Exception);
+
+	/**
+	 * Appends to spans the data in [offset, offset + length), clamped to
+	 * the end of the torrent, and returns the number of bytes appended.
+	 *
+	 * This method blocks until every piece covering the range is
+	 * available. If unlock() is called, the pieces that were already
+	 * available are returned, so the range may be incomplete.
+	 */
+	int read(boost::int64_t offset, int length, std::vector<ByteSpan>& spans);
+
+	/**
+	 * Like read(), but only waits for the first piece of the range. The
+	 * following pieces are appended while they are already available,
+	 * so the returned range may be shorter than requested.
+	 */
+	int read_some(boost::int64_t offset, int length,
+			std::vector<ByteSpan>& spans);
+
+	/**
+	 * Reads several ranges, in order, appending their spans. Returns the
+	 * total number of bytes appended, stopping at the first incomplete
+	 * range.
+	 */
+	int readv(const std::vector<ByteRange>& ranges,
+			std::vector<ByteSpan>& spans);
+
+	/**
+	 * Returns the size of the torrent data, in bytes.
+	 */
+	boost::int64_t size() const;
+
+	/**
+	 * Unlocks blocked read calls.
+	 */
+	void unlock();
+
+private:
+	int read(boost::int64_t offset, int length, std::vector<ByteSpan>& spans,
+			bool wait_all);
+	int fetch(int first, int last, bool wait_all);
+
+	boost::shared_ptr<PieceCursor> m_cursor;
+	int m_piece_length;
+	boost::int64_t m_total_size;
+
+	// Contiguous pieces that were last read, ending just before the
+	// cursor position.
+	std::deque<boost::shared_ptr<Piece> > m_pieces;
+};
+
+} /* namespace btstream */
+
+#endif /* RANGEREADER_H_ */
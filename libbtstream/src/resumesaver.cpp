@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * ResumeSaver.cpp
+ */
+
+#include "resumesaver.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <iterator>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <libtorrent/alert_types.hpp>
+#include <libtorrent/bencode.hpp>
+
+namespace btstream {
+
+/*
+ * Writes data to a new file at path and flushes it to the disk. Returns
+ * false on failure.
+ */
+static bool write_file(const std::string& path, const std::vector<char>& data) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t result = write(fd, &data[written], data.size() - written);
+
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (result <= 0) {
+			close(fd);
+			return false;
+		}
+
+		written += result;
+	}
+
+	bool synced = fsync(fd) == 0;
+
+	return close(fd) == 0 && synced;
+}
+
+ResumeSaver::ResumeSaver(AlertDispatcher& dispatcher) :
+		m_dispatcher(dispatcher), m_outstanding(0),
+		m_interval(DEFAULT_CHECKPOINT_INTERVAL) {
+
+	m_saved_handler = m_dispatcher.add_handler(
+			boost::bind(&ResumeSaver::handle_alert, this, _1),
+			libtorrent::save_resume_data_alert::alert_type);
+	m_failed_handler = m_dispatcher.add_handler(
+			boost::bind(&ResumeSaver::handle_alert, this, _1),
+			libtorrent::save_resume_data_failed_alert::alert_type);
+
+	m_checkpoint_thread = boost::shared_ptr<boost::thread>(
+			new boost::thread(&ResumeSaver::run_checkpoints, this));
+}
+
+ResumeSaver::~ResumeSaver() {
+	m_dispatcher.remove_handler(m_saved_handler);
+	m_dispatcher.remove_handler(m_failed_handler);
+
+	m_checkpoint_thread->interrupt();
+	m_checkpoint_thread->join();
+}
+
+void ResumeSaver::save(libtorrent::torrent_handle handle,
+		const std::string& path) {
+
+	if (!handle.is_valid()) {
+		return;
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+
+		Request& request = m_requests[handle];
+		request.path = path;
+		request.count++;
+		m_outstanding++;
+	} // Releasing lock.
+
+	// Registered before the request, so the answer can't be missed.
+	handle.save_resume_data();
+}
+
+void ResumeSaver::release(libtorrent::torrent_handle handle,
+		const std::string& path) {
+
+	if (!handle.is_valid()) {
+		return;
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+
+		Request& request = m_requests[handle];
+		request.path = path;
+		request.count++;
+		request.released = true;
+		m_outstanding++;
+	} // Releasing lock.
+
+	handle.save_resume_data();
+}
+
+void ResumeSaver::watch(libtorrent::torrent_handle handle,
+		const std::string& path) {
+
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_watched[handle] = path;
+}
+
+void ResumeSaver::unwatch(libtorrent::torrent_handle handle) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_watched.erase(handle);
+}
+
+void ResumeSaver::set_interval(int seconds) {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_interval = std::max(1, seconds);
+	} // Releasing lock.
+
+	m_work.notify_all();
+}
+
+bool ResumeSaver::wait(const boost::posix_time::time_duration& timeout) {
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+
+	boost::system_time deadline = boost::get_system_time() + timeout;
+
+	while (m_outstanding > 0) {
+		if (!m_finished.timed_wait(lock, deadline)) {
+			break;
+		}
+	}
+
+	return m_outstanding == 0;
+}
+
+bool ResumeSaver::wait(libtorrent::torrent_handle handle,
+		const boost::posix_time::time_duration& timeout) {
+
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+
+	boost::system_time deadline = boost::get_system_time() + timeout;
+
+	while (m_requests.count(handle) > 0) {
+		if (!m_finished.timed_wait(lock, deadline)) {
+			break;
+		}
+	}
+
+	return m_requests.count(handle) == 0;
+}
+
+int ResumeSaver::outstanding() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_outstanding;
+}
+
+int ResumeSaver::outstanding(libtorrent::torrent_handle handle) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	std::map<libtorrent::torrent_handle, Request>::iterator it =
+			m_requests.find(handle);
+
+	return it == m_requests.end() ? 0 : it->second.count;
+}
+
+int ResumeSaver::watched() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_watched.size();
+}
+
+/*
+ * Called from the dispatcher thread. The data is written by the
+ * checkpoint thread.
+ */
+void ResumeSaver::handle_alert(boost::shared_ptr<libtorrent::alert> alert) {
+	const libtorrent::save_resume_data_alert* resume_alert =
+			libtorrent::alert_cast<libtorrent::save_resume_data_alert>(
+					alert.get());
+	const libtorrent::torrent_alert* torrent_alert =
+			dynamic_cast<const libtorrent::torrent_alert*>(alert.get());
+
+	if (resume_alert && resume_alert->resume_data) {
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+
+			std::map<libtorrent::torrent_handle, Request>::iterator it =
+					m_requests.find(resume_alert->handle);
+			if (it == m_requests.end()) {
+				return;
+			}
+
+			Write write;
+			write.handle = resume_alert->handle;
+			write.path = it->second.path;
+			write.data = resume_alert->resume_data;
+			m_writes.push_back(write);
+		} // Releasing lock.
+
+		m_work.notify_all();
+		return;
+	}
+
+	finish(torrent_alert->handle);
+}
+
+/*
+ * Writes resume data to its file. Called from the checkpoint thread.
+ */
+void ResumeSaver::write(const Write& write) {
+	std::vector<char> data;
+	libtorrent::bencode(std::back_inserter(data), *write.data);
+
+	// Replaces the resume data file only once the new one is complete
+	// and on disk, so that a crash leaves either file.
+	std::string temp_path = write.path + ".tmp";
+
+	if (!write_file(temp_path, data)
+			|| std::rename(temp_path.c_str(), write.path.c_str()) != 0) {
+		std::remove(temp_path.c_str());
+	}
+
+	finish(write.handle);
+}
+
+void ResumeSaver::finish(libtorrent::torrent_handle handle) {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+
+		std::map<libtorrent::torrent_handle, Request>::iterator it =
+				m_requests.find(handle);
+		if (it == m_requests.end()) {
+			return;
+		}
+
+		// A released torrent is forgotten after its last save.
+		if (--it->second.count == 0) {
+			if (it->second.released) {
+				m_watched.erase(handle);
+			}
+
+			m_requests.erase(it);
+		}
+
+		m_outstanding--;
+	} // Releasing lock.
+
+	m_finished.notify_all();
+}
+
+void ResumeSaver::checkpoint() {
+	std::map<libtorrent::torrent_handle, std::string> watched;
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		watched = m_watched;
+	} // Releasing lock.
+
+	std::map<libtorrent::torrent_handle, std::string>::iterator it;
+	for (it = watched.begin(); it != watched.end(); it++) {
+		if (!it->first.is_valid() || !it->first.need_save_resume_data()) {
+			continue;
+		}
+
+		bool outstanding;
+		{
+			boost::lock_guard<boost::mutex> lock(m_mutex);
+			outstanding = m_requests.count(it->first) > 0;
+		} // Releasing lock.
+
+		// A request that is still outstanding will save the changes.
+		if (!outstanding) {
+			save(it->first, it->second);
+		}
+	}
+}
+
+/*
+ * Writes the queued resume data as it arrives, and checkpoints the
+ * watched torrents every m_interval seconds.
+ */
+void ResumeSaver::run_checkpoints() {
+	boost::system_time last_checkpoint = boost::get_system_time();
+
+	try {
+		while (true) {
+			std::deque<Write> writes;
+			bool due;
+			{
+				boost::unique_lock<boost::mutex> lock(m_mutex);
+
+				while (m_writes.empty()
+						&& boost::get_system_time() < last_checkpoint
+								+ boost::posix_time::seconds(m_interval)) {
+					m_work.timed_wait(lock,
+							last_checkpoint
+									+ boost::posix_time::seconds(m_interval));
+				}
+
+				writes.swap(m_writes);
+				due = boost::get_system_time() >= last_checkpoint
+						+ boost::posix_time::seconds(m_interval);
+			} // Releasing lock.
+
+			for (size_t i = 0; i < writes.size(); i++) {
+				write(writes[i]);
+			}
+
+			if (due) {
+				last_checkpoint = boost::get_system_time();
+				checkpoint();
+			}
+		}
+	} catch (boost::thread_interrupted& e) {
+		// Thread will stop.
+	}
+}
+
+} /* namespace btstream */
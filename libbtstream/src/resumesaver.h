@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * ResumeSaver.h
+ */
+
+#ifndef RESUMESAVER_H_
+#define RESUMESAVER_H_
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <libtorrent/entry.hpp>
+#include <libtorrent/torrent_handle.hpp>
+
+#include "alertdispatcher.h"
+
+namespace btstream {
+
+/**
+ * Default interval between resume data checkpoints, in seconds.
+ */
+const int DEFAULT_CHECKPOINT_INTERVAL = 30;
+
+/**
+ * Writes resume data files without blocking the caller.
+ *
+ * save() asks libtorrent for a torrent's resume data. When the data
+ * arrives, the AlertDispatcher thread only queues it: the file is
+ * written by a background thread, so slow disks don't delay the other
+ * alerts. Files are written to a temporary file and renamed over the
+ * previous one, so a crash never leaves a truncated file. wait() bounds
+ * how long shutdown waits for outstanding requests.
+ *
+ * The same thread checkpoints watched torrents periodically, but only
+ * when libtorrent reports that their state changed.
+ */
+class ResumeSaver {
+public:
+
+	/**
+	 * Constructor. The dispatcher must outlive the saver.
+	 */
+	ResumeSaver(AlertDispatcher& dispatcher);
+
+	/**
+	 * Destructor. Stops checkpoints; data that wasn't written yet is
+	 * dropped.
+	 */
+	~ResumeSaver();
+
+	/**
+	 * Checkpoints the given torrent periodically to path.
+	 */
+	void watch(libtorrent::torrent_handle handle, const std::string& path);
+
+	/**
+	 * Stops checkpointing the given torrent.
+	 */
+	void unwatch(libtorrent::torrent_handle handle);
+
+	/**
+	 * Sets the interval between checkpoints, in seconds.
+	 */
+	void set_interval(int seconds);
+
+	/**
+	 * Requests the resume data of the watched torrents whose state
+	 * changed since it was last saved, without waiting for the next
+	 * periodic checkpoint.
+	 */
+	void checkpoint();
+
+	/**
+	 * Requests the resume data of a torrent, to be written to path.
+	 */
+	void save(libtorrent::torrent_handle handle, const std::string& path);
+
+	/**
+	 * Saves the resume data of a torrent one last time. Once it was
+	 * written, the torrent isn't checkpointed anymore.
+	 */
+	void release(libtorrent::torrent_handle handle, const std::string& path);
+
+	/**
+	 * Waits until every requested file was written or failed, for at
+	 * most timeout. Returns false if requests are still outstanding.
+	 */
+	bool wait(const boost::posix_time::time_duration& timeout);
+
+	/**
+	 * Same as above, but only waits for the requests of a torrent.
+	 */
+	bool wait(libtorrent::torrent_handle handle,
+			const boost::posix_time::time_duration& timeout);
+
+	/**
+	 * Returns the number of requests that didn't finish yet.
+	 */
+	int outstanding();
+
+	/**
+	 * Returns the number of requests of a torrent that didn't finish
+	 * yet.
+	 */
+	int outstanding(libtorrent::torrent_handle handle);
+
+	/**
+	 * Returns the number of torrents that are checkpointed.
+	 */
+	int watched();
+
+private:
+	struct Request {
+		Request() :
+				count(0), released(false) {
+		}
+
+		std::string path;
+		int count;
+		bool released;
+	};
+
+	struct Write {
+		libtorrent::torrent_handle handle;
+		std::string path;
+		boost::shared_ptr<libtorrent::entry> data;
+	};
+
+	void handle_alert(boost::shared_ptr<libtorrent::alert> alert);
+	void finish(libtorrent::torrent_handle handle);
+	void write(const Write& write);
+	void run_checkpoints();
+
+	AlertDispatcher& m_dispatcher;
+	int m_saved_handler;
+	int m_failed_handler;
+
+	std::map<libtorrent::torrent_handle, Request> m_requests;
+	std::map<libtorrent::torrent_handle, std::string> m_watched;
+	std::deque<Write> m_writes;
+	int m_outstanding;
+	int m_interval;
+
+	boost::shared_ptr<boost::thread> m_checkpoint_thread;
+
+	boost::mutex m_mutex;
+	boost::condition_variable m_finished;
+	boost::condition_variable m_work;
+};
+
+} /* namespace btstream */
+
+#endif /* RESUMESAVER_H_ */
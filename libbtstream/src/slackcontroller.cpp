@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * SlackController.cpp
+ */
+
+
+#include "slackcontroller.h"
+
+#include <algorithm>
+
+namespace btstream {
+
+SlackController::SlackController(int low, int high, int hysteresis) :
+		m_low(low), m_high(std::max(low, high)), m_hysteresis(hysteresis),
+		m_mode(URGENT_SEQUENTIAL) {
+}
+
+bool SlackController::update(int slack) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	SelectionMode mode = target(slack);
+
+	// More urgent modes are taken right away. Less urgent ones only past
+	// the margin.
+	if (mode > m_mode) {
+		mode = std::max(m_mode, target(slack - m_hysteresis));
+	}
+
+	if (mode == m_mode) {
+		return false;
+	}
+
+	m_mode = mode;
+	return true;
+}
+
+SelectionMode SlackController::mode() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_mode;
+}
+
+void SlackController::reset() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_mode = URGENT_SEQUENTIAL;
+}
+
+void SlackController::set_thresholds(int low, int high, int hysteresis) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	m_low = low;
+	m_high = std::max(low, high);
+	m_hysteresis = std::max(0, hysteresis);
+}
+
+int SlackController::low_threshold() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_low;
+}
+
+/*
+ * Returns the mode for a slack, without hysteresis.
+ */
+SelectionMode SlackController::target(int slack) const {
+	if (slack < m_low) {
+		return URGENT_SEQUENTIAL;
+	}
+
+	if (slack < m_high) {
+		return DEADLINE_WINDOW;
+	}
+
+	return RAREST_FIRST_WINDOW;
+}
+
+} /* namespace btstream */
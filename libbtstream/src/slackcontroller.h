@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * SlackController.h
+ */
+
+
+#ifndef SLACKCONTROLLER_H_
+#define SLACKCONTROLLER_H_
+
+#include <boost/thread.hpp>
+
+namespace btstream {
+
+/**
+ * Default slack, in milliseconds, under which pieces are downloaded
+ * sequentially.
+ */
+const int DEFAULT_LOW_SLACK_MS = 10000;
+
+/**
+ * Default slack, in milliseconds, above which pieces are picked rarest
+ * first.
+ */
+const int DEFAULT_HIGH_SLACK_MS = 60000;
+
+/**
+ * Default margin, in milliseconds, that slack has to gain over a
+ * threshold before a less urgent selection mode is used.
+ */
+const int DEFAULT_SLACK_HYSTERESIS_MS = 5000;
+
+/**
+ * How pieces are selected by the ADAPTIVE algorithm, from the most to
+ * the least urgent. URGENT_SEQUENTIAL downloads pieces in order, on top
+ * of their deadlines. DEADLINE_WINDOW only keeps deadlines. With
+ * RAREST_FIRST_WINDOW, only a short window after playback has deadlines
+ * and the rest is picked rarest first, which is better for the swarm.
+ */
+enum SelectionMode {
+	URGENT_SEQUENTIAL, DEADLINE_WINDOW, RAREST_FIRST_WINDOW
+};
+
+/**
+ * Chooses a selection mode from the buffer slack, i.e. how much media is
+ * buffered ahead of playback.
+ *
+ * Slack under a threshold makes the selection more urgent at once.
+ * It only becomes less urgent once slack is above a threshold by the
+ * hysteresis margin, so that the mode doesn't flip back and forth while
+ * slack hovers around a threshold.
+ */
+class SlackController {
+public:
+
+	/**
+	 * Constructor. Starts in URGENT_SEQUENTIAL mode.
+	 */
+	SlackController(int low = DEFAULT_LOW_SLACK_MS, int high =
+			DEFAULT_HIGH_SLACK_MS, int hysteresis = DEFAULT_SLACK_HYSTERESIS_MS);
+
+	/**
+	 * Updates the mode with a new slack measure, in milliseconds.
+	 * Returns true if the mode changed.
+	 */
+	bool update(int slack);
+
+	/**
+	 * Returns the current selection mode.
+	 */
+	SelectionMode mode();
+
+	/**
+	 * Goes back to URGENT_SEQUENTIAL mode.
+	 */
+	void reset();
+
+	/**
+	 * Sets the thresholds and the hysteresis margin, in milliseconds.
+	 */
+	void set_thresholds(int low, int high, int hysteresis =
+			DEFAULT_SLACK_HYSTERESIS_MS);
+
+	/**
+	 * Returns the low threshold, in milliseconds.
+	 */
+	int low_threshold();
+
+private:
+	SelectionMode target(int slack) const;
+
+	int m_low;
+	int m_high;
+	int m_hysteresis;
+	SelectionMode m_mode;
+
+	boost::mutex m_mutex;
+};
+
+} /* namespace btstream */
+
+#endif /* SLACKCONTROLLER_H_ */
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * TorrentInfoCache.cpp
+ */
+
+#include "torrentinfocache.h"
+
+#include <algorithm>
+#include <sys/stat.h>
+
+#include "mappedfile.h"
+
+namespace btstream {
+
+TorrentInfoCache& TorrentInfoCache::instance() {
+	static TorrentInfoCache cache;
+
+	return cache;
+}
+
+TorrentInfoCache::TorrentInfoCache(size_t capacity) :
+		m_capacity(std::max<size_t>(1, capacity)), m_clock(0) {
+}
+
+boost::intrusive_ptr<libtorrent::torrent_info> TorrentInfoCache::load(
+		const std::string& path) throw (Exception) {
+
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+		throw Exception("Could not open torrent file " + path);
+	}
+
+	boost::intrusive_ptr<libtorrent::torrent_info> info;
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+
+		std::map<std::string, Entry>::iterator it = m_entries.find(path);
+		if (it != m_entries.end() && it->second.mtime == st.st_mtime
+				&& it->second.size == st.st_size) {
+			it->second.last_use = ++m_clock;
+			info = it->second.info;
+		}
+	} // Releasing lock.
+
+	if (!info) {
+		// Parsed without the lock, so other files can be loaded meanwhile.
+		info = parse(path);
+
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+
+		Entry& entry = m_entries[path];
+		entry.mtime = st.st_mtime;
+		entry.size = st.st_size;
+		entry.info = info;
+		entry.last_use = ++m_clock;
+
+		evict();
+	}
+
+	// The cached copy is never handed out.
+	return boost::intrusive_ptr<libtorrent::torrent_info>(
+			new libtorrent::torrent_info(*info));
+}
+
+void TorrentInfoCache::clear() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	m_entries.clear();
+}
+
+size_t TorrentInfoCache::size() {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+	return m_entries.size();
+}
+
+/*
+ * Parses a .torrent file straight from its mapping.
+ */
+boost::intrusive_ptr<libtorrent::torrent_info> TorrentInfoCache::parse(
+		const std::string& path) throw (Exception) {
+
+	try {
+		MappedFile file(path);
+
+		boost::shared_array<char> data = file.view(0, file.size());
+		if (!data) {
+			throw Exception("Could not read torrent file " + path);
+		}
+
+		return boost::intrusive_ptr<libtorrent::torrent_info>(
+				new libtorrent::torrent_info(data.get(),
+						(int) file.size()));
+
+	} catch (Exception& e) {
+		throw;
+	} catch (std::exception& e) {
+		throw Exception(e.what());
+	}
+}
+
+/*
+ * Drops the least recently used entries while the cache is over
+ * capacity. Must be called with m_mutex held.
+ */
+void TorrentInfoCache::evict() {
+	while (m_entries.size() > m_capacity) {
+		std::map<std::string, Entry>::iterator oldest = m_entries.begin();
+
+		std::map<std::string, Entry>::iterator it;
+		for (it = m_entries.begin(); it != m_entries.end(); it++) {
+			if (it->second.last_use < oldest->second.last_use) {
+				oldest = it;
+			}
+		}
+
+		m_entries.erase(oldest);
+	}
+}
+
+} /* namespace btstream */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * TorrentInfoCache.h
+ */
+
+#ifndef TORRENTINFOCACHE_H_
+#define TORRENTINFOCACHE_H_
+
+#include <ctime>
+#include <map>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <libtorrent/torrent_info.hpp>
+
+#include "exception.h"
+
+namespace btstream {
+
+/**
+ * Default number of torrents kept by a TorrentInfoCache.
+ */
+const size_t DEFAULT_TORRENT_CACHE_SIZE = 16;
+
+/**
+ * Keeps parsed .torrent files, so that adding a torrent again doesn't
+ * read and parse its metadata again.
+ *
+ * Entries are keyed by path and checked against the file's modification
+ * time and size, so edited files are parsed again. Files are mapped
+ * instead of copied to memory before parsing. Callers get their own
+ * copy of the metadata, since the session may change it. The least
+ * recently used entries are dropped when the cache is full.
+ */
+class TorrentInfoCache {
+public:
+
+	/**
+	 * Returns the cache shared by the whole process.
+	 */
+	static TorrentInfoCache& instance();
+
+	/**
+	 * Constructor.
+	 */
+	TorrentInfoCache(size_t capacity = DEFAULT_TORRENT_CACHE_SIZE);
+
+	/**
+	 * Returns the metadata of the .torrent file at path, parsing it only
+	 * if it isn't cached or changed since it was.
+	 * @throw Exception if the file can't be read or parsed.
+	 */
+	boost::intrusive_ptr<libtorrent::torrent_info> load(
+			const std::string& path) throw (Exception);
+
+	/**
+	 * Drops every entry.
+	 */
+	void clear();
+
+	/**
+	 * Returns the number of cached torrents.
+	 */
+	size_t size();
+
+private:
+	struct Entry {
+		std::time_t mtime;
+		boost::int64_t size;
+		boost::intrusive_ptr<libtorrent::torrent_info> info;
+		unsigned long last_use;
+	};
+
+	boost::intrusive_ptr<libtorrent::torrent_info> parse(
+			const std::string& path) throw (Exception);
+	void evict();
+
+	std::map<std::string, Entry> m_entries;
+	size_t m_capacity;
+	unsigned long m_clock;
+
+	boost::mutex m_mutex;
+};
+
+} /* namespace btstream */
+
+#endif /* TORRENTINFOCACHE_H_ */
@@ -24,39 +24,112 @@
 
 #include "videobuffer.h"
 
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
 #include <boost/lexical_cast.hpp>
 
+#include "piecepool.h"
+
 namespace btstream {
 
-VideoBuffer::VideoBuffer(int num_pieces) throw (Exception) :
-		m_buffer_size(10), m_num_pieces(num_pieces), m_next_piece_index(0),
-		m_unlocked(false) {
+BufferSettings::BufferSettings() :
+		mode(LOCKED), capacity_bytes(0), capacity_ms(0), adaptive(false),
+		prefetch_pieces(0) {}
+
+VideoBuffer::VideoBuffer(int num_pieces, BufferMode mode) throw (Exception) :
+		m_mode(mode), m_buffer_size(0), m_max_capacity(0),
+		m_num_pieces(num_pieces), m_next_piece_index(0), m_unlocked(false),
+		m_next_missing_index(0), m_consumer_waiting(false),
+		m_producer_waiting(false), m_space_wanted(false), m_capacity(0),
+		m_buffered_bytes(0),
+		m_media_rate(0), m_download_rate(0), m_consume_rate(0),
+		m_default_capacity(0), m_sample_bytes(0), m_event_read_fd(-1),
+		m_event_write_fd(-1), m_event_signaled(false) {
 
 	if (num_pieces <= 0) {
 		throw Exception("Invalid number of pieces.");
 	}
+
+	init(0);
+}
+
+VideoBuffer::VideoBuffer(int num_pieces, const BufferSettings& settings,
+		int piece_length) throw (Exception) :
+		m_settings(settings), m_mode(settings.mode), m_buffer_size(0),
+		m_max_capacity(0), m_num_pieces(num_pieces), m_next_piece_index(0),
+		m_unlocked(false), m_next_missing_index(0), m_consumer_waiting(false),
+		m_producer_waiting(false), m_space_wanted(false), m_capacity(0),
+		m_buffered_bytes(0),
+		m_media_rate(0), m_download_rate(0), m_consume_rate(0),
+		m_default_capacity(0), m_sample_bytes(0), m_event_read_fd(-1),
+		m_event_write_fd(-1), m_event_signaled(false) {
+
+	if (num_pieces <= 0) {
+		throw Exception("Invalid number of pieces.");
+	}
+
+	if (piece_length <= 0 || settings.capacity_bytes < 0
+			|| settings.capacity_ms < 0 || settings.prefetch_pieces < 0) {
+		throw Exception("Invalid buffer settings.");
+	}
+
+	init(piece_length);
 }
 
 VideoBuffer::~VideoBuffer() {
 	unlock();
+
+	int write_fd = m_event_write_fd.load();
+	if (write_fd >= 0) {
+		close(write_fd);
+	}
+
+	if (m_event_read_fd >= 0 && m_event_read_fd != write_fd) {
+		close(m_event_read_fd);
+	}
+}
+
+bool VideoBuffer::add_piece(int index, boost::shared_array<char> data, int size) {
+	return add_piece(index, data, size, true);
+}
+
+bool VideoBuffer::try_add_piece(int index, boost::shared_array<char> data,
+		int size) {
+
+	return add_piece(index, data, size, false);
+}
+
+void VideoBuffer::set_space_callback(boost::function<void()> callback) {
+	boost::lock_guard<boost::mutex> lock(m_lazy_mutex);
+	m_space_callback = callback;
 }
 
-void VideoBuffer::add_piece(int index, boost::shared_array<char> data, int size) {
+bool VideoBuffer::add_piece(int index, boost::shared_array<char> data, int size,
+		bool wait) {
 
 	if (index >= 0 && index < m_num_pieces && data && size > 0) {
-		boost::unique_lock<boost::mutex> lock(m_mutex);
+		boost::shared_ptr<Piece> piece = make_piece(index, data, size);
 
-		// Waits while buffer is full.
-		while (m_pieces.size() == m_buffer_size) {
-			m_buffer_not_full.wait(lock);
+		bool stored;
+		if (m_mode == SPSC) {
+			stored = add_piece_spsc(piece, wait);
+		} else {
+			stored = add_piece_locked(piece, wait);
 		}
 
-		// Adds piece to buffer.
-		boost::shared_ptr<Piece> piece(new Piece(index, data, size));
-		m_pieces.push(piece);
+		// A loaded piece that didn't fit is loaded again later.
+		if (!stored && lazy() && in_window(index)) {
+			boost::lock_guard<boost::mutex> lock(m_lazy_mutex);
+			m_loading_pieces[index] = false;
+		}
 
-		// Notifies that next piece is available.
-		m_next_piece_available.notify_all();
+		return stored;
 
 	} else {
 		throw Exception(
@@ -65,24 +138,426 @@ void VideoBuffer::add_piece(int index, boost::shared_array<char> data, int size)
 	}
 }
 
+void VideoBuffer::set_piece_ready(int index) {
+	if (!lazy() || index < 0 || index >= m_num_pieces) {
+		return;
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_lazy_mutex);
+		m_ready_pieces[index] = true;
+	} // Releasing lock.
+
+	prefetch();
+}
+
+void VideoBuffer::set_loader(boost::function<void(int)> loader) {
+	boost::lock_guard<boost::mutex> lock(m_lazy_mutex);
+	m_loader = loader;
+}
+
+bool VideoBuffer::lazy() const {
+	return m_settings.prefetch_pieces > 0;
+}
+
+int VideoBuffer::ready_pieces() {
+	int next_piece_index = m_next_piece_index.load();
+
+	if (!lazy()) {
+		int count = 0;
+		while (next_piece_index + count < m_num_pieces
+				&& count < m_buffer_size
+				&& m_ready[(next_piece_index + count) % m_buffer_size].load()
+						== next_piece_index + count + 1) {
+			count++;
+		}
+
+		return count;
+	}
+
+	boost::lock_guard<boost::mutex> lock(m_lazy_mutex);
+
+	int index = next_piece_index;
+	while (index < m_num_pieces && m_ready_pieces[index]) {
+		index++;
+	}
+
+	return index - next_piece_index;
+}
+
 boost::shared_ptr<Piece> VideoBuffer::get_next_piece() {
-	boost::shared_ptr<Piece> piece;
+	return get_next_piece_until(boost::posix_time::pos_infin);
+}
+
+boost::shared_ptr<Piece> VideoBuffer::try_get_next_piece() {
+	return get_next_piece_until(boost::posix_time::neg_infin);
+}
+
+boost::shared_ptr<Piece> VideoBuffer::get_next_piece_for(
+		const boost::posix_time::time_duration& timeout) {
+
+	return get_next_piece_until(boost::get_system_time() + timeout);
+}
+
+int VideoBuffer::get_event_fd() throw (Exception) {
+	boost::lock_guard<boost::mutex> lock(m_mutex);
+
+	if (m_event_read_fd >= 0) {
+		return m_event_read_fd;
+	}
+
+	int fds[2];
+#ifdef HAVE_SYS_EVENTFD_H
+	fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fds[0] < 0) {
+		throw Exception("Could not create event descriptor.");
+	}
+#else
+	if (pipe(fds) < 0) {
+		throw Exception("Could not create event descriptor.");
+	}
+
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	m_event_read_fd = fds[0];
+	m_event_write_fd = fds[1];
+
+	// The next piece may already be there.
+	signal_event();
+
+	return m_event_read_fd;
+}
+
+PieceHandle VideoBuffer::get_next_handle() {
+	boost::shared_ptr<Piece> piece = get_next_piece();
+	PieceHandle handle(piece, m_release_hook);
+
+	return boost::move(handle);
+}
+
+void VideoBuffer::set_release_hook(ReleaseHook hook) {
+	if (hook) {
+		m_release_hook.reset(new ReleaseHook(hook));
+	} else {
+		m_release_hook.reset();
+	}
+}
+
+std::vector<boost::shared_ptr<Piece> > VideoBuffer::get_next_pieces(
+		int max_count, long max_bytes) {
+
+	std::vector<boost::shared_ptr<Piece> > pieces;
+
+	if (max_count <= 0) {
+		return pieces;
+	}
+
+	prefetch();
+
+	if (m_mode == SPSC) {
+		get_next_pieces_spsc(pieces, max_count, max_bytes);
+	} else {
+		get_next_pieces_locked(pieces, max_count, max_bytes);
+		call_space_callback();
+	}
+
+	if (!pieces.empty()) {
+		prefetch();
+	}
+
+	return pieces;
+}
+
+int VideoBuffer::get_next_handles(PieceHandle* handles, int max_count,
+		long max_bytes) {
+
+	std::vector<boost::shared_ptr<Piece> > pieces = get_next_pieces(max_count,
+			max_bytes);
+
+	for (size_t i = 0; i < pieces.size(); i++) {
+		PieceHandle handle(pieces[i], m_release_hook);
+		handles[i] = boost::move(handle);
+	}
+
+	return pieces.size();
+}
+
+int VideoBuffer::get_next_piece_index() {
+	return m_next_piece_index.load();
+}
+
+int VideoBuffer::window_size() const {
+	return m_buffer_size;
+}
+
+bool VideoBuffer::in_window(int index) {
+	int next_piece_index = m_next_piece_index.load();
+
+	if (index < next_piece_index || index >= next_piece_index + m_buffer_size
+			|| index >= m_num_pieces) {
+		return false;
+	}
+
+	return m_ready[index % m_buffer_size].load() != index + 1;
+}
+
+void VideoBuffer::unlock() {
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_unlocked = true;
+	} // Releasing lock.
+
+	m_next_piece_available.notify_all();
+	signal_event();
+}
+
+bool VideoBuffer::unlocked() {
+	return m_unlocked.load();
+}
+
+BufferMode VideoBuffer::mode() const {
+	return m_mode;
+}
+
+void VideoBuffer::set_media_rate(long bytes_per_second) {
+	m_media_rate = bytes_per_second;
+
+	if (update_capacity()) {
+		notify_space_available();
+	}
+}
+
+void VideoBuffer::set_download_rate(long bytes_per_second) {
+	m_download_rate = bytes_per_second;
+
+	if (update_capacity()) {
+		notify_space_available();
+	}
+}
+
+long VideoBuffer::capacity() const {
+	return m_capacity.load();
+}
+
+long VideoBuffer::buffered_bytes() const {
+	return m_buffered_bytes.load();
+}
+
+long VideoBuffer::consume_rate() const {
+	return m_consume_rate.load();
+}
+
+void VideoBuffer::init(int piece_length) {
+	m_default_capacity = (long) DEFAULT_CAPACITY_PIECES * piece_length;
+
+	// Largest capacity the buffer may reach. A time-based capacity
+	// without a byte limit is unbounded.
+	if (m_settings.capacity_bytes > 0) {
+		m_max_capacity = m_settings.capacity_bytes;
+	} else if (m_settings.capacity_ms == 0) {
+		m_max_capacity = m_default_capacity;
+		if (m_settings.adaptive) {
+			m_max_capacity *= 4;
+		}
+	}
+
+	// Bounds the number of pieces, which is also the reorder window. The
+	// last piece may be shorter than the others.
+	m_buffer_size = m_num_pieces;
+	if (piece_length == 0) {
+		m_buffer_size = std::min(m_num_pieces, DEFAULT_CAPACITY_PIECES);
+	} else if (m_max_capacity > 0
+			&& m_max_capacity / piece_length + 2 < m_buffer_size) {
+		m_buffer_size = m_max_capacity / piece_length + 2;
+	}
+
+	// In lazy mode only the prefetched pieces are held.
+	if (lazy()) {
+		m_buffer_size = std::min(m_buffer_size, m_settings.prefetch_pieces);
+		m_ready_pieces.resize(m_num_pieces);
+		m_loading_pieces.resize(m_num_pieces);
+	}
+
+	m_slots.resize(m_buffer_size);
+	m_stored_index.resize(m_buffer_size, -1);
+	m_ready.reset(new boost::atomic<int>[m_buffer_size]);
+	for (int i = 0; i < m_buffer_size; i++) {
+		m_ready[i].store(0);
+	}
+
+	update_capacity();
+}
+
+/*
+ * Computes the capacity in bytes from the settings and the current
+ * media, consume and download rates. May be called by any thread.
+ * Returns true if the capacity has grown, in which case the caller
+ * should wake up the producer.
+ */
+bool VideoBuffer::update_capacity() {
+	if (m_default_capacity == 0) {
+		// Created without settings, limited by number of pieces only.
+		return false;
+	}
+
+	long media_rate = m_media_rate.load();
+	if (media_rate <= 0) {
+		media_rate = m_consume_rate.load();
+	}
+
+	double capacity;
+	if (m_settings.capacity_ms > 0 && media_rate > 0) {
+		capacity = (double) m_settings.capacity_ms * media_rate / 1000;
+	} else if (m_settings.capacity_bytes > 0) {
+		capacity = m_settings.capacity_bytes;
+	} else {
+		capacity = m_default_capacity;
+	}
+
+	long download_rate = m_download_rate.load();
+	if (m_settings.adaptive && media_rate > 0 && download_rate > 0) {
+		double factor = (double) media_rate / download_rate;
+		factor = std::max(0.5, std::min(factor, 4.0));
+		capacity *= factor;
+	}
+
+	if (m_max_capacity > 0 && capacity > m_max_capacity) {
+		capacity = m_max_capacity;
+	}
+
+	long old_capacity = m_capacity.exchange((long) capacity);
+
+	return old_capacity < (long) capacity;
+}
+
+/*
+ * Measures the consume rate over periods of at least half a second.
+ * Long gaps between reads (pauses) restart the measurement. Called by
+ * the consumer, which wakes up the producer right after.
+ */
+void VideoBuffer::sample_consume_rate(int size) {
+	boost::posix_time::ptime now =
+			boost::posix_time::microsec_clock::universal_time();
+
+	if (m_sample_start.is_not_a_date_time()) {
+		m_sample_start = now;
+		m_sample_bytes = 0;
+		return;
+	}
+
+	m_sample_bytes += size;
+
+	long elapsed = (now - m_sample_start).total_milliseconds();
+	if (elapsed > 5000) {
+		m_sample_start = now;
+		m_sample_bytes = 0;
+
+	} else if (elapsed >= 500) {
+		long rate = m_sample_bytes * 1000 / elapsed;
+		long old_rate = m_consume_rate.load();
+
+		if (old_rate > 0) {
+			rate = (old_rate * 7 + rate * 3) / 10;
+		}
+
+		m_consume_rate = rate;
+		m_sample_start = now;
+		m_sample_bytes = 0;
+
+		update_capacity();
+	}
+}
+
+void VideoBuffer::notify_space_available() {
+	if (m_mode == SPSC) {
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (!m_producer_waiting.load(boost::memory_order_relaxed)) {
+			return;
+		}
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_mutex);
+		m_buffer_not_full.notify_all();
+	} // Releasing lock.
+
+	call_space_callback();
+}
+
+/*
+ * Tells a producer whose piece was rejected by try_add_piece() that it
+ * may try again. Called without m_mutex.
+ */
+void VideoBuffer::call_space_callback() {
+	if (!m_space_wanted.load(boost::memory_order_relaxed)
+			|| !m_space_wanted.exchange(false)) {
+		return;
+	}
+
+	boost::function<void()> callback;
+	{
+		boost::lock_guard<boost::mutex> lock(m_lazy_mutex);
+		callback = m_space_callback;
+	} // Releasing lock.
+
+	if (callback) {
+		callback();
+	}
+}
+
+bool VideoBuffer::add_piece_locked(boost::shared_ptr<Piece> piece,
+		bool wait) {
 
 	boost::unique_lock<boost::mutex> lock(m_mutex);
-	if (m_next_piece_index < m_num_pieces) {
-		while (m_pieces.empty() && !m_unlocked) {
-			m_next_piece_available.wait(lock);
+
+	if (added(piece->index)) {
+		return false;
+	}
+
+	// Waits while buffer is full, unless the piece is out of order.
+	while (!fits(piece->index, piece->size)) {
+		if (piece->index != m_next_missing_index) {
+			return false;
 		}
 
-		if (m_unlocked) {
+		// The consumer will call the space callback when it takes a
+		// piece, which also needs m_mutex.
+		if (!wait) {
+			m_space_wanted = true;
+			return false;
+		}
+
+		m_buffer_not_full.wait(lock);
+	}
+
+	// Adds piece to buffer.
+	store(piece);
+
+	// Notifies that next piece is available.
+	m_next_piece_available.notify_all();
+
+	return true;
+}
+
+boost::shared_ptr<Piece> VideoBuffer::get_next_piece_locked(
+		const boost::system_time& deadline) {
+
+	boost::shared_ptr<Piece> piece;
+
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	if (m_next_piece_index < m_num_pieces) {
+		if (!wait_next_piece_locked(lock, deadline)) {
 			boost::shared_ptr<Piece> null_pointer;
 			return null_pointer;
 		}
 
-		piece = m_pieces.front();
-		m_pieces.pop();
+		piece = take();
 
-		m_next_piece_index++;
+		sample_consume_rate(piece->size);
 
 		// Notifies that there is free space on buffer.
 		m_buffer_not_full.notify_all();
@@ -91,23 +566,392 @@ boost::shared_ptr<Piece> VideoBuffer::get_next_piece() {
 	return piece;
 }
 
-int VideoBuffer::get_next_piece_index() {
-	boost::lock_guard<boost::mutex> lock(m_mutex);
-	return m_next_piece_index;
+void VideoBuffer::get_next_pieces_locked(
+		std::vector<boost::shared_ptr<Piece> >& pieces, int max_count,
+		long max_bytes) {
+
+	boost::unique_lock<boost::mutex> lock(m_mutex);
+	if (m_next_piece_index < m_num_pieces) {
+		if (!wait_next_piece_locked(lock, boost::posix_time::pos_infin)) {
+			return;
+		}
+
+		sample_consume_rate(take_ready(pieces, max_count, max_bytes));
+
+		// Notifies once that there is free space on buffer.
+		m_buffer_not_full.notify_all();
+	}
 }
 
-void VideoBuffer::unlock() {
-	{
+/*
+ * Waits, holding the lock, while the next piece is missing. Returns
+ * false if the deadline expired or the buffer was unlocked.
+ */
+bool VideoBuffer::wait_next_piece_locked(boost::unique_lock<boost::mutex>& lock,
+		const boost::system_time& deadline) {
+
+	while (!next_piece_ready() && !m_unlocked) {
+		if (!wait_until(m_next_piece_available, lock, deadline)) {
+			break;
+		}
+	}
+
+	return next_piece_ready() && !m_unlocked;
+}
+
+/*
+ * The SPSC path never takes the mutex while the ring has room/data. A
+ * thread that has to sleep first raises its waiting flag and then checks
+ * the ring again while holding the mutex, and the other side checks the
+ * flag after publishing its update. The seq_cst fences on both sides
+ * guarantee that at least one of them sees the other's write, so a
+ * wake-up can't be lost.
+ */
+bool VideoBuffer::add_piece_spsc(boost::shared_ptr<Piece> piece, bool wait) {
+
+	if (added(piece->index)) {
+		return false;
+	}
+
+	// Waits while buffer is full, unless the piece is out of order.
+	if (!fits(piece->index, piece->size)) {
+		if (piece->index != m_next_missing_index) {
+			return false;
+		}
+
+		// Same protocol as a sleeping producer: either the consumer sees
+		// the flags and calls the space callback, or the piece fits now.
+		if (!wait) {
+			m_space_wanted.store(true, boost::memory_order_relaxed);
+			m_producer_waiting.store(true, boost::memory_order_relaxed);
+			boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+			if (!fits(piece->index, piece->size)) {
+				return false;
+			}
+
+			m_space_wanted.store(false, boost::memory_order_relaxed);
+		}
+
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		m_producer_waiting.store(true, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+		while (!fits(piece->index, piece->size)) {
+			m_buffer_not_full.wait(lock);
+		}
+
+		m_producer_waiting.store(false, boost::memory_order_relaxed);
+
+	} else if (m_producer_waiting.load(boost::memory_order_relaxed)) {
+		// Left by a piece that try_add_piece() rejected.
+		m_producer_waiting.store(false, boost::memory_order_relaxed);
+	}
+
+	// Adds piece to buffer.
+	store(piece);
+
+	// Notifies that next piece is available, if anyone is sleeping.
+	boost::atomic_thread_fence(boost::memory_order_seq_cst);
+	if (m_consumer_waiting.load(boost::memory_order_relaxed)) {
 		boost::lock_guard<boost::mutex> lock(m_mutex);
-		m_unlocked = true;
-	} // Releasing lock.
+		m_next_piece_available.notify_all();
+	}
 
-	m_next_piece_available.notify_all();
+	return true;
 }
 
-bool VideoBuffer::unlocked() {
-	boost::lock_guard<boost::mutex> lock(m_mutex);
-	return m_unlocked;
+boost::shared_ptr<Piece> VideoBuffer::get_next_piece_spsc(
+		const boost::system_time& deadline) {
+
+	boost::shared_ptr<Piece> piece;
+
+	if (!wait_next_piece_spsc(deadline)) {
+		return piece;
+	}
+
+	piece = take();
+
+	sample_consume_rate(piece->size);
+
+	// Notifies that there is free space on buffer, if anyone is sleeping.
+	notify_space_available();
+
+	return piece;
+}
+
+void VideoBuffer::get_next_pieces_spsc(
+		std::vector<boost::shared_ptr<Piece> >& pieces, int max_count,
+		long max_bytes) {
+
+	if (!wait_next_piece_spsc(boost::posix_time::pos_infin)) {
+		return;
+	}
+
+	sample_consume_rate(take_ready(pieces, max_count, max_bytes));
+
+	// Notifies once that there is free space on buffer, if anyone is
+	// sleeping.
+	notify_space_available();
+}
+
+/*
+ * Waits while the next piece is missing. Returns false if there are no
+ * more pieces, the deadline expired or the buffer was unlocked.
+ */
+bool VideoBuffer::wait_next_piece_spsc(const boost::system_time& deadline) {
+	if (m_next_piece_index.load(boost::memory_order_relaxed) >= m_num_pieces) {
+		return false;
+	}
+
+	if (!next_piece_ready() && !m_unlocked && !deadline.is_neg_infinity()) {
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		m_consumer_waiting.store(true, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+
+		while (!next_piece_ready() && !m_unlocked) {
+			if (!wait_until(m_next_piece_available, lock, deadline)) {
+				break;
+			}
+		}
+
+		m_consumer_waiting.store(false, boost::memory_order_relaxed);
+	}
+
+	return next_piece_ready() && !m_unlocked;
+}
+
+/*
+ * Waits on the condition until the deadline. Positive infinity waits
+ * without a timeout and negative infinity doesn't wait at all. Returns
+ * false if the deadline expired.
+ */
+bool VideoBuffer::wait_until(boost::condition_variable& condition,
+		boost::unique_lock<boost::mutex>& lock,
+		const boost::system_time& deadline) {
+
+	if (deadline.is_pos_infinity()) {
+		condition.wait(lock);
+		return true;
+	}
+
+	if (deadline.is_neg_infinity()) {
+		return false;
+	}
+
+	return condition.timed_wait(lock, deadline);
+}
+
+boost::shared_ptr<Piece> VideoBuffer::get_next_piece_until(
+		const boost::system_time& deadline) {
+
+	prefetch();
+
+	boost::shared_ptr<Piece> piece;
+	if (m_mode == SPSC) {
+		piece = get_next_piece_spsc(deadline);
+	} else {
+		piece = get_next_piece_locked(deadline);
+		call_space_callback();
+	}
+
+	// Keeps the following pieces loading while this one is played.
+	if (piece) {
+		prefetch();
+	}
+
+	return piece;
+}
+
+/*
+ * The event descriptor is readable while the consumer wouldn't block:
+ * the next piece is ready, there are no more pieces or the buffer was
+ * unlocked. m_event_signaled tells whether it was written and not yet
+ * drained. The producer signals after publishing a piece; the consumer
+ * clears the flag before checking the ring again, so an update can't be
+ * missed by both.
+ */
+bool VideoBuffer::event_ready() const {
+	return m_unlocked.load()
+			|| m_next_piece_index.load(boost::memory_order_relaxed)
+					>= m_num_pieces || next_piece_ready();
+}
+
+void VideoBuffer::signal_event() {
+	int fd = m_event_write_fd.load();
+	if (fd < 0) {
+		return;
+	}
+
+	boost::atomic_thread_fence(boost::memory_order_seq_cst);
+	if (!event_ready() || m_event_signaled.exchange(true)) {
+		return;
+	}
+
+	boost::uint64_t one = 1;
+	ssize_t result = write(fd, &one, sizeof(one));
+	(void) result;
+}
+
+/*
+ * Drains the event descriptor if the consumer would now block. Called
+ * by the consumer after taking a piece.
+ */
+void VideoBuffer::reset_event() {
+	if (m_event_write_fd.load(boost::memory_order_relaxed) < 0
+			|| event_ready()) {
+		return;
+	}
+
+	char buffer[64];
+	while (read(m_event_read_fd, buffer, sizeof(buffer)) > 0) {
+	}
+
+	m_event_signaled.store(false);
+	signal_event();
+}
+
+/*
+ * Returns true if the piece was already played or is on the buffer.
+ * Called by the producer.
+ */
+bool VideoBuffer::added(int index) const {
+	return index < m_next_missing_index
+			|| m_stored_index[index % m_buffer_size] == index;
+}
+
+/*
+ * Returns true if the piece is inside the reorder window and fits in the
+ * buffer capacity. The next piece to be played always fits.
+ */
+bool VideoBuffer::fits(int index, int size) const {
+	int next_piece_index = m_next_piece_index.load(boost::memory_order_acquire);
+
+	if (index >= next_piece_index + m_buffer_size) {
+		return false;
+	}
+
+	long capacity = m_capacity.load();
+	return index == next_piece_index || capacity == 0
+			|| m_buffered_bytes.load() + size <= capacity;
+}
+
+bool VideoBuffer::next_piece_ready() const {
+	int index = m_next_piece_index.load(boost::memory_order_relaxed);
+	return m_ready[index % m_buffer_size].load(boost::memory_order_acquire)
+			== index + 1;
+}
+
+/*
+ * Publishes a piece on its slot. Bytes are accounted before the piece is
+ * published, so the consumer never takes them out first.
+ */
+void VideoBuffer::store(boost::shared_ptr<Piece> piece) {
+	int slot = piece->index % m_buffer_size;
+
+	m_buffered_bytes.fetch_add(piece->size);
+	m_slots[slot] = piece;
+	m_stored_index[slot] = piece->index;
+	m_ready[slot].store(piece->index + 1, boost::memory_order_release);
+
+	while (m_next_missing_index < m_num_pieces
+			&& m_stored_index[m_next_missing_index % m_buffer_size]
+					== m_next_missing_index) {
+		m_next_missing_index++;
+	}
+
+	signal_event();
+}
+
+/*
+ * Takes the next piece from its slot, releasing the buffer's reference.
+ * The slot is only handed back to the producer when the next piece index
+ * is incremented.
+ */
+boost::shared_ptr<Piece> VideoBuffer::take() {
+	int index = m_next_piece_index.load(boost::memory_order_relaxed);
+	int slot = index % m_buffer_size;
+
+	boost::shared_ptr<Piece> piece;
+	piece.swap(m_slots[slot]);
+	m_ready[slot].store(0, boost::memory_order_relaxed);
+	m_buffered_bytes.fetch_sub(piece->size);
+
+	m_next_piece_index.store(index + 1, boost::memory_order_release);
+
+	reset_event();
+
+	return piece;
+}
+
+/*
+ * Takes the next piece, which must be ready, and the consecutive ready
+ * pieces that follow it within the given limits. Returns the number of
+ * bytes taken.
+ */
+long VideoBuffer::take_ready(std::vector<boost::shared_ptr<Piece> >& pieces,
+		int max_count, long max_bytes) {
+
+	long bytes = 0;
+	int count = 0;
+
+	while (true) {
+		boost::shared_ptr<Piece> piece = take();
+		bytes += piece->size;
+		pieces.push_back(piece);
+		count++;
+
+		if (count >= max_count
+				|| m_next_piece_index.load(boost::memory_order_relaxed)
+						>= m_num_pieces || !next_piece_ready()) {
+			break;
+		}
+
+		int slot = m_next_piece_index.load(boost::memory_order_relaxed)
+				% m_buffer_size;
+
+		if (max_bytes > 0 && bytes + m_slots[slot]->size > max_bytes) {
+			break;
+		}
+	}
+
+	return bytes;
+}
+
+/*
+ * Lazy mode only. Hands the ready pieces among the next prefetch_pieces
+ * that aren't held or loading to the loader.
+ */
+void VideoBuffer::prefetch() {
+	if (!lazy()) {
+		return;
+	}
+
+	std::vector<int> to_load;
+	boost::function<void(int)> loader;
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_lazy_mutex);
+		if (!m_loader) {
+			return;
+		}
+
+		int begin = m_next_piece_index.load();
+		int end = std::min(m_num_pieces, begin + m_buffer_size);
+
+		for (int index = begin; index < end; index++) {
+			if (m_ready_pieces[index] && !m_loading_pieces[index]) {
+				m_loading_pieces[index] = true;
+				to_load.push_back(index);
+			}
+		}
+
+		loader = m_loader;
+	} // Releasing lock.
+
+	for (size_t i = 0; i < to_load.size(); i++) {
+		loader(to_load[i]);
+	}
 }
 
 } /* namespace btstream */
@@ -25,13 +25,18 @@
 #ifndef VIDEOBUFFER_H_
 #define VIDEOBUFFER_H_
 
-#include <queue>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/shared_array.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/dynamic_bitset.hpp>
 
 #include "exception.h"
+#include "piecehandle.h"
 
 namespace btstream {
 
@@ -47,12 +52,88 @@ struct Piece {
 	int size;
 };
 
+/**
+ * Synchronization strategy used by a VideoBuffer.
+ *
+ * LOCKED allows any number of threads to add and read pieces. Every
+ * operation takes the buffer mutex.
+ *
+ * SPSC assumes that exactly one thread calls add_piece() and exactly one
+ * thread calls get_next_piece(). Pieces are exchanged without locking and
+ * threads only sleep when the next piece is missing or there is no room
+ * for a new one.
+ */
+enum BufferMode {
+	LOCKED, SPSC
+};
+
+/**
+ * Capacity and synchronization settings of a VideoBuffer.
+ *
+ * The buffer capacity can be given in bytes, in milliseconds of media,
+ * or both. When both are set, capacity_ms defines the target depth and
+ * capacity_bytes is a hard limit on the memory used by the buffer. When
+ * none is set, the buffer holds DEFAULT_CAPACITY_PIECES pieces.
+ */
+struct BufferSettings {
+	BufferSettings();
+
+	/**
+	 * Synchronization strategy. Defaults to LOCKED.
+	 */
+	BufferMode mode;
+
+	/**
+	 * Maximum amount of piece data held by the buffer, in bytes.
+	 * Zero means no byte limit.
+	 */
+	int capacity_bytes;
+
+	/**
+	 * Amount of media the buffer should hold, in milliseconds. It is
+	 * converted to bytes with the rate given to
+	 * VideoBuffer::set_media_rate() or, if unknown, with the measured
+	 * consume rate. Zero disables time-based capacity.
+	 */
+	int capacity_ms;
+
+	/**
+	 * If true, the capacity is scaled by the ratio between the media
+	 * rate and the download rate: the buffer grows (up to 4x) while the
+	 * download can't keep up with playback and shrinks (down to 0.5x)
+	 * while it is much faster.
+	 */
+	bool adaptive;
+
+	/**
+	 * If greater than zero, enables lazy mode: the buffer keeps track of
+	 * the pieces that are verified and ready on storage, but only holds
+	 * the data of the next prefetch_pieces pieces. Piece data is loaded
+	 * through the loader (see VideoBuffer::set_loader()) as the consumer
+	 * gets near it. Zero (the default) holds the data of every buffered
+	 * piece.
+	 */
+	int prefetch_pieces;
+};
+
+/**
+ * Default buffer capacity, in pieces, when no capacity is configured.
+ */
+const int DEFAULT_CAPACITY_PIECES = 10;
+
 /**
  * Stores references to downloaded video pieces.
  * VideoBuffer is a thread-safe container in which piece references can
  * be added and read by different threads at the same time.
  * VideoBuffer keeps track of current video playback position when the
  * get_next_piece method is used.
+ *
+ * Pieces are stored in a ring indexed by piece index, which works as a
+ * reorder window: pieces from get_next_piece_index() up to
+ * get_next_piece_index() + window_size() may be added in any order, and
+ * are returned strictly in order.
+ *
+ * See BufferMode for the supported producer/consumer arrangements.
  */
 class VideoBuffer {
 public:
@@ -60,8 +141,19 @@ public:
 	/**
 	 * Constructor.
 	 * @param num_pieces Number of pieces in the video file.
+	 * @param mode Synchronization strategy.
+	 */
+	VideoBuffer(int num_pieces = 1, BufferMode mode = LOCKED)
+			throw (Exception);
+
+	/**
+	 * Constructor.
+	 * @param num_pieces Number of pieces in the video file.
+	 * @param settings Capacity and synchronization settings.
+	 * @param piece_length Nominal piece size in bytes.
 	 */
-	VideoBuffer(int num_pieces = 1) throw (Exception);
+	VideoBuffer(int num_pieces, const BufferSettings& settings,
+			int piece_length) throw (Exception);
 
 	/**
 	 * Destructor.
@@ -70,17 +162,46 @@ public:
 	~VideoBuffer();
 
 	/**
-	 * Adds a piece reference to the buffer. If there is no space left
-	 * on the buffer then the method will block until the method
-	 * get_next_piece is called.
+	 * Adds a piece reference to the buffer.
+	 *
+	 * If the piece is the next one missing in sequence and there is no
+	 * space left on the buffer, then the method will block until the
+	 * method get_next_piece is called. The piece that should be played
+	 * next is always accepted, even if it is larger than the buffer
+	 * capacity.
+	 *
+	 * A piece that arrives ahead of a missing one is never waited for:
+	 * if it is out of the reorder window or doesn't fit, it is rejected
+	 * and should be added again later.
 	 *
 	 * This method implements mutual exclusion and will block until
 	 * resources are available.
 	 * @param index the piece index.
 	 * @param data a char array with piece data.
 	 * @param size the size of the data array.
+	 * @return true if the piece was stored, false if it was rejected or
+	 * 			was already added.
+	 */
+	bool add_piece(int index, boost::shared_array<char> data, int size);
+
+	/**
+	 * Adds a piece reference to the buffer without ever blocking.
+	 *
+	 * Works as add_piece(), except that the next missing piece is also
+	 * rejected when there is no space left. In that case the space
+	 * callback is called once the consumer frees space, so the piece can
+	 * be added again.
+	 * @return true if the piece was stored, false if it was rejected or
+	 * 			was already added.
+	 */
+	bool try_add_piece(int index, boost::shared_array<char> data, int size);
+
+	/**
+	 * Sets the function called when space is freed after try_add_piece()
+	 * rejected the next missing piece. It is called by the consumer
+	 * thread, so it should only wake the producer up.
 	 */
-	void add_piece(int index, boost::shared_array<char> data, int size);
+	void set_space_callback(boost::function<void()> callback);
 
 	/**
 	 * Returns a pointer to the next piece that should be played.
@@ -93,11 +214,90 @@ public:
 	 */
 	boost::shared_ptr<Piece> get_next_piece();
 
+	/**
+	 * Returns the next piece if it is already available, or a NULL
+	 * shared_ptr otherwise. Never blocks.
+	 */
+	boost::shared_ptr<Piece> try_get_next_piece();
+
+	/**
+	 * Same as get_next_piece(), but blocks for at most the given time.
+	 * Returns a NULL shared_ptr if the timeout expires.
+	 */
+	boost::shared_ptr<Piece> get_next_piece_for(
+			const boost::posix_time::time_duration& timeout);
+
+	/**
+	 * Returns a file descriptor that is readable while get_next_piece()
+	 * wouldn't block, i.e. the next piece is available, all pieces were
+	 * returned or unlock() was called. It can be watched with poll,
+	 * epoll or a GLib main loop to drive several buffers from one
+	 * thread. The descriptor belongs to the buffer and must not be read
+	 * or closed.
+	 *
+	 * It is an eventfd where available, or a pipe otherwise, and is
+	 * created on the first call.
+	 */
+	int get_event_fd() throw (Exception);
+
+	/**
+	 * Same as get_next_piece(), but returns a move-only handle. The piece
+	 * reference is moved out of the buffer, so no reference count is
+	 * touched until the handle releases the piece. An empty handle is
+	 * returned instead of NULL.
+	 */
+	PieceHandle get_next_handle();
+
+	/**
+	 * Sets the function called when a handle returned by
+	 * get_next_handle() releases its piece. Should be called before
+	 * pieces are read. Handles share the hook, so they may outlive the
+	 * buffer; handles returned before a new hook is set keep the old one.
+	 */
+	void set_release_hook(ReleaseHook hook);
+
+	/**
+	 * Returns the next pieces that should be played, in order.
+	 *
+	 * Blocks like get_next_piece() until the next piece is available,
+	 * then returns it together with the consecutive pieces that are
+	 * already on the buffer, up to max_count pieces and max_bytes bytes
+	 * (zero means no byte limit). The first piece is always returned,
+	 * even if it is larger than max_bytes.
+	 *
+	 * Returns an empty vector if all pieces have already been returned
+	 * or the unlock() method was called.
+	 */
+	std::vector<boost::shared_ptr<Piece> > get_next_pieces(int max_count,
+			long max_bytes = 0);
+
+	/**
+	 * Same as get_next_pieces(), but moves the pieces into handles, which
+	 * share the release hook like the ones returned by get_next_handle().
+	 * @param handles Array of at least max_count handles.
+	 * @return Number of handles filled, zero when get_next_pieces() would
+	 * 			return an empty vector.
+	 */
+	int get_next_handles(PieceHandle* handles, int max_count,
+			long max_bytes = 0);
+
 	/**
 	 * Returns the index of the next piece that should be played.
 	 */
 	int get_next_piece_index();
 
+	/**
+	 * Returns the number of pieces, starting at get_next_piece_index(),
+	 * that can be held by the reorder window.
+	 */
+	int window_size() const;
+
+	/**
+	 * Returns true if the piece with the given index is inside the
+	 * reorder window and hasn't been added yet.
+	 */
+	bool in_window(int index);
+
 	/**
 	 * Unlocks any blocked calls to get_next_piece().
 	 */
@@ -110,13 +310,160 @@ public:
 	 */
 	bool unlocked();
 
+	/**
+	 * Returns the synchronization strategy used by this buffer.
+	 */
+	BufferMode mode() const;
+
+	/**
+	 * Lazy mode only. Marks a piece as verified and ready to be loaded.
+	 * Ready pieces close to the consumer are loaded right away.
+	 */
+	void set_piece_ready(int index);
+
+	/**
+	 * Lazy mode only. Sets the function that starts loading a ready
+	 * piece, which should be added later with add_piece(). It is called
+	 * from the thread that reads or marks pieces, without locks held.
+	 */
+	void set_loader(boost::function<void(int)> loader);
+
+	/**
+	 * Returns true if the buffer is in lazy mode.
+	 */
+	bool lazy() const;
+
+	/**
+	 * Returns the number of consecutive pieces, starting at
+	 * get_next_piece_index(), that are ready to be played. In lazy mode
+	 * these include pieces whose data isn't loaded.
+	 */
+	int ready_pieces();
+
+	/**
+	 * Sets the media bitrate, in bytes per second, used to convert
+	 * BufferSettings::capacity_ms to bytes.
+	 */
+	void set_media_rate(long bytes_per_second);
+
+	/**
+	 * Reports the current download rate, in bytes per second. Used by
+	 * the adaptive capacity mode.
+	 */
+	void set_download_rate(long bytes_per_second);
+
+	/**
+	 * Returns the current capacity in bytes, or zero if the buffer is
+	 * only limited by its number of pieces.
+	 */
+	long capacity() const;
+
+	/**
+	 * Returns the amount of piece data currently held, in bytes.
+	 */
+	long buffered_bytes() const;
+
+	/**
+	 * Returns the measured rate at which pieces are read, in bytes per
+	 * second, or zero if it wasn't measured yet.
+	 */
+	long consume_rate() const;
+
 private:
-	const int m_buffer_size;
+	void init(int piece_length);
+	bool update_capacity();
+	void sample_consume_rate(int size);
+	void notify_space_available();
+	void call_space_callback();
+	bool add_piece(int index, boost::shared_array<char> data, int size,
+			bool wait);
+
+	bool add_piece_locked(boost::shared_ptr<Piece> piece, bool wait);
+	boost::shared_ptr<Piece> get_next_piece_locked(
+			const boost::system_time& deadline);
+	bool wait_next_piece_locked(boost::unique_lock<boost::mutex>& lock,
+			const boost::system_time& deadline);
+	void get_next_pieces_locked(std::vector<boost::shared_ptr<Piece> >& pieces,
+			int max_count, long max_bytes);
+
+	bool add_piece_spsc(boost::shared_ptr<Piece> piece, bool wait);
+	boost::shared_ptr<Piece> get_next_piece_spsc(
+			const boost::system_time& deadline);
+	void get_next_pieces_spsc(std::vector<boost::shared_ptr<Piece> >& pieces,
+			int max_count, long max_bytes);
+	bool wait_next_piece_spsc(const boost::system_time& deadline);
+
+	bool wait_until(boost::condition_variable& condition,
+			boost::unique_lock<boost::mutex>& lock,
+			const boost::system_time& deadline);
+	boost::shared_ptr<Piece> get_next_piece_until(
+			const boost::system_time& deadline);
+
+	bool event_ready() const;
+	void signal_event();
+	void reset_event();
+
+	bool added(int index) const;
+	bool fits(int index, int size) const;
+	bool next_piece_ready() const;
+	void store(boost::shared_ptr<Piece> piece);
+	boost::shared_ptr<Piece> take();
+	void prefetch();
+	long take_ready(std::vector<boost::shared_ptr<Piece> >& pieces,
+			int max_count, long max_bytes);
+
+	const BufferSettings m_settings;
+	const BufferMode m_mode;
+	int m_buffer_size;
+	long m_max_capacity;
 
-	std::queue<boost::shared_ptr<Piece> > m_pieces;
 	int m_num_pieces;
-	int m_next_piece_index;
-	bool m_unlocked;
+	boost::atomic<int> m_next_piece_index;
+	boost::atomic<bool> m_unlocked;
+
+	// Ring of m_buffer_size slots, piece i goes to slot i % m_buffer_size.
+	// A slot is published by storing i + 1 at m_ready. m_next_piece_index
+	// is only written by the consumer; m_stored_index and
+	// m_next_missing_index are only used by the producer(s).
+	std::vector<boost::shared_ptr<Piece> > m_slots;
+	boost::scoped_array<boost::atomic<int> > m_ready;
+	std::vector<int> m_stored_index;
+	int m_next_missing_index;
+
+	boost::atomic<bool> m_consumer_waiting;
+	boost::atomic<bool> m_producer_waiting;
+
+	// Set when try_add_piece() rejected the next missing piece for lack
+	// of space. The callback is guarded by m_lazy_mutex.
+	boost::atomic<bool> m_space_wanted;
+	boost::function<void()> m_space_callback;
+
+	// Capacity in bytes (zero means unlimited) and its inputs.
+	boost::atomic<long> m_capacity;
+	boost::atomic<long> m_buffered_bytes;
+	boost::atomic<long> m_media_rate;
+	boost::atomic<long> m_download_rate;
+	boost::atomic<long> m_consume_rate;
+	long m_default_capacity;
+
+	boost::shared_ptr<const ReleaseHook> m_release_hook;
+
+	// Consume rate sampling, only touched by the consumer.
+	boost::posix_time::ptime m_sample_start;
+	long m_sample_bytes;
+
+	// Lazy mode state, guarded by m_lazy_mutex. Pieces are ready once
+	// marked by the producer and loading once handed to the loader.
+	boost::dynamic_bitset<> m_ready_pieces;
+	boost::dynamic_bitset<> m_loading_pieces;
+	boost::function<void(int)> m_loader;
+	boost::mutex m_lazy_mutex;
+
+	// Event descriptor, created by get_event_fd(). Both ends are the
+	// same eventfd, or the two ends of a pipe.
+	int m_event_read_fd;
+	boost::atomic<int> m_event_write_fd;
+	boost::atomic<bool> m_event_signaled;
 
 	mutable boost::mutex m_mutex;
 	mutable boost::condition_variable m_next_piece_available;
@@ -24,17 +24,90 @@
 
 #include "videotorrentmanager.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <boost/bind.hpp>
 #include <libtorrent/alert_types.hpp>
 #include <libtorrent/peer_info.hpp>
-#include <libtorrent/bencode.hpp>
+#include <libtorrent/lazy_entry.hpp>
 
 #include "videotorrentplugin.h"
 
 namespace btstream {
 
+/*
+ * Hands a piece read by the DiskReader to the feeding thread as if
+ * libtorrent had read it.
+ */
+static void post_read_alert(boost::shared_ptr<AlertQueue> queue,
+		libtorrent::torrent_handle handle, int piece,
+		boost::shared_array<char> data, int size) {
+
+	queue->push(
+			boost::shared_ptr<libtorrent::alert>(
+					new libtorrent::read_piece_alert(handle, piece, data, size)));
+}
+
+/*
+ * Returns the pieces that the resume data says are on disk. Resume data
+ * of another torrent, or that can't be parsed, trusts no pieces.
+ */
+static boost::dynamic_bitset<> read_trusted_pieces(
+		const libtorrent::torrent_info& info,
+		const std::vector<char>& resume_data) {
+
+	boost::dynamic_bitset<> trusted(info.num_pieces());
+
+	libtorrent::lazy_entry entry;
+	libtorrent::error_code ec;
+
+	if (resume_data.empty()
+			|| libtorrent::lazy_bdecode(&resume_data[0],
+					&resume_data[0] + resume_data.size(), entry, ec) != 0
+			|| entry.type() != libtorrent::lazy_entry::dict_t
+			|| entry.dict_find_string_value("info-hash")
+					!= info.info_hash().to_string()) {
+		return trusted;
+	}
+
+	// One byte per piece, with the lowest bit set if it is complete.
+	std::string pieces = entry.dict_find_string_value("pieces");
+
+	int num_pieces = std::min(info.num_pieces(), (int) pieces.size());
+	for (int i = 0; i < num_pieces; i++) {
+		trusted[i] = pieces[i] & 1;
+	}
+
+	return trusted;
+}
+
+/*
+ * Returns the index of the torrent's largest file, which is taken as the
+ * video.
+ */
+static int video_file(const libtorrent::torrent_info& info) {
+	int video = 0;
+	for (int i = 1; i < info.num_files(); i++) {
+		if (info.file_at(i).size > info.file_at(video).size) {
+			video = i;
+		}
+	}
+
+	return video;
+}
+
 VideoTorrentManager::VideoTorrentManager() :
-		m_last_played_piece(0), m_deadlines_mode(false) {
+		m_alert_dispatcher(m_session), m_resume_saver(m_alert_dispatcher),
+		m_store_capacity(0), m_read_ahead(DEFAULT_READ_AHEAD),
+		m_read_engine(LIBTORRENT_READS), m_startup_mode(LIBTORRENT_CHECK),
+		m_full_check(false), m_recheck_pending(false), m_checked_pieces(0),
+		m_reads_in_flight(0), m_last_played_piece(0), m_deadlines_mode(false),
+		m_deadline_horizon(DEFAULT_DEADLINE_HORIZON_MS),
+		m_adaptive_mode(false), m_index_first(false), m_index_checked(true),
+		m_video_head_read(false), m_video_head_piece(0),
+		m_index_start_piece(-1), m_index_end_piece(-1),
+		m_sequential_download(false), m_sequential_held(false),
+		m_index_offset(-1), m_feeding(false) {
 
 	TorrentPluginFactory f(&create_video_plugin);
 	m_session.add_extension(f);
@@ -45,15 +118,31 @@ VideoTorrentManager::VideoTorrentManager() :
 	// Sets alert mask in order to receive downloaded pieces as alerts.
 	m_session.set_alert_mask(
 			libtorrent::alert::storage_notification
-					| libtorrent::alert::progress_notification);
+					| libtorrent::alert::progress_notification
+					| libtorrent::alert::status_notification);
+
+	// Routes alerts to the feeding thread and the resume data saver.
+	m_alert_dispatcher.start();
 }
 
 VideoTorrentManager::~VideoTorrentManager() {
+	stop_index_thread();
+	m_verifier.reset();
 	stop_feeding_thread();
+	remove_alert_handlers();
+
+	if (m_piece_store) {
+		m_piece_store->unlock();
+	}
 
 	m_session.pause();
 
-	save_resume_data();
+	// Only torrents that changed since their last checkpoint are saved.
+	// Waits a bounded time, since the files are written by the
+	// dispatcher thread.
+	m_resume_saver.checkpoint();
+	m_resume_saver.wait(
+			boost::posix_time::milliseconds(RESUME_DATA_TIMEOUT_MS));
 }
 
 boost::shared_ptr<VideoBuffer> VideoTorrentManager::add_torrent(
@@ -65,25 +154,45 @@ boost::shared_ptr<VideoBuffer> VideoTorrentManager::add_torrent(
 	// Sets piece picking algorithm
 	switch (algorithm) {
 	case RAREST_FIRST:
-		m_torrent_handle.set_sequential_download(false);
+		set_sequential_download(false);
 		break;
 
 	case SEQUENTIAL:
-		m_torrent_handle.set_sequential_download(true);
+		set_sequential_download(true);
 		break;
 
-	case DEADLINE:
-		if (stream_length == 0) {
-			throw Exception("The decoded stream length must be provided.");
-		}
+	case ADAPTIVE:
+		m_adaptive_mode = true;
+		m_slack_controller.reset();
 
+		// Pieces are timed as in DEADLINE mode, and downloaded
+		// sequentially until there is enough slack.
+		// fall through
+	case DEADLINE:
 		m_deadlines_mode = true;
 
-		// Estimates decoded piece (audio/video) length.
+		// Estimates decoded piece (audio/video) length, until pieces are
+		// timed by the container index. Without a stream length, there
+		// are no deadlines before that.
 		m_decoded_piece_length = (float) stream_length / m_num_pieces;
 
+		// Allows time-based buffer capacity.
+		if (stream_length > 0) {
+			m_video_buffer->set_media_rate(
+					m_torrent_handle.get_torrent_info().total_size() * 1000
+							/ stream_length);
+		}
+
 		// Starts on sequential mode.
-		m_torrent_handle.set_sequential_download(true);
+		set_sequential_download(true);
+
+		m_deadline_scheduler.start(m_num_pieces, m_decoded_piece_length,
+				boost::bind(&libtorrent::torrent_handle::set_piece_deadline,
+						m_torrent_handle, _1, _2, 0),
+				boost::bind(&libtorrent::torrent_handle::reset_piece_deadline,
+						m_torrent_handle, _1));
+
+		start_index_thread();
 
 		break;
 	}
@@ -91,6 +200,42 @@ boost::shared_ptr<VideoBuffer> VideoTorrentManager::add_torrent(
 	return m_video_buffer;
 }
 
+boost::shared_ptr<VideoBuffer> VideoTorrentManager::switch_torrent(
+		const std::string& file_name, const std::string& save_path,
+		Algorithm algorithm, int stream_length) throw (Exception) {
+
+	boost::posix_time::ptime start =
+			boost::posix_time::microsec_clock::universal_time();
+
+	release_torrent();
+	add_torrent(file_name, save_path, algorithm, stream_length);
+
+	m_last_switch_duration = boost::posix_time::microsec_clock::universal_time()
+			- start;
+
+	return m_video_buffer;
+}
+
+boost::shared_ptr<VideoBuffer> VideoTorrentManager::switch_torrent(
+		const std::string& file_name, PiecePicker* piece_picker,
+		const std::string& save_path) throw (Exception) {
+
+	boost::posix_time::ptime start =
+			boost::posix_time::microsec_clock::universal_time();
+
+	release_torrent();
+	add_torrent(file_name, piece_picker, save_path);
+
+	m_last_switch_duration = boost::posix_time::microsec_clock::universal_time()
+			- start;
+
+	return m_video_buffer;
+}
+
+boost::posix_time::time_duration VideoTorrentManager::last_switch_duration() const {
+	return m_last_switch_duration;
+}
+
 boost::shared_ptr<VideoBuffer> VideoTorrentManager::add_torrent(
 		const std::string& file_name, PiecePicker* piece_picker,
 		const std::string& save_path) throw (Exception) {
@@ -106,6 +251,33 @@ boost::shared_ptr<VideoBuffer> VideoTorrentManager::add_torrent(
 		std::string video_file_name = params.ti->name() + ".resume";
 		std::string resume_data_file = save_path + "/" + video_file_name;
 
+		// Clear old alerts before adding new torrent.
+		stop_index_thread();
+		m_verifier.reset();
+		stop_feeding_thread();
+		remove_alert_handlers();
+
+		if (m_piece_store) {
+			m_piece_store->unlock();
+		}
+//		clear_alerts();
+
+		// A torrent that was switched away from may still be in the
+		// session, saving the resume data that is loaded below. It is
+		// added again, with the new piece picker and resume data. Calls
+		// are handled in order, so it is gone before it is added.
+		libtorrent::torrent_handle previous = m_session.find_torrent(
+				params.ti->info_hash());
+
+		if (previous.is_valid()) {
+			m_resume_saver.wait(previous,
+					boost::posix_time::milliseconds(RESUME_DATA_TIMEOUT_MS));
+			m_resume_saver.unwatch(previous);
+			m_session.remove_torrent(previous);
+		}
+
+		remove_released_torrents();
+
 		std::vector<char> buffer;
 		libtorrent::error_code ec;
 
@@ -113,27 +285,124 @@ boost::shared_ptr<VideoBuffer> VideoTorrentManager::add_torrent(
 			params.resume_data = &buffer;
 		}
 
-		// Clear old alerts before adding new torrent.
-		stop_feeding_thread();
-//		clear_alerts();
+		// Pieces trusted from the resume data.
+		boost::dynamic_bitset<> trusted(params.ti->num_pieces());
+
+		if (m_startup_mode == FAST_START && params.resume_data) {
+			trusted = read_trusted_pieces(*params.ti, buffer);
+
+			// A complete torrent isn't checked by libtorrent either.
+			if ((int) trusted.count() == params.ti->num_pieces()) {
+				params.seed_mode = true;
+			}
+		}
 
 		// Add torrent to session.
 		m_torrent_handle = m_session.add_torrent(params);
+
+		// Alerts are queued even while the feeding thread is stopped, so
+		// reads issued before a restart aren't lost.
+		add_alert_handlers();
+
 		m_torrent_handle.resume();
 
 		m_save_path = save_path;
+
+		// Keeps resume data up to date in case the process dies.
+		m_resume_saver.watch(m_torrent_handle, resume_data_file);
 		m_num_pieces = params.ti.get()->num_pieces();
 		m_next_piece = 0;
+		m_window_end = 0;
+		m_added = boost::dynamic_bitset<>(m_num_pieces);
+		m_requested = boost::dynamic_bitset<>(m_num_pieces);
+		m_have = boost::dynamic_bitset<>(m_num_pieces);
+		m_index_have = boost::dynamic_bitset<>(m_num_pieces);
+		m_on_disk = boost::dynamic_bitset<>(m_num_pieces);
+		m_unverified = trusted;
+		m_full_check = trusted.none();
+		m_recheck_pending = false;
+		m_checked_pieces = 0;
+		m_last_check_update = boost::posix_time::ptime();
+		m_deferred_piece.reset();
+		m_reads_in_flight = 0;
+		m_reads_deferred = false;
 		m_last_played_piece = 0;
 		m_deadlines_mode = false;
+		m_adaptive_mode = false;
+		m_deadline_scheduler.stop();
+		m_deadline_scheduler.set_horizon(m_deadline_horizon);
+
+		// The head of the video tells where its index is.
+		m_video_head_piece = params.ti->file_at(video_file(*params.ti)).offset
+				/ params.ti->piece_length();
+		m_index_checked = !m_index_first;
+		m_video_head_read = false;
+		m_index_start_piece = -1;
+		m_index_end_piece = -1;
+		m_index_offset = -1;
+
+		{
+			boost::lock_guard<boost::mutex> lock(m_sequential_mutex);
+			m_sequential_download = false;
+			m_sequential_held = false;
+		} // Releasing lock.
+
+		if (m_index_first) {
+			m_torrent_handle.set_piece_deadline(m_video_head_piece, 0);
+		}
 
 		m_video_buffer =
-				boost::shared_ptr<VideoBuffer>(new VideoBuffer(m_num_pieces));
+				boost::shared_ptr<VideoBuffer>(
+						new VideoBuffer(m_num_pieces, m_buffer_settings,
+								params.ti->piece_length()));
+
+		// A piece rejected by the full buffer is added again as soon as
+		// the player makes room for it.
+		m_video_buffer->set_space_callback(
+				boost::bind(&AlertQueue::wake, m_alert_queue));
+
+		// Reads of the previous torrent are dropped.
+		m_torrent_info = params.ti;
+		m_disk_reader.reset();
+		m_piece_pool.reset();
+		m_mapped_files.clear();
+
+		if (m_read_engine == DIRECT_READS || m_startup_mode == FAST_START) {
+			m_disk_reader.reset(new DiskReader());
+			m_piece_pool = boost::shared_ptr<PiecePool>(
+					new PiecePool(params.ti->piece_length()));
+		}
+
+		if (m_startup_mode == FAST_START) {
+			start_verifier();
+		}
+
+		// Pieces asked for by readers are loaded by the feeding thread.
+		// Requests of the previous torrent's readers are dropped.
+		{
+			boost::lock_guard<boost::mutex> lock(m_load_mutex);
+			m_load_requests.clear();
+			m_load_queue = m_alert_queue;
+		} // Releasing lock.
+
+		// In lazy mode pieces are read as the consumer gets near them.
+		if (m_video_buffer->lazy()) {
+			m_video_buffer->set_loader(
+					boost::bind(&VideoTorrentManager::queue_load, this,
+							m_alert_queue, _1));
+		}
+
+		m_piece_store = boost::shared_ptr<PieceStore>(
+				new PieceStore(m_num_pieces, DEFAULT_CAPACITY_PIECES,
+						m_store_capacity));
+		m_piece_store->set_request_callback(
+				boost::bind(&VideoTorrentManager::queue_load, this,
+						m_alert_queue, _1));
+		m_store_generation = -1;
 
 		// Starts new VideoBuffer feeding thread that calls the feed_video_buffer
 		// method.
-		m_feeding_thread = boost::shared_ptr<boost::thread>(
-				new boost::thread(&VideoTorrentManager::feed_video_buffer, this));
+		start_feeding_thread();
 
 	} catch (std::exception& e) {
 		throw Exception(e.what());
@@ -144,86 +413,288 @@ boost::shared_ptr<VideoBuffer> VideoTorrentManager::add_torrent(
 
 void VideoTorrentManager::feed_video_buffer() {
 	try {
-		while (m_next_piece < m_num_pieces) {
-
-			// Tries to get an alert from alert queue.
-			const libtorrent::alert* new_alert = m_session.wait_for_alert(
-					libtorrent::seconds(10));
-
-			if (new_alert) {
-				// Tries to cast alert pointer to different alert types.
-				const libtorrent::piece_finished_alert* finished_alert =
-						libtorrent::alert_cast<libtorrent::piece_finished_alert>(
-								new_alert);
-				const libtorrent::read_piece_alert* read_alert =
-						libtorrent::alert_cast<libtorrent::read_piece_alert>(
-								new_alert);
-
-				if (finished_alert) {
-					if (finished_alert->handle == m_torrent_handle &&
-						finished_alert->piece_index == m_next_piece) {
-
-						m_torrent_handle.read_piece(m_next_piece);
-					}
-
-				} else if (read_alert) {
-					if (read_alert->handle == m_torrent_handle &&
-						read_alert->piece == m_next_piece) {
-
-						// Adds piece to VideoBuffer.
-						int index = read_alert->piece;
-						boost::shared_array<char> data = read_alert->buffer;
-						int size = read_alert->size;
-
-						m_video_buffer->add_piece(index, data, size);
-						m_next_piece++;
-
-						bool have_next =
-								m_torrent_handle.status().pieces[m_next_piece];
-						if (have_next) {
-							m_torrent_handle.read_piece(m_next_piece);
-						}
-					}
+		bool window_changed = true;
+
+		// Pieces that are already on disk. The ones finished from now on
+		// are reported by alerts.
+		load_have_pieces();
+
+		while (keep_feeding()) {
+
+			if (m_deferred_piece && add_deferred_piece()) {
+				window_changed = true;
+			}
+
+			if (m_verifier && add_verified_pieces()) {
+				window_changed = true;
+			}
+
+			if (load_requested_pieces()) {
+				window_changed = true;
+			}
+
+			// Pieces that were downloaded before entering the window are
+			// requested as the window moves forward. The next missing piece
+			// is always requested, so that the buffer's back pressure
+			// works as before.
+			int window_end = std::min(m_num_pieces,
+					std::max(m_next_piece + 1,
+							m_video_buffer->get_next_piece_index()
+									+ m_video_buffer->window_size()));
+
+			int store_generation = m_piece_store->generation();
+
+			if (window_changed || window_end != m_window_end
+					|| store_generation != m_store_generation) {
+				m_window_end = window_end;
+				m_store_generation = store_generation;
+				window_changed = request_window();
+
+				// Pieces about to be played are hashed first.
+				if (m_verifier) {
+					m_verifier->set_head(m_next_piece);
 				}
+			}
 
-				// Removes alert from queue.
-				m_session.pop_alert();
+			// Waits for alerts routed by the dispatcher and handles them
+			// in batches. Pieces added right away may have moved the
+			// window, so it is scanned again without waiting.
+			std::deque<boost::shared_ptr<libtorrent::alert> > alerts;
+			m_alert_queue->pop_all(alerts,
+					boost::posix_time::milliseconds(window_changed ? 0 : 10000));
+
+			for (size_t i = 0; i < alerts.size(); i++) {
+				window_changed = handle_alert(alerts[i].get())
+						|| window_changed;
+			}
+
+			if (!m_index_checked) {
+				read_video_head();
+			}
+
+			if (m_index_start_piece >= 0) {
+				release_sequential_download();
 			}
 
+			update_download_rate();
+			update_check_progress();
+			update_selection_mode();
+
+			// Deadlines follow playback.
+			m_deadline_scheduler.advance();
+
 			// Allow thread to be interrupted.
-//			boost::this_thread::interruption_point();
+			boost::this_thread::interruption_point();
 		}
 	} catch (boost::thread_interrupted& e) {
 		// Thread will stop.
 	}
 }
 
+/*
+ * Handles an alert about the current torrent. Returns true if the
+ * window should be scanned again.
+ */
+bool VideoTorrentManager::handle_alert(const libtorrent::alert* alert) {
+	// Tries to cast alert pointer to different alert types.
+	const libtorrent::piece_finished_alert* finished_alert =
+			libtorrent::alert_cast<libtorrent::piece_finished_alert>(alert);
+	const libtorrent::read_piece_alert* read_alert =
+			libtorrent::alert_cast<libtorrent::read_piece_alert>(alert);
+	const libtorrent::hash_failed_alert* failed_alert =
+			libtorrent::alert_cast<libtorrent::hash_failed_alert>(alert);
+	const libtorrent::torrent_checked_alert* checked_alert =
+			libtorrent::alert_cast<libtorrent::torrent_checked_alert>(alert);
+
+	if (finished_alert) {
+		set_have_piece(finished_alert->piece_index);
+		return request_piece(finished_alert->piece_index);
+
+	} else if (failed_alert) {
+		int index = failed_alert->piece_index;
+
+		if (index >= 0 && index < m_num_pieces) {
+			clear_have_piece(index);
+			m_on_disk[index] = false;
+		}
+
+	} else if (checked_alert) {
+		// Pieces verified by the initial check (or a recheck). After a
+		// full check there is nothing left for the verifier.
+		if (m_full_check) {
+			m_verifier.reset();
+		}
+
+		m_recheck_pending = false;
+		load_have_pieces();
+		return true;
+
+	} else if (read_alert) {
+		// Reads that didn't fit in the read-ahead depth can be issued now.
+		// A failed read is retried later, through libtorrent. Trusted
+		// pieces that failed their check are corrupt, though libtorrent
+		// trusts them too: they are dropped until libtorrent rechecks the
+		// torrent and downloads them again.
+		int index = read_alert->piece;
+		bool deferred = finish_read(index);
+
+		if (index >= 0 && index < m_num_pieces) {
+			if (!read_alert->buffer) {
+				m_on_disk[index] = false;
+
+				// The head is read again.
+				if (index == m_video_head_piece) {
+					m_video_head_read = false;
+				}
+
+				if (m_unverified[index]) {
+					clear_have_piece(index);
+					recheck_torrent();
+				}
+			}
+
+			m_unverified[index] = false;
+		}
+
+		bool added = false;
+
+		if (read_alert->buffer) {
+			added = add_piece(read_alert->piece, read_alert->buffer,
+					read_alert->size);
+		}
+
+		return added || deferred;
+	}
+
+	return false;
+}
+
 void VideoTorrentManager::notify_playback() {
 	// If deadlines algorithm is being used, updates piece deadline.
 	if (m_deadlines_mode) {
 		int last_requested_piece = m_video_buffer->get_next_piece_index();
-		int pieces_on_buffer = last_requested_piece - m_last_played_piece;
 
-		int buffer_time = m_decoded_piece_length * pieces_on_buffer;
+		int buffer_time = m_deadline_scheduler.duration(m_last_played_piece,
+				last_requested_piece);
 
-		for (int i = last_requested_piece; i < m_num_pieces; i++) {
-			int deadline = (i - last_requested_piece) * m_decoded_piece_length
-					+ buffer_time;
-			m_torrent_handle.set_piece_deadline(i, deadline);
-		}
+		// Only pieces due in the next seconds get deadlines. The feeding
+		// thread schedules the following ones as playback goes on.
+		m_deadline_scheduler.play(last_requested_piece, buffer_time);
 
-		// Disables strict sequential mode.
-		m_torrent_handle.set_sequential_download(false);
+		// Disables strict sequential mode. The adaptive mode leaves it
+		// until there is enough slack.
+		if (!m_adaptive_mode) {
+			set_sequential_download(false);
+		}
 	}
 }
 
 void VideoTorrentManager::notify_stall() {
 	if (m_deadlines_mode) {
 		m_last_played_piece = m_video_buffer->get_next_piece_index();
+		m_deadline_scheduler.stop();
 
 		// Returns to sequential mode until buffer is full.
-		m_torrent_handle.set_sequential_download(true);
+		if (m_adaptive_mode) {
+			m_slack_controller.reset();
+			apply_selection_mode(URGENT_SEQUENTIAL);
+		} else {
+			set_sequential_download(true);
+		}
+	}
+}
+
+void VideoTorrentManager::report_position(int media_time,
+		const boost::posix_time::ptime& wall_time, double rate) {
+
+	if (m_deadlines_mode) {
+		m_deadline_scheduler.report_position(media_time, wall_time, rate);
+	}
+}
+
+boost::shared_ptr<PieceCursor> VideoTorrentManager::create_cursor(
+		int start_piece) throw (Exception) {
+
+	if (!m_piece_store) {
+		throw Exception("No torrent was added.");
+	}
+
+	boost::lock_guard<boost::mutex> lock(m_feeding_mutex);
+
+	boost::shared_ptr<PieceCursor> cursor = m_piece_store->create_cursor(
+			start_piece);
+
+	// The feeding thread stops once the VideoBuffer has every piece, so it
+	// may have to be restarted for the new reader.
+	if (!m_feeding) {
+		m_feeding_thread->join();
+		start_feeding_thread();
+	}
+
+	return cursor;
+}
+
+boost::shared_ptr<RangeReader> VideoTorrentManager::create_reader(
+		boost::int64_t start_offset) throw (Exception) {
+
+	if (!m_piece_store) {
+		throw Exception("No torrent was added.");
 	}
+
+	const libtorrent::torrent_info& info = m_torrent_handle.get_torrent_info();
+
+	int start_piece = std::max<boost::int64_t>(0,
+			std::min<boost::int64_t>(start_offset / info.piece_length(),
+					m_num_pieces));
+
+	return boost::shared_ptr<RangeReader>(
+			new RangeReader(create_cursor(start_piece), info.piece_length(),
+					info.total_size()));
+}
+
+void VideoTorrentManager::set_read_ahead(int depth) {
+	m_read_ahead = std::max(0, depth);
+}
+
+void VideoTorrentManager::set_read_engine(ReadEngine engine) {
+	m_read_engine = engine;
+}
+
+void VideoTorrentManager::set_startup_mode(StartupMode mode) {
+	m_startup_mode = mode;
+}
+
+void VideoTorrentManager::set_deadline_horizon(int horizon) {
+	m_deadline_horizon = horizon;
+	m_deadline_scheduler.set_horizon(horizon);
+}
+
+void VideoTorrentManager::set_slack_thresholds(int low, int high) {
+	m_slack_controller.set_thresholds(low, high);
+}
+
+void VideoTorrentManager::set_index_first(bool enabled) {
+	m_index_first = enabled;
+}
+
+boost::int64_t VideoTorrentManager::index_offset() const {
+	return m_index_offset;
+}
+
+void VideoTorrentManager::set_checkpoint_interval(int seconds) {
+	m_resume_saver.set_interval(seconds);
+}
+
+void VideoTorrentManager::set_store_capacity(long capacity) {
+	m_store_capacity = capacity;
+}
+
+void VideoTorrentManager::set_buffer_mode(BufferMode mode) {
+	m_buffer_settings.mode = mode;
+}
+
+void VideoTorrentManager::set_buffer_settings(const BufferSettings& settings) {
+	m_buffer_settings = settings;
 }
 
 Status VideoTorrentManager::get_status() {
@@ -252,79 +723,86 @@ Status VideoTorrentManager::get_status() {
 	return status;
 }
 
-libtorrent::torrent_info* VideoTorrentManager::read_torrent_file(
-		const std::string& file_name) {
-
-	int size;
-	char* memory_block;
-	libtorrent::torrent_info* ti = 0;
-
-	std::ifstream torrent_file(file_name.c_str(),
-			std::ios::in | std::ios::binary | std::ios::ate);
-
-	if (torrent_file.is_open()) {
-		size = torrent_file.tellg();
-		memory_block = new char[size];
-
-		torrent_file.seekg(0, std::ios::beg);
-		torrent_file.read(memory_block, size);
-		torrent_file.close();
+/*
+ * Returns the metadata of a .torrent file. Files that were added before
+ * are served by the process-wide cache.
+ */
+boost::intrusive_ptr<libtorrent::torrent_info> VideoTorrentManager::read_torrent_file(
+		const std::string& file_name) throw (Exception) {
 
-		ti = new libtorrent::torrent_info(memory_block, size);
+	return TorrentInfoCache::instance().load(file_name);
+}
 
-		delete[] memory_block;
+/*
+ * Lets go of the current torrent before switching: its readers return
+ * right away, its download is paused and its resume data is saved in
+ * the background. The torrent is removed from the session by a later
+ * add_torrent call, once the data was written.
+ */
+void VideoTorrentManager::release_torrent() {
+	stop_index_thread();
+	m_verifier.reset();
+	stop_feeding_thread();
 
-	} else {
-		throw Exception("Could not open torrent file " + file_name);
+	if (m_video_buffer) {
+		m_video_buffer->unlock();
 	}
 
-	return ti;
-}
+	if (m_piece_store) {
+		m_piece_store->unlock();
+	}
 
-void VideoTorrentManager::save_resume_data() {
 	if (m_torrent_handle.is_valid()) {
 		m_torrent_handle.auto_managed(false);
 		m_torrent_handle.pause();
-		m_torrent_handle.save_resume_data();
-
-		// Waits for alerts.
-		int outstanding_resume_data = 1;
-
-		while (outstanding_resume_data > 0) {
-			libtorrent::alert const* new_alert = m_session.wait_for_alert(
-					libtorrent::seconds(10));
-
-			if (new_alert) {
-				libtorrent::save_resume_data_alert const* resume_alert =
-						libtorrent::alert_cast<libtorrent::save_resume_data_alert>(
-								new_alert);
-
-				// Saves resume data file.
-				if (resume_alert && resume_alert->resume_data
-						&& resume_alert->handle == m_torrent_handle) {
-					std::string save_path = m_save_path;
-					std::string torrent_name =
-							m_torrent_handle.get_torrent_info().name();
-					std::string resume_path = save_path + "/" + torrent_name
-							+ ".resume";
-
-					std::ofstream out(resume_path.c_str(), std::ios_base::binary);
-					out.unsetf(std::ios_base::skipws);
-					bencode(std::ostream_iterator<char>(out),
-							*resume_alert->resume_data);
-					outstanding_resume_data--;
-				}
 
-				// Resume data failed.
-				if (libtorrent::alert_cast<libtorrent::save_resume_data_failed_alert>(
-						new_alert)) {
-					outstanding_resume_data--;
-				}
+		m_resume_saver.release(m_torrent_handle,
+				m_save_path + "/" + m_torrent_info->name() + ".resume");
+		m_released_torrents.push_back(m_torrent_handle);
+	}
+}
 
-				m_session.pop_alert();
-			}
+/*
+ * Removes the released torrents whose resume data was written, so that
+ * switching doesn't pile up torrents in the session.
+ */
+void VideoTorrentManager::remove_released_torrents() {
+	std::vector<libtorrent::torrent_handle> pending;
+
+	for (size_t i = 0; i < m_released_torrents.size(); i++) {
+		libtorrent::torrent_handle handle = m_released_torrents[i];
+
+		if (!handle.is_valid()) {
+			continue;
+		}
+
+		if (m_resume_saver.outstanding(handle) > 0) {
+			pending.push_back(handle);
+		} else {
+			m_session.remove_torrent(handle);
 		}
 	}
+
+	m_released_torrents.swap(pending);
+}
+
+void VideoTorrentManager::start_feeding_thread() {
+	m_feeding = true;
+	m_feeding_thread = boost::shared_ptr<boost::thread>(
+			new boost::thread(&VideoTorrentManager::feed_video_buffer, this));
+}
+
+/*
+ * Returns true while the VideoBuffer or any shared store reader still
+ * needs pieces. Once it returns false, the feeding thread will stop.
+ */
+bool VideoTorrentManager::keep_feeding() {
+	boost::lock_guard<boost::mutex> lock(m_feeding_mutex);
+
+	m_feeding = m_next_piece < m_num_pieces
+			|| m_piece_store->num_cursors() > 0;
+
+	return m_feeding;
 }
 
 void VideoTorrentManager::stop_feeding_thread() {
@@ -342,4 +820,809 @@ void VideoTorrentManager::clear_alerts() {
 	}
 }
 
+/*
+ * Routes the current torrent's alerts used by the feeding thread to a new
+ * queue.
+ */
+void VideoTorrentManager::add_alert_handlers() {
+	static const int alert_types[] = {
+			libtorrent::read_piece_alert::alert_type,
+			libtorrent::piece_finished_alert::alert_type,
+			libtorrent::hash_failed_alert::alert_type,
+			libtorrent::torrent_checked_alert::alert_type };
+
+	m_alert_queue = boost::shared_ptr<AlertQueue>(new AlertQueue());
+
+	for (size_t i = 0; i < sizeof(alert_types) / sizeof(alert_types[0]);
+			i++) {
+		m_alert_handlers.push_back(
+				m_alert_dispatcher.add_handler(
+						boost::bind(&AlertQueue::push, m_alert_queue, _1),
+						alert_types[i], m_torrent_handle));
+	}
+}
+
+void VideoTorrentManager::remove_alert_handlers() {
+	for (size_t i = 0; i < m_alert_handlers.size(); i++) {
+		m_alert_dispatcher.remove_handler(m_alert_handlers[i]);
+	}
+
+	m_alert_handlers.clear();
+}
+
+/*
+ * Starts reading the container index of the current torrent's video in
+ * the background.
+ */
+void VideoTorrentManager::start_index_thread() {
+	m_index_thread = boost::shared_ptr<boost::thread>(
+			new boost::thread(&VideoTorrentManager::build_media_index, this,
+					m_torrent_handle, m_torrent_info, m_video_buffer));
+}
+
+void VideoTorrentManager::stop_index_thread() {
+	if (m_index_thread) {
+		m_index_thread->interrupt();
+		m_index_thread->join();
+		m_index_thread.reset();
+	}
+}
+
+/*
+ * Reads the container index of the torrent's largest file, which is
+ * taken as the video, and times pieces by it. Runs in its own thread,
+ * reading the file from disk, so it never holds pieces in the store nor
+ * waits on the feeder.
+ *
+ * Index ranges whose pieces weren't downloaded yet get an immediate
+ * deadline and the parse is retried after INDEX_RETRY_INTERVAL_MS.
+ * MPEG-TS files have no index, so PCRs are only sampled from downloaded
+ * pieces. The table is parsed again as more pieces arrive, until every
+ * sample was read.
+ */
+void VideoTorrentManager::build_media_index(libtorrent::torrent_handle handle,
+		boost::intrusive_ptr<libtorrent::torrent_info> info,
+		boost::shared_ptr<VideoBuffer> video_buffer) {
+
+	libtorrent::file_entry file = info->file_at(video_file(*info));
+
+	IndexFile index_file;
+	index_file.handle = handle;
+	index_file.path = m_save_path + "/" + file.path;
+	index_file.offset = file.offset;
+	index_file.piece_length = info->piece_length();
+
+	MediaIndex index;
+
+	try {
+		while (true) {
+			index_file.missing = false;
+			bool parsed = index.parse(
+					boost::bind(&VideoTorrentManager::read_index_range, this,
+							&index_file, _1, _2, _3), file.size,
+					boost::bind(&VideoTorrentManager::range_downloaded, this,
+							file.offset, info->piece_length(), _1, _2));
+
+			if (parsed && index.duration() > 0) {
+				m_deadline_scheduler.set_piece_times(
+						index.piece_times(file.offset, info->piece_length(),
+								info->num_pieces()), index.duration());
+
+				video_buffer->set_media_rate(
+						info->total_size() * 1000 / index.duration());
+			}
+
+			if (index_file.missing) {
+				// Reopens the file, which may have been allocated meanwhile.
+				index_file.files.close_files();
+				boost::this_thread::sleep(
+						boost::posix_time::milliseconds(INDEX_RETRY_INTERVAL_MS));
+				continue;
+			}
+
+			if (index.complete()) {
+				break;
+			}
+
+			boost::this_thread::sleep(
+					boost::posix_time::milliseconds(INDEX_REFINE_INTERVAL_MS));
+		}
+	} catch (boost::thread_interrupted& e) {
+		// Thread will stop.
+	}
+}
+
+/*
+ * Reads a range of the video file from disk. Used as the MediaIndex
+ * ByteSource. If the range's pieces weren't downloaded yet, they are
+ * requested with an immediate deadline, the file is marked as missing
+ * data and nothing is read.
+ */
+int VideoTorrentManager::read_index_range(IndexFile* file,
+		boost::int64_t offset, int size, char* buffer) {
+
+	boost::this_thread::interruption_point();
+
+	if (!range_downloaded(file->offset, file->piece_length, offset, size)) {
+		int first = (file->offset + offset) / file->piece_length;
+		int last = (file->offset + offset + std::max(size, 1) - 1)
+				/ file->piece_length;
+
+		for (int i = first; i <= last; i++) {
+			file->handle.set_piece_deadline(i, 0);
+		}
+
+		file->missing = true;
+		return 0;
+	}
+
+	FileSlice slice;
+	slice.path = file->path;
+	slice.offset = offset;
+	slice.size = size;
+
+	return std::max(read_slices(file->files,
+			std::vector<FileSlice>(1, slice), buffer), 0);
+}
+
+/*
+ * Returns true if every piece holding a range of the file that starts at
+ * file_offset was downloaded. Called by the index thread, so it uses a
+ * copy of m_have.
+ */
+bool VideoTorrentManager::range_downloaded(boost::int64_t file_offset,
+		int piece_length, boost::int64_t offset, int size) {
+
+	int first = (file_offset + offset) / piece_length;
+	int last = (file_offset + offset + std::max(size, 1) - 1) / piece_length;
+
+	boost::lock_guard<boost::mutex> lock(m_index_mutex);
+
+	for (int i = first; i <= last; i++) {
+		if (i >= (int) m_index_have.size() || !m_index_have[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void VideoTorrentManager::update_download_rate() {
+	if (!m_buffer_settings.adaptive) {
+		return;
+	}
+
+	// Reports download rate to VideoBuffer at most once per second.
+	boost::posix_time::ptime now =
+			boost::posix_time::microsec_clock::universal_time();
+
+	if (m_last_rate_update.is_not_a_date_time()
+			|| now - m_last_rate_update >= boost::posix_time::seconds(1)) {
+		libtorrent::torrent_status status = m_torrent_handle.status(0);
+		m_video_buffer->set_download_rate(status.download_payload_rate);
+
+		m_last_rate_update = now;
+	}
+}
+
+/*
+ * Measures the buffer slack in ADAPTIVE mode, at most once per second,
+ * and switches piece selection when the controller says so. Until
+ * pieces can be timed, they are downloaded sequentially.
+ */
+void VideoTorrentManager::update_selection_mode() {
+	if (!m_adaptive_mode) {
+		return;
+	}
+
+	boost::posix_time::ptime now =
+			boost::posix_time::microsec_clock::universal_time();
+
+	if (!m_last_slack_update.is_not_a_date_time()
+			&& now - m_last_slack_update < boost::posix_time::seconds(1)) {
+		return;
+	}
+
+	m_last_slack_update = now;
+
+	int slack = m_deadline_scheduler.slack(m_have, now);
+
+	if (slack >= 0 && m_slack_controller.update(slack)) {
+		apply_selection_mode(m_slack_controller.mode());
+	}
+}
+
+void VideoTorrentManager::apply_selection_mode(SelectionMode mode) {
+	switch (mode) {
+	case URGENT_SEQUENTIAL:
+		m_deadline_scheduler.set_horizon(m_deadline_horizon);
+		set_sequential_download(true);
+		break;
+
+	case DEADLINE_WINDOW:
+		m_deadline_scheduler.set_horizon(m_deadline_horizon);
+		set_sequential_download(false);
+		break;
+
+	case RAREST_FIRST_WINDOW:
+		// Only the pieces about to be played keep deadlines.
+		m_deadline_scheduler.set_horizon(
+				std::min(m_deadline_horizon,
+						m_slack_controller.low_threshold()));
+		set_sequential_download(false);
+		break;
+	}
+}
+
+bool VideoTorrentManager::add_piece(int index, boost::shared_array<char> data,
+		int size) {
+
+	if (index < 0 || index >= m_num_pieces) {
+		return false;
+	}
+
+	if (index == m_video_head_piece && !m_index_checked) {
+		check_trailing_index(index, data, size);
+	}
+
+	// Shared readers use the same piece memory.
+	m_piece_store->add_piece(index, data, size);
+
+	return add_to_buffer(index, data, size);
+}
+
+bool VideoTorrentManager::add_to_buffer(int index,
+		boost::shared_array<char> data, int size) {
+
+	if (m_added[index]) {
+		return false;
+	}
+
+	// Pieces ahead of a missing one may be rejected if the buffer is
+	// full. They will be requested again when there is room. The next
+	// missing piece is kept instead, so that alerts are still handled
+	// while the player is paused.
+	if (m_video_buffer->try_add_piece(index, data, size)) {
+		m_added[index] = true;
+
+		while (m_next_piece < m_num_pieces && m_added[m_next_piece]) {
+			m_next_piece++;
+		}
+
+		return true;
+	}
+
+	if (index == m_next_piece && !m_video_buffer->unlocked()) {
+		m_deferred_piece = make_piece(index, data, size);
+	}
+
+	return false;
+}
+
+/*
+ * Tries again to add the piece rejected by a full VideoBuffer. Returns
+ * true if it was added.
+ */
+bool VideoTorrentManager::add_deferred_piece() {
+	boost::shared_ptr<Piece> piece;
+	piece.swap(m_deferred_piece);
+
+	return add_to_buffer(piece->index, piece->data, piece->size);
+}
+
+/*
+ * Reads a piece that is wanted by the VideoBuffer or a shared store
+ * reader, or that a reader asked for (forced). Returns true if it was
+ * added to the VideoBuffer right away.
+ */
+bool VideoTorrentManager::request_piece(int index, bool forced) {
+	if (index < 0 || index >= m_num_pieces || m_requested[index]) {
+		return false;
+	}
+
+	// Already read, waiting for space on the buffer.
+	if (m_deferred_piece && m_deferred_piece->index == index) {
+		return false;
+	}
+
+	// In lazy mode the buffer loads its own pieces.
+	bool buffer_wants = !m_video_buffer->lazy() && !m_added[index]
+			&& (index == m_next_piece || m_video_buffer->in_window(index));
+
+	if (!forced && !buffer_wants && !m_piece_store->wanted(index)) {
+		return false;
+	}
+
+	// Complete files are served from their mappings, without reads.
+	boost::shared_array<char> data;
+	int size;
+
+	if (m_on_disk[index] && map_view(index, data, size)) {
+		return add_piece(index, data, size);
+	}
+
+	// Pieces that don't fit in the read-ahead depth are requested when
+	// a read finishes.
+	if (m_read_ahead > 0 && m_reads_in_flight >= m_read_ahead) {
+		m_reads_deferred = true;
+		return false;
+	}
+
+	if (m_disk_reader && m_on_disk[index]) {
+		read_direct(index);
+	} else {
+		m_torrent_handle.read_piece(index);
+	}
+
+	m_requested[index] = true;
+	m_reads_in_flight++;
+
+	return false;
+}
+
+/*
+ * Reads a piece with the DiskReader. The result arrives as a
+ * read_piece_alert, so it is handled like any other read. The kernel is
+ * also told to read ahead the piece that will be requested next.
+ */
+void VideoTorrentManager::read_direct(int index) {
+	// Pieces trusted from the resume data are hashed as they are read.
+	ReadCheck check;
+	if (m_unverified[index]) {
+		check = boost::bind(&check_piece_hash, m_torrent_info, _1, _2, _3);
+	}
+
+	m_disk_reader->read(index, map_piece(index), m_piece_pool->get_buffer(),
+			boost::bind(&post_read_alert, m_alert_queue, m_torrent_handle, _1,
+					_2, _3), check);
+
+	int next = index + std::max(1, m_read_ahead);
+	if (next < m_num_pieces && m_on_disk[next]) {
+		m_disk_reader->advise(map_piece(next));
+	}
+}
+
+/*
+ * Maps the torrent's files, which must be complete. Files that can't be
+ * mapped are read as usual.
+ */
+void VideoTorrentManager::map_files() {
+	m_mapped_files.resize(m_torrent_info->num_files());
+
+	for (int i = 0; i < m_torrent_info->num_files(); i++) {
+		const libtorrent::file_entry& file = m_torrent_info->file_at(i);
+
+		try {
+			boost::shared_ptr<MappedFile> mapped(
+					new MappedFile(m_save_path + "/" + file.path));
+
+			if (mapped->size() >= file.size) {
+				m_mapped_files[i] = mapped;
+			}
+		} catch (Exception& e) {
+			// Read through libtorrent.
+		}
+	}
+}
+
+/*
+ * Points data to a piece inside a mapped file. Returns false if the
+ * piece isn't mapped or spans more than one file.
+ */
+bool VideoTorrentManager::map_view(int index, boost::shared_array<char>& data,
+		int& size) {
+
+	// Pieces that weren't hashed yet are read with a check.
+	if (m_mapped_files.empty() || m_unverified[index]) {
+		return false;
+	}
+
+	std::vector<libtorrent::file_slice> files = m_torrent_info->map_block(
+			index, 0, m_torrent_info->piece_size(index));
+
+	if (files.size() != 1 || !m_mapped_files[files[0].file_index]) {
+		return false;
+	}
+
+	data = m_mapped_files[files[0].file_index]->view(files[0].offset,
+			files[0].size);
+	size = files[0].size;
+
+	return data.get() != 0;
+}
+
+/*
+ * Returns the file regions where a piece is stored.
+ */
+std::vector<FileSlice> VideoTorrentManager::map_piece(int index) {
+	return btstream::map_piece(*m_torrent_info, m_save_path, index);
+}
+
+/*
+ * Maps the files once every piece is known to be on disk.
+ */
+void VideoTorrentManager::map_if_complete() {
+	if (m_mapped_files.empty() && (int) m_on_disk.count() == m_num_pieces) {
+		map_files();
+	}
+}
+
+/*
+ * Starts hashing the pieces on disk that weren't trusted, from the
+ * playback position. Valid pieces are handed to the feeding thread.
+ */
+void VideoTorrentManager::start_verifier() {
+	m_verified_pieces.clear();
+
+	m_verifier.reset(
+			new PieceVerifier(m_torrent_info, m_save_path,
+					boost::bind(&VideoTorrentManager::piece_verified, this, _1,
+							_2)));
+
+	for (int i = 0; i < m_num_pieces; i++) {
+		if (m_unverified[i]) {
+			m_verifier->skip(i);
+		}
+	}
+
+	m_verifier->start(m_next_piece);
+}
+
+/*
+ * Makes libtorrent check the torrent's files again, so that it downloads
+ * the corrupt pieces that it trusted from the resume data. Failures
+ * found while a recheck is pending are covered by it.
+ */
+void VideoTorrentManager::recheck_torrent() {
+	if (!m_recheck_pending) {
+		m_recheck_pending = true;
+		m_torrent_handle.force_recheck();
+	}
+}
+
+/*
+ * While libtorrent checks the whole files, which it does in order, the
+ * verifier skips the pieces that libtorrent already checked. Polled at
+ * most once per second.
+ */
+void VideoTorrentManager::update_check_progress() {
+	if (!m_verifier || !m_full_check) {
+		return;
+	}
+
+	boost::posix_time::ptime now =
+			boost::posix_time::microsec_clock::universal_time();
+
+	if (!m_last_check_update.is_not_a_date_time()
+			&& now - m_last_check_update < boost::posix_time::seconds(1)) {
+		return;
+	}
+
+	m_last_check_update = now;
+
+	libtorrent::torrent_status status = m_torrent_handle.status(0);
+	if (status.state != libtorrent::torrent_status::checking_files) {
+		return;
+	}
+
+	int checked = std::min(m_num_pieces,
+			(int) (status.progress * m_num_pieces));
+
+	for (; m_checked_pieces < checked; m_checked_pieces++) {
+		m_verifier->skip(m_checked_pieces);
+	}
+}
+
+/*
+ * Called by the verifier threads.
+ */
+void VideoTorrentManager::piece_verified(int index, bool valid) {
+	if (!valid) {
+		return;
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_verified_mutex);
+		m_verified_pieces.push_back(index);
+	} // Releasing lock.
+
+	m_alert_queue->wake();
+}
+
+/*
+ * Called by the VideoBuffer loader and the PieceStore, from reader
+ * threads. The piece is read by the feeding thread, which knows whether
+ * it was downloaded.
+ */
+void VideoTorrentManager::queue_load(boost::shared_ptr<AlertQueue> queue,
+		int index) {
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_load_mutex);
+
+		if (queue != m_load_queue) {
+			return;
+		}
+
+		m_load_requests.push_back(index);
+	} // Releasing lock.
+
+	queue->wake();
+}
+
+/*
+ * Reads the downloaded pieces that readers asked for. Pieces that don't
+ * fit in the read-ahead depth are kept for later. Returns true if pieces
+ * were added to the VideoBuffer right away.
+ */
+bool VideoTorrentManager::load_requested_pieces() {
+	std::vector<int> pieces;
+	{
+		boost::lock_guard<boost::mutex> lock(m_load_mutex);
+		pieces.swap(m_load_requests);
+	} // Releasing lock.
+
+	bool added = false;
+	std::vector<int> deferred;
+
+	for (size_t i = 0; i < pieces.size(); i++) {
+		int index = pieces[i];
+
+		// Missing pieces are read when they finish.
+		if (index < 0 || index >= m_num_pieces || !m_have[index]) {
+			continue;
+		}
+
+		added = request_piece(index, true) || added;
+
+		if (!m_requested[index] && m_read_ahead > 0
+				&& m_reads_in_flight >= m_read_ahead) {
+			deferred.push_back(index);
+		}
+	}
+
+	if (!deferred.empty()) {
+		boost::lock_guard<boost::mutex> lock(m_load_mutex);
+		m_load_requests.insert(m_load_requests.begin(), deferred.begin(),
+				deferred.end());
+	} // Releasing lock.
+
+	return added;
+}
+
+/*
+ * Marks the pieces hashed by the verifier as available, before
+ * libtorrent finishes its own check. Returns true if there were new
+ * pieces.
+ */
+bool VideoTorrentManager::add_verified_pieces() {
+	std::vector<int> pieces;
+	{
+		boost::lock_guard<boost::mutex> lock(m_verified_mutex);
+		pieces.swap(m_verified_pieces);
+	} // Releasing lock.
+
+	bool changed = false;
+
+	for (size_t i = 0; i < pieces.size(); i++) {
+		if (!m_have[pieces[i]]) {
+			m_on_disk[pieces[i]] = true;
+			set_have_piece(pieces[i]);
+			changed = true;
+		}
+	}
+
+	if (changed) {
+		map_if_complete();
+	}
+
+	return changed;
+}
+
+/*
+ * Accounts for a finished (or failed) read issued by request_piece().
+ * Returns true if reads were deferred, so the window should be scanned
+ * again.
+ */
+bool VideoTorrentManager::finish_read(int index) {
+	if (index < 0 || index >= m_num_pieces || !m_requested[index]) {
+		return false;
+	}
+
+	m_requested[index] = false;
+	m_reads_in_flight--;
+
+	bool deferred = m_reads_deferred;
+	m_reads_deferred = false;
+
+	return deferred;
+}
+
+/*
+ * Requests the downloaded pieces inside the VideoBuffer window and the
+ * ones wanted by shared store readers. Returns true if pieces were added
+ * to the VideoBuffer right away.
+ */
+bool VideoTorrentManager::request_window() {
+	m_reads_deferred = false;
+
+	bool added = false;
+
+	for (int i = m_next_piece; i < m_window_end; i++) {
+		if (m_have[i]) {
+			added = request_piece(i) || added;
+		}
+	}
+
+	std::vector<int> wanted = m_piece_store->wanted_pieces();
+	for (size_t i = 0; i < wanted.size(); i++) {
+		if (m_have[wanted[i]]) {
+			added = request_piece(wanted[i]) || added;
+		}
+	}
+
+	return added;
+}
+
+/*
+ * Reads the first piece of the video once it is downloaded, even if no
+ * reader wants it yet, so that its layout is known early. The read may
+ * wait for the read-ahead depth; if it fails, it is issued again.
+ */
+void VideoTorrentManager::read_video_head() {
+	if (m_video_head_read || !m_have[m_video_head_piece]
+			|| m_requested[m_video_head_piece]) {
+		return;
+	}
+
+	// Mapped pieces are checked right away.
+	request_piece(m_video_head_piece, true);
+	m_video_head_read = m_requested[m_video_head_piece] || m_index_checked;
+}
+
+/*
+ * Lets the sequential feed start once every piece of the trailing index
+ * was downloaded.
+ */
+void VideoTorrentManager::release_sequential_download() {
+	for (int i = m_index_start_piece; i <= m_index_end_piece; i++) {
+		if (!m_have[i]) {
+			return;
+		}
+	}
+
+	m_index_start_piece = -1;
+	m_index_end_piece = -1;
+	hold_sequential_download(false);
+}
+
+/*
+ * Sets sequential download on the torrent, unless it is held off while a
+ * trailing index is downloaded. Then it is applied when released.
+ */
+void VideoTorrentManager::set_sequential_download(bool sequential) {
+	boost::lock_guard<boost::mutex> lock(m_sequential_mutex);
+
+	m_sequential_download = sequential;
+	if (!m_sequential_held) {
+		m_torrent_handle.set_sequential_download(sequential);
+	}
+}
+
+/*
+ * Holds off sequential download, so that libtorrent doesn't spend peers
+ * on the head of the file before the pieces with deadlines.
+ */
+void VideoTorrentManager::hold_sequential_download(bool hold) {
+	boost::lock_guard<boost::mutex> lock(m_sequential_mutex);
+
+	m_sequential_held = hold;
+	m_torrent_handle.set_sequential_download(!hold && m_sequential_download);
+}
+
+/*
+ * Looks for an index after the media data in the first piece of the
+ * video. If there is one, the pieces holding it get the earliest
+ * deadline, and sequential download only starts once they are all
+ * downloaded. The head piece may start with the end of a previous file.
+ */
+void VideoTorrentManager::check_trailing_index(int index,
+		boost::shared_array<char> data, int size) {
+
+	m_index_checked = true;
+
+	int piece_length = m_torrent_info->piece_length();
+	libtorrent::file_entry file = m_torrent_info->file_at(
+			video_file(*m_torrent_info));
+
+	int skip = file.offset - (boost::int64_t) index * piece_length;
+	int head_size = std::min<boost::int64_t>(size - skip, file.size);
+
+	boost::int64_t offset;
+	if (head_size <= 0
+			|| !find_trailing_index(data.get() + skip, head_size, file.size,
+					offset)) {
+		return;
+	}
+
+	boost::int64_t index_start = file.offset + offset;
+	int first = index_start / piece_length;
+	int last = (file.offset + file.size - 1) / piece_length;
+
+	bool missing = false;
+
+	for (int i = first; i <= last; i++) {
+		if (!m_have[i]) {
+			m_torrent_handle.set_piece_deadline(i, 0);
+			missing = true;
+		}
+	}
+
+	if (missing) {
+		m_index_start_piece = first;
+		m_index_end_piece = last;
+		hold_sequential_download(true);
+	}
+
+	m_index_offset = index_start;
+}
+
+/*
+ * Copies the torrent's piece bitfield to m_have. This is the only place
+ * where the feeding thread asks libtorrent for it; afterwards m_have is
+ * kept up to date by alerts. Pieces that weren't downloaded by this
+ * session are on disk, so they may be read directly, as well as pieces
+ * trusted from the resume data.
+ */
+void VideoTorrentManager::load_have_pieces() {
+	libtorrent::torrent_status status = m_torrent_handle.status(
+			libtorrent::torrent_handle::query_pieces);
+
+	int num_pieces = std::min(m_num_pieces, (int) status.pieces.size());
+	for (int i = 0; i < num_pieces; i++) {
+		if (status.pieces[i] || m_unverified[i]) {
+			if (!m_have[i]) {
+				m_on_disk[i] = true;
+			}
+
+			set_have_piece(i);
+		}
+	}
+
+	// A torrent that was complete on disk is streamed from its mapped
+	// files. It is still seeded by libtorrent.
+	map_if_complete();
+}
+
+void VideoTorrentManager::set_have_piece(int index) {
+	if (index < 0 || index >= m_num_pieces) {
+		return;
+	}
+
+	// Pieces that libtorrent has aren't hashed again.
+	if (m_verifier) {
+		m_verifier->skip(index);
+	}
+
+	m_have[index] = true;
+	m_video_buffer->set_piece_ready(index);
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_index_mutex);
+		m_index_have[index] = true;
+	} // Releasing lock.
+}
+
+/*
+ * Forgets a piece that failed its check, until libtorrent has it again.
+ */
+void VideoTorrentManager::clear_have_piece(int index) {
+	m_have[index] = false;
+
+	{
+		boost::lock_guard<boost::mutex> lock(m_index_mutex);
+		m_index_have[index] = false;
+	} // Releasing lock.
+}
+
 } /* namespace btstream */
@@ -27,9 +27,23 @@
 
 #include <libtorrent/session.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/atomic.hpp>
 
+#include "alertdispatcher.h"
+#include "deadlinescheduler.h"
+#include "resumesaver.h"
+#include "slackcontroller.h"
+#include "torrentinfocache.h"
+#include "diskreader.h"
+#include "mappedfile.h"
+#include "mediaindex.h"
+#include "pieceverifier.h"
+#include "piecepool.h"
 #include "videobuffer.h"
+#include "piecestore.h"
+#include "rangereader.h"
 #include "exception.h"
 #include "piecepicker.h"
 
@@ -51,9 +65,50 @@ struct Status {
 };
 
 enum Algorithm {
-	RAREST_FIRST, SEQUENTIAL, DEADLINE
+	RAREST_FIRST, SEQUENTIAL, DEADLINE, ADAPTIVE
 };
 
+/**
+ * How pieces that were already downloaded are read. LIBTORRENT_READS
+ * uses read_piece and its alerts; DIRECT_READS reads the files with
+ * pread from a dedicated thread.
+ */
+enum ReadEngine {
+	LIBTORRENT_READS, DIRECT_READS
+};
+
+/**
+ * How pieces already on disk are verified when a torrent is added.
+ * LIBTORRENT_CHECK waits for libtorrent's check. FAST_START trusts the
+ * resume data, checking those pieces when they are read, and hashes the
+ * other pieces on every core, starting at the playback position.
+ */
+enum StartupMode {
+	LIBTORRENT_CHECK, FAST_START
+};
+
+/**
+ * Default number of concurrent piece reads issued by the feeding thread.
+ */
+const int DEFAULT_READ_AHEAD = 4;
+
+/**
+ * Maximum time the destructor waits for resume data, in milliseconds.
+ */
+const int RESUME_DATA_TIMEOUT_MS = 3000;
+
+/**
+ * Time between parses of an MPEG-TS index that was built from the
+ * pieces downloaded so far, in milliseconds.
+ */
+const int INDEX_REFINE_INTERVAL_MS = 10000;
+
+/**
+ * Time between parses of a media index whose pieces are still being
+ * downloaded, in milliseconds.
+ */
+const int INDEX_RETRY_INTERVAL_MS = 1000;
+
 /**
  * Manages video torrents through libtorrent.
  * Sends downloaded pieces to a VideoBuffer in order to be played.
@@ -76,6 +131,11 @@ public:
 	 * VideoBuffer that will store downloaded pieces.
 	 *
 	 * With this method, a built-in piece selection algorithm can be chosen.
+	 * With DEADLINE, pieces are timed by the video's container index
+	 * once its pieces arrive; stream_length may then be zero. ADAPTIVE
+	 * times pieces the same way, and moves between sequential, deadline
+	 * and rarest first selection as the media buffered ahead of playback
+	 * shrinks or grows.
 	 */
 	boost::shared_ptr<VideoBuffer> add_torrent(const std::string& file_name,
 			const std::string& save_path, Algorithm algorithm,
@@ -91,9 +151,40 @@ public:
 			PiecePicker* piece_picker, const std::string& save_path)
 			throw (Exception);
 
+	/**
+	 * Replaces the torrent being streamed by the one given by file_name.
+	 * The current VideoBuffer and readers are unlocked. The previous
+	 * torrent is paused and its resume data is saved in the background;
+	 * it is removed from the session by a later add or switch, once the
+	 * data was written. The session, and so the listen socket, is kept.
+	 */
+	boost::shared_ptr<VideoBuffer> switch_torrent(const std::string& file_name,
+			const std::string& save_path, Algorithm algorithm,
+			int stream_length) throw (Exception);
+
+	/**
+	 * Replaces the torrent being streamed, with a custom piece selection
+	 * algorithm. See the method above.
+	 */
+	boost::shared_ptr<VideoBuffer> switch_torrent(const std::string& file_name,
+			PiecePicker* piece_picker, const std::string& save_path)
+			throw (Exception);
+
+	/**
+	 * Returns how long the last switch_torrent call took.
+	 */
+	boost::posix_time::time_duration last_switch_duration() const;
+
 	/**
 	 * Adds downloaded pieces to VideoBuffer.
-	 * Pieces will be get through a libtorrent alert.
+	 * Pieces will be get through libtorrent alerts, which are routed to
+	 * this thread by the session's AlertDispatcher. This thread never
+	 * blocks on a full VideoBuffer: the next piece is kept until the
+	 * player frees space, while alerts are still handled. If the torrent
+	 * was complete when added, pieces are views of its mapped files and
+	 * no reads are issued. Every piece inside
+	 * the VideoBuffer reorder window is read as soon as it is available,
+	 * in any order.
 	 */
 	void feed_video_buffer();
 
@@ -111,6 +202,111 @@ public:
 	 */
 	void notify_stall();
 
+	/**
+	 * Knowing where the video player is and how fast it plays, re-times
+	 * the deadlines of upcoming pieces by the real playback clock.
+	 */
+	void report_position(int media_time,
+			const boost::posix_time::ptime& wall_time, double rate);
+
+	/**
+	 * Sets the synchronization strategy of the VideoBuffers created by
+	 * the following add_torrent calls. Use SPSC only if pieces will be
+	 * read by a single thread.
+	 */
+	void set_buffer_mode(BufferMode mode);
+
+	/**
+	 * Sets capacity and synchronization settings of the VideoBuffers
+	 * created by the following add_torrent calls.
+	 */
+	void set_buffer_settings(const BufferSettings& settings);
+
+	/**
+	 * Creates an additional reader for the current torrent, starting at
+	 * start_piece. Readers share piece memory with each other, so
+	 * several consumers may read the same download at different
+	 * positions. Pieces that were evicted are read again from disk.
+	 */
+	boost::shared_ptr<PieceCursor> create_cursor(int start_piece = 0)
+			throw (Exception);
+
+	/**
+	 * Creates a byte-range reader for the current torrent. Its cursor
+	 * starts at the piece containing start_offset.
+	 */
+	boost::shared_ptr<RangeReader> create_reader(
+			boost::int64_t start_offset = 0) throw (Exception);
+
+	/**
+	 * Sets how many read_piece requests for pieces that are already
+	 * downloaded may be in flight at once. Pieces are read ahead of the
+	 * playback position in order and handed to the buffer as they
+	 * complete. Zero means no limit other than the buffer window.
+	 */
+	void set_read_ahead(int depth);
+
+	/**
+	 * Sets how the following add_torrent calls read pieces that were
+	 * already on disk when the torrent was added. With DIRECT_READS they
+	 * are read straight from the files into pooled buffers, without
+	 * waiting for libtorrent's disk thread. Pieces downloaded afterwards
+	 * are always read through libtorrent, which may still be caching
+	 * them.
+	 */
+	void set_read_engine(ReadEngine engine);
+
+	/**
+	 * Sets how the following add_torrent calls verify pieces that are
+	 * already on disk. With FAST_START, streaming doesn't wait for the
+	 * whole files to be checked; pieces are read directly once they are
+	 * verified, as with DIRECT_READS.
+	 */
+	void set_startup_mode(StartupMode mode);
+
+	/**
+	 * Sets the maximum amount of data kept by the shared piece store of
+	 * the following add_torrent calls, in bytes. Zero (the default)
+	 * only limits the store by the readers' windows.
+	 */
+	void set_store_capacity(long capacity);
+
+	/**
+	 * Sets how far ahead of playback piece deadlines are kept in DEADLINE
+	 * mode, in milliseconds.
+	 */
+	void set_deadline_horizon(int horizon);
+
+	/**
+	 * Sets the buffer slack thresholds of the ADAPTIVE algorithm, in
+	 * milliseconds of media ahead of playback. Under low, pieces are
+	 * downloaded sequentially; above high, rarest first.
+	 */
+	void set_slack_thresholds(int low, int high);
+
+	/**
+	 * Makes the following add_torrent calls look for an index stored
+	 * after the media data (an MP4 moov box at the end, or Matroska
+	 * Cues) in the first piece of the video, and download the pieces
+	 * holding it before the rest of the file. Sequential download is
+	 * held off until the index is downloaded.
+	 */
+	void set_index_first(bool enabled);
+
+	/**
+	 * Returns the torrent offset where the trailing index of the current
+	 * video starts, or -1 if there is none or the first piece didn't
+	 * arrive yet. The index can be read with create_reader(index_offset()),
+	 * while the VideoBuffer is fed from the head of the file.
+	 */
+	boost::int64_t index_offset() const;
+
+	/**
+	 * Sets how often the resume data of torrents that changed is saved,
+	 * in seconds. Checkpoints are written in the background.
+	 */
+	void set_checkpoint_interval(int seconds);
+
 	/**
 	 * Returns a Status object with statistics like download rate,
 	 * upload rate, progress and current class.
@@ -118,23 +314,139 @@ public:
 	Status get_status();
 
 private:
+	friend class VideoTorrentManagerStateTest;
+
+	/**
+	 * Video file read by the index thread.
+	 */
+	struct IndexFile {
+		libtorrent::torrent_handle handle;
+		FileCache files;
+		std::string path;
+		boost::int64_t offset;
+		int piece_length;
+		bool missing;
+	};
 
-	libtorrent::torrent_info* read_torrent_file(const std::string& file_name);
-	void save_resume_data();
+	boost::intrusive_ptr<libtorrent::torrent_info> read_torrent_file(
+			const std::string& file_name) throw (Exception);
+	void release_torrent();
+	void remove_released_torrents();
+	void start_feeding_thread();
+	bool keep_feeding();
 	void stop_feeding_thread();
 	void clear_alerts();
+	void add_alert_handlers();
+	void remove_alert_handlers();
+	bool handle_alert(const libtorrent::alert* alert);
+	bool add_piece(int index, boost::shared_array<char> data, int size);
+	bool add_to_buffer(int index, boost::shared_array<char> data, int size);
+	bool add_deferred_piece();
+	bool finish_read(int index);
+	void load_have_pieces();
+	void set_have_piece(int index);
+	void clear_have_piece(int index);
+	bool request_piece(int index, bool forced = false);
+	void queue_load(boost::shared_ptr<AlertQueue> queue, int index);
+	bool load_requested_pieces();
+	void read_direct(int index);
+	std::vector<FileSlice> map_piece(int index);
+	void map_files();
+	bool map_view(int index, boost::shared_array<char>& data, int& size);
+	void map_if_complete();
+	void start_verifier();
+	void recheck_torrent();
+	void update_check_progress();
+	void piece_verified(int index, bool valid);
+	bool add_verified_pieces();
+	bool request_window();
+	void read_video_head();
+	void release_sequential_download();
+	void set_sequential_download(bool sequential);
+	void hold_sequential_download(bool hold);
+	void check_trailing_index(int index, boost::shared_array<char> data,
+			int size);
+	void update_download_rate();
+	void update_selection_mode();
+	void apply_selection_mode(SelectionMode mode);
+	void start_index_thread();
+	void stop_index_thread();
+	void build_media_index(libtorrent::torrent_handle handle,
+			boost::intrusive_ptr<libtorrent::torrent_info> info,
+			boost::shared_ptr<VideoBuffer> video_buffer);
+	int read_index_range(IndexFile* file, boost::int64_t offset, int size,
+			char* buffer);
+	bool range_downloaded(boost::int64_t file_offset, int piece_length,
+			boost::int64_t offset, int size);
 
 	libtorrent::session m_session;
+	AlertDispatcher m_alert_dispatcher;
+	ResumeSaver m_resume_saver;
+	boost::shared_ptr<AlertQueue> m_alert_queue;
+	std::vector<int> m_alert_handlers;
 	libtorrent::torrent_handle m_torrent_handle;
+	std::vector<libtorrent::torrent_handle> m_released_torrents;
 	boost::shared_ptr<VideoBuffer> m_video_buffer;
+	boost::shared_ptr<PieceStore> m_piece_store;
+	long m_store_capacity;
+	int m_store_generation;
 	std::string m_save_path;
 	int m_num_pieces;
 	int m_next_piece;
+	int m_window_end;
+	boost::dynamic_bitset<> m_added;
+	boost::dynamic_bitset<> m_requested;
+	boost::dynamic_bitset<> m_have;
+	boost::dynamic_bitset<> m_on_disk;
+	boost::dynamic_bitset<> m_unverified;
+	boost::shared_ptr<Piece> m_deferred_piece;
+	int m_read_ahead;
+	ReadEngine m_read_engine;
+	StartupMode m_startup_mode;
+	boost::scoped_ptr<PieceVerifier> m_verifier;
+	std::vector<int> m_verified_pieces;
+	boost::mutex m_verified_mutex;
+	bool m_full_check;
+	bool m_recheck_pending;
+	int m_checked_pieces;
+	boost::posix_time::ptime m_last_check_update;
+	boost::shared_ptr<AlertQueue> m_load_queue;
+	std::vector<int> m_load_requests;
+	boost::mutex m_load_mutex;
+	boost::intrusive_ptr<libtorrent::torrent_info> m_torrent_info;
+	boost::scoped_ptr<DiskReader> m_disk_reader;
+	boost::shared_ptr<PiecePool> m_piece_pool;
+	std::vector<boost::shared_ptr<MappedFile> > m_mapped_files;
+	boost::atomic<int> m_reads_in_flight;
+	bool m_reads_deferred;
 	int m_last_played_piece;
 	bool m_deadlines_mode;
+	DeadlineScheduler m_deadline_scheduler;
+	int m_deadline_horizon;
+	bool m_adaptive_mode;
+	SlackController m_slack_controller;
+	boost::posix_time::ptime m_last_slack_update;
+	boost::shared_ptr<boost::thread> m_index_thread;
+	boost::dynamic_bitset<> m_index_have;
+	boost::mutex m_index_mutex;
+	bool m_index_first;
+	bool m_index_checked;
+	bool m_video_head_read;
+	int m_video_head_piece;
+	int m_index_start_piece;
+	int m_index_end_piece;
+	bool m_sequential_download;
+	bool m_sequential_held;
+	boost::mutex m_sequential_mutex;
+	boost::atomic<boost::int64_t> m_index_offset;
 	float m_decoded_piece_length;
+	BufferSettings m_buffer_settings;
+	boost::posix_time::ptime m_last_rate_update;
+	boost::posix_time::time_duration m_last_switch_duration;
 
 	boost::shared_ptr<boost::thread> m_feeding_thread;
+	boost::mutex m_feeding_mutex;
+	bool m_feeding;
 };
 
 } /* namespace btstream */
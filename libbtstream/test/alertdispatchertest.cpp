@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * AlertDispatcherTest.cpp
+ */
+
+#include "alertdispatcher.h"
+
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <libtorrent/alert_types.hpp>
+
+#include "constants.h"
+
+namespace btstream {
+
+TEST(AlertDispatcherTest, RoutesAlertToHandler) {
+	libtorrent::session session;
+	session.set_alert_mask(libtorrent::alert::status_notification);
+
+	AlertDispatcher dispatcher(session);
+	AlertQueue queue;
+	dispatcher.add_handler(boost::bind(&AlertQueue::push, &queue, _1),
+			libtorrent::add_torrent_alert::alert_type);
+	dispatcher.start();
+
+	libtorrent::add_torrent_params params;
+	params.ti = new libtorrent::torrent_info(TEST_TORRENT1);
+	params.save_path = ".";
+	params.paused = true;
+	session.add_torrent(params);
+
+	std::deque<boost::shared_ptr<libtorrent::alert> > alerts;
+	ASSERT_TRUE(queue.pop_all(alerts, boost::posix_time::seconds(10)));
+	ASSERT_EQ(1u, alerts.size());
+	EXPECT_TRUE(libtorrent::alert_cast<libtorrent::add_torrent_alert>(
+			alerts[0].get()));
+}
+
+} /* namespace btstream */
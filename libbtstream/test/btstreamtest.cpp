@@ -137,6 +137,30 @@ TEST(BTStreamTest, GetPieceAfterTwoTorrents) {
 		TEST_TORRENT2_PIECE_LENGTH, check);
 }
 
+TEST(BTStreamTest, GetPieceAfterSwitch) {
+	BTStream btstream(TEST_TORRENT1);
+	bool check = true;
+
+	ASSERT_NO_THROW(btstream.switch_torrent(TEST_TORRENT2));
+	EXPECT_GT(btstream.last_switch_duration().total_microseconds(), 0);
+
+	// Pieces on buffer should be from torrent 2.
+	run_playback_thread(&btstream, TEST_TORRENT2_PIECES,
+		TEST_TORRENT2_PIECE_LENGTH, check);
+}
+
+TEST(BTStreamTest, GetPieceWithFastStart) {
+	BTStream btstream;
+	bool check = true;
+
+	// Pieces are hashed by the verifier instead of libtorrent's check.
+	btstream.set_startup_mode(FAST_START);
+	ASSERT_NO_THROW(btstream.add_torrent(TEST_TORRENT1));
+
+	run_playback_thread(&btstream, TEST_TORRENT1_PIECES,
+		TEST_TORRENT1_PIECE_LENGTH, check);
+}
+
 TEST(BTStreamTest, GetStatus) {
 	BTStream btstream(TEST_TORRENT1);
 
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DeadlineSchedulerTest.cpp
+ */
+
+#include "deadlinescheduler.h"
+
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+
+namespace btstream {
+
+/**
+ * Records the calls made by a DeadlineScheduler.
+ */
+struct DeadlineLog {
+	void set(int piece, int deadline) {
+		deadlines[piece] = deadline;
+		num_set++;
+	}
+
+	void reset(int piece) {
+		deadlines.erase(piece);
+		num_reset++;
+	}
+
+	DeadlineLog() :
+			num_set(0), num_reset(0) {
+	}
+
+	std::map<int, int> deadlines;
+	int num_set;
+	int num_reset;
+};
+
+void start_scheduler(DeadlineScheduler& scheduler, DeadlineLog& log,
+		int num_pieces) {
+
+	// One second per piece.
+	scheduler.start(num_pieces, 1000,
+			boost::bind(&DeadlineLog::set, &log, _1, _2),
+			boost::bind(&DeadlineLog::reset, &log, _1));
+}
+
+TEST(DeadlineSchedulerTest, PlayWithinHorizon) {
+	DeadlineScheduler scheduler(10000);
+	DeadlineLog log;
+	start_scheduler(scheduler, log, 10000);
+
+	boost::posix_time::ptime now(boost::gregorian::date(2026, 10, 17));
+	scheduler.play(100, 2000, now);
+
+	// Pieces due in the next 10 seconds.
+	EXPECT_EQ(9, log.num_set);
+	EXPECT_EQ(9, scheduler.scheduled());
+	EXPECT_EQ(2000, log.deadlines[100]);
+	EXPECT_EQ(10000, log.deadlines[108]);
+	EXPECT_EQ(0u, log.deadlines.count(109));
+}
+
+TEST(DeadlineSchedulerTest, AdvanceSetsOnlyNewPieces) {
+	DeadlineScheduler scheduler(10000);
+	DeadlineLog log;
+	start_scheduler(scheduler, log, 10000);
+
+	boost::posix_time::ptime now(boost::gregorian::date(2026, 10, 17));
+	scheduler.play(0, 0, now);
+	EXPECT_EQ(11, log.num_set);
+
+	scheduler.advance(now + boost::posix_time::milliseconds(3500));
+
+	// Pieces 11 to 13 entered the horizon; 0 to 3 are due.
+	EXPECT_EQ(14, log.num_set);
+	EXPECT_EQ(9500, log.deadlines[13]);
+	EXPECT_EQ(10, scheduler.scheduled());
+
+	// Advancing without playback doesn't set deadlines.
+	scheduler.stop();
+	scheduler.advance(now + boost::posix_time::seconds(20));
+	EXPECT_EQ(14, log.num_set);
+}
+
+TEST(DeadlineSchedulerTest, ReplayRetimesMovedPieces) {
+	DeadlineScheduler scheduler(10000);
+	DeadlineLog log;
+	start_scheduler(scheduler, log, 10000);
+
+	boost::posix_time::ptime now(boost::gregorian::date(2026, 10, 17));
+	scheduler.play(0, 0, now);
+
+	// Playback resumed on time: nothing changes.
+	now += boost::posix_time::seconds(2);
+	scheduler.advance(now);
+	EXPECT_EQ(13, log.num_set);
+
+	scheduler.play(2, 0, now);
+	EXPECT_EQ(13, log.num_set);
+	EXPECT_EQ(0, log.num_reset);
+
+	// A stall delays the remaining pieces.
+	scheduler.play(2, 5000, now);
+	EXPECT_EQ(13 + 6, log.num_set);
+
+	// Pieces 8 to 12 are now due after the horizon.
+	EXPECT_EQ(5, log.num_reset);
+	EXPECT_EQ(5000, log.deadlines[2]);
+	EXPECT_EQ(0u, log.deadlines.count(8));
+}
+
+TEST(DeadlineSchedulerTest, ShrinkHorizon) {
+	DeadlineScheduler scheduler(10000);
+	DeadlineLog log;
+	start_scheduler(scheduler, log, 10000);
+
+	boost::posix_time::ptime now(boost::gregorian::date(2026, 10, 17));
+	scheduler.play(0, 0, now);
+	EXPECT_EQ(11, log.num_set);
+
+	// Pieces 5 to 10 are due after the new horizon.
+	scheduler.set_horizon(4000, now);
+	EXPECT_EQ(6, log.num_reset);
+	EXPECT_EQ(5, scheduler.scheduled());
+	EXPECT_EQ(0u, log.deadlines.count(5));
+
+	// They get deadlines again as playback reaches them.
+	scheduler.advance(now + boost::posix_time::seconds(2));
+	EXPECT_EQ(4000, log.deadlines[6]);
+	EXPECT_EQ(0u, log.deadlines.count(7));
+
+	// Growing the horizon resets nothing.
+	scheduler.set_horizon(10000, now);
+	EXPECT_EQ(6, log.num_reset);
+}
+
+TEST(DeadlineSchedulerTest, Seek) {
+	DeadlineScheduler scheduler(5000);
+	DeadlineLog log;
+	start_scheduler(scheduler, log, 100);
+
+	boost::posix_time::ptime now(boost::gregorian::date(2026, 10, 17));
+	scheduler.play(0, 0, now);
+	scheduler.play(50, 0, now);
+
+	// Old pieces are reset.
+	EXPECT_EQ(6, log.num_reset);
+	EXPECT_EQ(6, scheduler.scheduled());
+	EXPECT_EQ(0, log.deadlines[50]);
+
+	// The horizon stops at the last piece.
+	scheduler.play(98, 0, now);
+	EXPECT_EQ(2, scheduler.scheduled());
+}
+
+TEST(DeadlineSchedulerTest, ReportPosition) {
+	DeadlineScheduler scheduler(10000);
+	DeadlineLog log;
+	start_scheduler(scheduler, log, 10000);
+
+	boost::posix_time::ptime now(boost::gregorian::date(2026, 10, 17));
+	scheduler.play(0, 0, now);
+	EXPECT_EQ(11, log.num_set);
+
+	// The player is on time: only pieces 11 and 12, which entered the
+	// horizon, are set.
+	now += boost::posix_time::seconds(2);
+	scheduler.report_position(2000, now);
+	EXPECT_EQ(13, log.num_set);
+
+	// The player is one second late: pieces in the horizon are re-timed
+	// and the ones already played are dropped.
+	now += boost::posix_time::seconds(2);
+	scheduler.report_position(3000, now);
+	EXPECT_EQ(2000, log.deadlines[5]);
+	EXPECT_EQ(0u, log.deadlines.count(2));
+	EXPECT_EQ(3000, log.deadlines[6]);
+
+	// Faster playback brings deadlines closer.
+	scheduler.report_position(3000, now, 2.0);
+	EXPECT_EQ(1500, log.deadlines[6]);
+	EXPECT_EQ(10000, log.deadlines[23]);
+
+	// Paused.
+	int num_set = log.num_set;
+	scheduler.report_position(3000, now, 0);
+	scheduler.advance(now + boost::posix_time::seconds(10));
+	EXPECT_EQ(num_set, log.num_set);
+}
+
+TEST(DeadlineSchedulerTest, PieceTimes) {
+	DeadlineScheduler scheduler(3000);
+	DeadlineLog log;
+
+	// Pieces can't be timed yet.
+	scheduler.start(5, 0, boost::bind(&DeadlineLog::set, &log, _1, _2),
+			boost::bind(&DeadlineLog::reset, &log, _1));
+
+	boost::posix_time::ptime now(boost::gregorian::date(2026, 10, 17));
+	scheduler.play(0, 0, now);
+	EXPECT_EQ(0, log.num_set);
+
+	std::vector<int> times;
+	times.push_back(0);
+	times.push_back(500);
+	times.push_back(1000);
+	times.push_back(4000);
+	times.push_back(4500);
+	scheduler.set_piece_times(times, 6000);
+
+	scheduler.play(0, 0, now);
+	EXPECT_EQ(3, log.num_set);
+	EXPECT_EQ(1000, log.deadlines[2]);
+
+	EXPECT_EQ(4000, scheduler.duration(0, 3));
+	EXPECT_EQ(2000, scheduler.duration(3, 5));
+}
+
+TEST(DeadlineSchedulerTest, Slack) {
+	DeadlineScheduler scheduler(10000);
+	DeadlineLog log;
+
+	boost::dynamic_bitset<> have(100);
+	boost::posix_time::ptime now(boost::gregorian::date(2026, 10, 17));
+	EXPECT_EQ(-1, scheduler.slack(have, now));
+
+	start_scheduler(scheduler, log, 100);
+
+	// Before playback, slack is counted from the start.
+	for (int i = 0; i < 10; i++) {
+		have[i] = true;
+	}
+	EXPECT_EQ(10000, scheduler.slack(have, now));
+
+	// Piece 0 plays now. Pieces behind the clock don't count.
+	scheduler.play(0, 0, now);
+	EXPECT_EQ(6500, scheduler.slack(have, now + boost::posix_time::seconds(3)
+			+ boost::posix_time::milliseconds(500)));
+
+	// The clock is held while playback is stopped.
+	scheduler.stop(now + boost::posix_time::seconds(4));
+	EXPECT_EQ(6000, scheduler.slack(have, now + boost::posix_time::seconds(20)));
+
+	scheduler.report_position(12000, now + boost::posix_time::seconds(20));
+	EXPECT_EQ(0, scheduler.slack(have, now + boost::posix_time::seconds(20)));
+}
+
+} /* namespace btstream */
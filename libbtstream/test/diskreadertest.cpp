@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * DiskReaderTest.cpp
+ */
+
+#include "diskreader.h"
+
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <fstream>
+#include <cstring>
+
+namespace btstream {
+
+/**
+ * Stores the result of a read. Used as a ReadCallback.
+ */
+struct ReadResult {
+	ReadResult() :
+			piece(-1), size(0), done(false) {
+	}
+
+	void set(int piece, boost::shared_array<char> data, int size) {
+		boost::lock_guard<boost::mutex> lock(mutex);
+		this->piece = piece;
+		this->data = data;
+		this->size = size;
+		done = true;
+		condition.notify_all();
+	}
+
+	bool wait() {
+		boost::unique_lock<boost::mutex> lock(mutex);
+		boost::system_time deadline = boost::get_system_time()
+				+ boost::posix_time::seconds(5);
+
+		while (!done) {
+			if (!condition.timed_wait(lock, deadline)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	int piece;
+	boost::shared_array<char> data;
+	int size;
+	bool done;
+	boost::mutex mutex;
+	boost::condition_variable condition;
+};
+
+FileSlice make_slice(const std::string& path, boost::int64_t offset,
+		int size) {
+
+	FileSlice slice;
+	slice.path = path;
+	slice.offset = offset;
+	slice.size = size;
+
+	return slice;
+}
+
+std::string read_file(const std::string& path, int offset, int size) {
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	file.seekg(offset);
+
+	std::string data(size, '\0');
+	file.read(&data[0], size);
+
+	return data;
+}
+
+TEST(DiskReaderTest, ReadAcrossFiles) {
+	DiskReader reader;
+
+	// A piece that ends in one file and starts in the next.
+	std::vector<FileSlice> slices;
+	slices.push_back(make_slice("testfile1", 8000, 192));
+	slices.push_back(make_slice("testfile2", 0, 64));
+
+	reader.advise(slices);
+
+	ReadResult result;
+	boost::shared_array<char> buffer(new char[256]);
+	reader.read(7, slices, buffer,
+			boost::bind(&ReadResult::set, &result, _1, _2, _3));
+
+	ASSERT_TRUE(result.wait());
+	EXPECT_EQ(7, result.piece);
+	ASSERT_EQ(256, result.size);
+	EXPECT_EQ(buffer.get(), result.data.get());
+
+	std::string expected = read_file("testfile1", 8000, 192)
+			+ read_file("testfile2", 0, 64);
+	EXPECT_EQ(0, memcmp(expected.data(), result.data.get(), 256));
+}
+
+TEST(DiskReaderTest, ReadFailure) {
+	DiskReader reader;
+
+	std::vector<FileSlice> slices;
+	slices.push_back(make_slice("testfile1", 8100, 200));
+
+	// The file is shorter than the slice.
+	ReadResult result;
+	reader.read(3, slices, boost::shared_array<char>(new char[200]),
+			boost::bind(&ReadResult::set, &result, _1, _2, _3));
+
+	ASSERT_TRUE(result.wait());
+	EXPECT_EQ(3, result.piece);
+	EXPECT_FALSE(result.data);
+
+	// Missing files fail too.
+	ReadResult missing;
+	slices[0] = make_slice("missingfile", 0, 10);
+	reader.read(4, slices, boost::shared_array<char>(new char[10]),
+			boost::bind(&ReadResult::set, &missing, _1, _2, _3));
+
+	ASSERT_TRUE(missing.wait());
+	EXPECT_FALSE(missing.data);
+}
+
+/**
+ * Accepts pieces whose first byte is the given value. Used as a
+ * ReadCheck.
+ */
+bool first_byte_is(char value, int, const char* data, int size) {
+	return size > 0 && data[0] == value;
+}
+
+TEST(DiskReaderTest, ReadCheck) {
+	DiskReader reader;
+
+	std::vector<FileSlice> slices;
+	slices.push_back(make_slice("testfile1", 0, 16));
+	char first = read_file("testfile1", 0, 1)[0];
+
+	ReadResult accepted;
+	reader.read(0, slices, boost::shared_array<char>(new char[16]),
+			boost::bind(&ReadResult::set, &accepted, _1, _2, _3),
+			boost::bind(first_byte_is, first, _1, _2, _3));
+
+	ReadResult rejected;
+	reader.read(0, slices, boost::shared_array<char>(new char[16]),
+			boost::bind(&ReadResult::set, &rejected, _1, _2, _3),
+			boost::bind(first_byte_is, (char) (first + 1), _1, _2, _3));
+
+	ASSERT_TRUE(accepted.wait());
+	EXPECT_TRUE(accepted.data);
+	EXPECT_EQ(16, accepted.size);
+
+	ASSERT_TRUE(rejected.wait());
+	EXPECT_FALSE(rejected.data);
+}
+
+} /* namespace btstream */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MappedFileTest.cpp
+ */
+
+#include "mappedfile.h"
+
+#include <gtest/gtest.h>
+#include <fstream>
+#include <cstring>
+#include <boost/scoped_ptr.hpp>
+
+namespace btstream {
+
+TEST(MappedFileTest, OpenMissing) {
+	ASSERT_THROW(MappedFile file("missingfile"), Exception);
+}
+
+TEST(MappedFileTest, View) {
+	MappedFile file("testfile1");
+	ASSERT_EQ(8192, file.size());
+
+	char expected[100];
+	std::ifstream stream("testfile1", std::ios::in | std::ios::binary);
+	stream.seekg(4000);
+	stream.read(expected, 100);
+
+	boost::shared_array<char> view = file.view(4000, 100);
+	ASSERT_TRUE(view);
+	EXPECT_EQ(0, memcmp(expected, view.get(), 100));
+
+	// Views must be inside the file.
+	EXPECT_FALSE(file.view(8100, 100));
+	EXPECT_FALSE(file.view(-1, 10));
+}
+
+TEST(MappedFileTest, ViewOutlivesFile) {
+	boost::scoped_ptr<MappedFile> file(new MappedFile("testfile1"));
+
+	boost::shared_array<char> view = file->view(8000, 192);
+	file.reset();
+
+	// The mapping is still there.
+	char expected[192];
+	std::ifstream stream("testfile1", std::ios::in | std::ios::binary);
+	stream.seekg(8000);
+	stream.read(expected, 192);
+
+	EXPECT_EQ(0, memcmp(expected, view.get(), 192));
+}
+
+} /* namespace btstream */
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * MediaIndexTest.cpp
+ */
+
+#include "mediaindex.h"
+
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <cstring>
+
+namespace btstream {
+
+/**
+ * Reads from a file kept in memory. Used as a ByteSource.
+ */
+struct MemoryFile {
+	int read(boost::int64_t offset, int size, char* buffer) {
+		reads.push_back(offset);
+
+		int available = std::max(0, std::min<int>(size, data.size() - offset));
+		memcpy(buffer, data.data() + offset, available);
+
+		return available;
+	}
+
+	ByteSource source() {
+		return boost::bind(&MemoryFile::read, this, _1, _2, _3);
+	}
+
+	std::string data;
+	std::vector<boost::int64_t> reads;
+};
+
+std::string u32(boost::uint32_t value) {
+	std::string bytes(4, '\0');
+	for (int i = 0; i < 4; i++) {
+		bytes[i] = (value >> (24 - 8 * i)) & 0xff;
+	}
+
+	return bytes;
+}
+
+std::string mp4_box(const std::string& type, const std::string& body) {
+	return u32(8 + body.size()) + type + body;
+}
+
+std::string mp4_track(const std::string& handler,
+		const std::string& samples, const std::string& chunks) {
+
+	std::string mdhd = u32(0) + u32(0) + u32(0) + u32(1000) + u32(5000)
+			+ u32(0);
+	std::string hdlr = u32(0) + u32(0) + handler + std::string(13, '\0');
+	std::string stsc = u32(0) + u32(1) + u32(1) + u32(1) + u32(1);
+
+	std::string stbl = mp4_box("stts", samples) + mp4_box("stsc", stsc)
+			+ mp4_box("stco", chunks);
+
+	return mp4_box("trak",
+			mp4_box("mdia",
+					mp4_box("mdhd", mdhd) + mp4_box("hdlr", hdlr)
+							+ mp4_box("minf", mp4_box("stbl", stbl))));
+}
+
+TEST(MediaIndexTest, ParseMp4) {
+	// The moov box is after the media data. Chunks hold one sample, and
+	// the video has a variable frame duration.
+	std::string audio = mp4_track("soun", u32(0) + u32(1) + u32(1) + u32(10),
+			u32(0) + u32(1) + u32(50));
+	std::string video = mp4_track("vide",
+			u32(0) + u32(3) + u32(1) + u32(1000) + u32(1) + u32(3000) + u32(2)
+					+ u32(500),
+			u32(0) + u32(4) + u32(100) + u32(1000) + u32(5000) + u32(6000));
+
+	MemoryFile file;
+	file.data = mp4_box("ftyp", "isom" + u32(0))
+			+ mp4_box("mdat", std::string(8000, 'x'))
+			+ mp4_box("moov", audio + video);
+
+	MediaIndex index;
+	ASSERT_TRUE(index.parse(file.source(), file.data.size()));
+	EXPECT_EQ(MP4_CONTAINER, index.container());
+	EXPECT_EQ(5000, index.duration());
+
+	const std::vector<IndexPoint>& points = index.points();
+	ASSERT_EQ(4u, points.size());
+	EXPECT_EQ(100, points[0].offset);
+	EXPECT_EQ(0, points[0].time);
+	EXPECT_EQ(4000, points[2].time);
+	EXPECT_EQ(4500, points[3].time);
+
+	// Interpolated between chunks.
+	EXPECT_EQ(2500, index.time_at(3000));
+	EXPECT_EQ(0, index.time_at(0));
+
+	std::vector<int> times = index.piece_times(0, 2000, 5);
+	ASSERT_EQ(5u, times.size());
+	EXPECT_EQ(0, times[0]);
+	EXPECT_EQ(1750, times[1]);
+
+	for (size_t i = 1; i < times.size(); i++) {
+		EXPECT_LE(times[i - 1], times[i]);
+	}
+}
+
+std::string mkv_element(const std::string& id, const std::string& body) {
+	// Sizes are written with 8 bytes.
+	std::string size(8, '\0');
+	size[0] = 0x01;
+	for (int i = 0; i < 4; i++) {
+		size[4 + i] = (body.size() >> (24 - 8 * i)) & 0xff;
+	}
+
+	return id + size + body;
+}
+
+std::string mkv_double(double value) {
+	boost::uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	return u32(bits >> 32) + u32(bits & 0xffffffff);
+}
+
+std::string mkv_cue(boost::uint32_t time, boost::uint32_t position) {
+	return mkv_element("\xBB",
+			mkv_element("\xB3", u32(time))
+					+ mkv_element("\xB7",
+							mkv_element("\xF7", "\x01")
+									+ mkv_element("\xF1", u32(position))));
+}
+
+std::string mkv_seek_head(boost::uint32_t cues_position) {
+	return mkv_element("\x11\x4D\x9B\x74",
+			mkv_element("\x4D\xBB",
+					mkv_element("\x53\xAB", "\x1C\x53\xBB\x6B")
+							+ mkv_element("\x53\xAC", u32(cues_position))));
+}
+
+TEST(MediaIndexTest, ParseMatroska) {
+	std::string info = mkv_element("\x15\x49\xA9\x66",
+			mkv_element("\x2A\xD7\xB1", u32(1000000))
+					+ mkv_element("\x44\x89", mkv_double(9000)));
+	std::string cluster1 = mkv_element("\x1F\x43\xB6\x75",
+			std::string(4000, 'x'));
+	std::string cluster2 = mkv_element("\x1F\x43\xB6\x75",
+			std::string(2000, 'x'));
+
+	// Positions are relative to the segment data.
+	boost::uint32_t cluster1_position = mkv_seek_head(0).size() + info.size();
+	boost::uint32_t cluster2_position = cluster1_position + cluster1.size();
+	boost::uint32_t cues_position = cluster2_position + cluster2.size();
+
+	std::string cues = mkv_element("\x1C\x53\xBB\x6B",
+			mkv_cue(0, cluster1_position) + mkv_cue(6000, cluster2_position));
+
+	std::string header = mkv_element(std::string("\x1A\x45\xDF\xA3"),
+			std::string());
+	std::string segment = mkv_element("\x18\x53\x80\x67",
+			mkv_seek_head(cues_position) + info + cluster1 + cluster2 + cues);
+
+	MemoryFile file;
+	file.data = header + segment;
+	boost::int64_t segment_start = header.size() + 12;
+
+	MediaIndex index;
+	ASSERT_TRUE(index.parse(file.source(), file.data.size()));
+	EXPECT_EQ(MATROSKA_CONTAINER, index.container());
+	EXPECT_EQ(9000, index.duration());
+
+	const std::vector<IndexPoint>& points = index.points();
+	ASSERT_EQ(2u, points.size());
+	EXPECT_EQ(segment_start + cluster1_position, points[0].offset);
+	EXPECT_EQ(6000, points[1].time);
+
+	// The second cluster isn't read: the SeekHead points to the Cues.
+	for (size_t i = 0; i < file.reads.size(); i++) {
+		EXPECT_NE(segment_start + cluster2_position, file.reads[i]);
+	}
+}
+
+/**
+ * Returns the presentation time of a packet of the test stream, which
+ * has a higher bit rate in its first half.
+ */
+int ts_packet_time(int packet) {
+	return packet < 1000 ? packet * 2 : 2000 + (packet - 1000) * 8;
+}
+
+/**
+ * Returns an MPEG-TS file of 2000 packets, with a PCR every 10 packets.
+ */
+std::string ts_file() {
+	std::string data;
+
+	for (int i = 0; i < 2000; i++) {
+		std::string packet(188, '\xff');
+		packet[0] = 0x47;
+
+		if (i % 10 == 0) {
+			// PID 0x100 with a PCR in its adaptation field.
+			boost::uint64_t base = (boost::uint64_t) ts_packet_time(i) * 90;
+
+			packet[1] = 0x01;
+			packet[2] = 0x00;
+			packet[3] = 0x20;
+			packet[4] = 7;
+			packet[5] = 0x10;
+			packet[6] = base >> 25;
+			packet[7] = base >> 17;
+			packet[8] = base >> 9;
+			packet[9] = base >> 1;
+			packet[10] = (base & 1) << 7;
+			packet[11] = 0;
+
+		} else {
+			packet[1] = 0x01;
+			packet[2] = 0x01;
+			packet[3] = 0x10;
+		}
+
+		data += packet;
+	}
+
+	return data;
+}
+
+/**
+ * Tells whether a range ends before limit. Used as a RangeCheck.
+ */
+bool range_before(boost::int64_t limit, boost::int64_t offset, int size) {
+	return offset + size <= limit;
+}
+
+TEST(MediaIndexTest, ParseMpegTs) {
+	MemoryFile file;
+	file.data = ts_file();
+
+	MediaIndex index;
+	ASSERT_TRUE(index.parse(file.source(), file.data.size()));
+	EXPECT_TRUE(index.complete());
+	EXPECT_EQ(MPEG_TS_CONTAINER, index.container());
+	EXPECT_GT(index.points().size(), 10u);
+
+	EXPECT_NEAR(1000, index.time_at(500 * 188), 100);
+	EXPECT_NEAR(6000, index.time_at(1500 * 188), 100);
+	EXPECT_NEAR(10000, index.duration(), 200);
+}
+
+TEST(MediaIndexTest, ParseMpegTsAvailable) {
+	MemoryFile file;
+	file.data = ts_file();
+	boost::int64_t limit = 1200 * 188;
+
+	// Only the first 1200 packets are downloaded.
+	MediaIndex index;
+	ASSERT_TRUE(index.parse(file.source(), file.data.size(),
+			boost::bind(range_before, limit, _1, _2)));
+	EXPECT_FALSE(index.complete());
+	EXPECT_GT(index.points().size(), 10u);
+
+	for (size_t i = 0; i < file.reads.size(); i++) {
+		EXPECT_LT(file.reads[i], limit);
+	}
+
+	EXPECT_NEAR(1000, index.time_at(500 * 188), 100);
+	EXPECT_LT(index.points().back().offset, limit);
+
+	// Nothing but the head.
+	file.reads.clear();
+	EXPECT_FALSE(index.parse(file.source(), file.data.size(),
+			boost::bind(range_before, 0, _1, _2)));
+	EXPECT_FALSE(index.complete());
+	EXPECT_EQ(0, file.reads.back());
+
+	// Parsing again once the file is downloaded refines the index.
+	ASSERT_TRUE(index.parse(file.source(), file.data.size(),
+			boost::bind(range_before, file.data.size(), _1, _2)));
+	EXPECT_TRUE(index.complete());
+	EXPECT_NEAR(6000, index.time_at(1500 * 188), 100);
+	EXPECT_NEAR(10000, index.duration(), 200);
+}
+
+TEST(MediaIndexTest, ParseUnknown) {
+	MemoryFile file;
+	file.data = std::string(1000, 'x');
+
+	MediaIndex index;
+	EXPECT_FALSE(index.parse(file.source(), file.data.size()));
+	EXPECT_EQ(UNKNOWN_CONTAINER, index.container());
+	EXPECT_TRUE(index.points().empty());
+
+	// Truncated index.
+	file.data = mp4_box("ftyp", "isom") + u32(1000) + "moov";
+	EXPECT_FALSE(index.parse(file.source(), file.data.size()));
+}
+
+TEST(MediaIndexTest, FindTrailingIndex) {
+	std::string ftyp = mp4_box("ftyp", "isom" + u32(0));
+	std::string mdat = mp4_box("mdat", std::string(8000, 'x'));
+	std::string moov = mp4_box("moov", std::string(100, 'x'));
+
+	// Only the first piece is looked at.
+	std::string file = ftyp + mdat + moov;
+	boost::int64_t offset = -1;
+
+	ASSERT_TRUE(find_trailing_index(file.data(), 1024, file.size(), offset));
+	EXPECT_EQ((boost::int64_t) (ftyp.size() + mdat.size()), offset);
+
+	file = ftyp + moov + mdat;
+	EXPECT_FALSE(find_trailing_index(file.data(), 1024, file.size(), offset));
+
+	// Cues after the clusters.
+	boost::uint32_t cues_position = 50000;
+	std::string header = mkv_element(std::string("\x1A\x45\xDF\xA3"),
+			std::string());
+	std::string segment = mkv_element("\x18\x53\x80\x67",
+			mkv_seek_head(cues_position) + std::string(60000, 'x'));
+
+	file = header + segment;
+	ASSERT_TRUE(find_trailing_index(file.data(), 1024, file.size(), offset));
+	EXPECT_EQ((boost::int64_t) (header.size() + 12 + cues_position), offset);
+
+	// Cues in the first piece.
+	ASSERT_FALSE(find_trailing_index(file.data(), 60000, file.size(), offset));
+
+	// Heads that end before or inside the Segment header.
+	header = mkv_element(std::string("\x1A\x45\xDF\xA3"),
+			std::string(20, 'h'));
+	file = header + segment;
+
+	EXPECT_FALSE(find_trailing_index(file.data(), header.size() - 1,
+			file.size(), offset));
+	EXPECT_FALSE(find_trailing_index(file.data(), header.size(), file.size(),
+			offset));
+	EXPECT_FALSE(find_trailing_index(file.data(), header.size() + 2,
+			file.size(), offset));
+	ASSERT_TRUE(find_trailing_index(file.data(), 1024, file.size(), offset));
+	EXPECT_EQ((boost::int64_t) (header.size() + 12 + cues_position), offset);
+}
+
+} /* namespace btstream */
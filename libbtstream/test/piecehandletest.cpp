@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PieceHandleTest.cpp
+ */
+
+#include "piecehandle.h"
+
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+
+#include "videobuffer.h"
+
+namespace btstream {
+
+/**
+ * Counts released pieces. Used as a release hook.
+ */
+void count_release(int* released, const Piece&) {
+	(*released)++;
+}
+
+PieceHandle make_handle(int index,
+		boost::shared_ptr<const ReleaseHook> hook =
+				boost::shared_ptr<const ReleaseHook>()) {
+	boost::shared_ptr<Piece> piece(
+			new Piece(index, boost::shared_array<char>(new char[4]), 4));
+	PieceHandle handle(piece, hook);
+
+	return boost::move(handle);
+}
+
+TEST(PieceHandleTest, TakesOwnership) {
+	boost::shared_ptr<Piece> piece(
+			new Piece(1, boost::shared_array<char>(new char[4]), 4));
+	const char* data = piece->data.get();
+
+	PieceHandle handle(piece);
+
+	EXPECT_FALSE(piece);
+	ASSERT_FALSE(handle.empty());
+	EXPECT_EQ(1, handle.index());
+	EXPECT_EQ(data, handle.data());
+	EXPECT_EQ(4, handle.size());
+}
+
+TEST(PieceHandleTest, SharedPiece) {
+	boost::shared_ptr<Piece> piece(
+			new Piece(1, boost::shared_array<char>(new char[4]), 4));
+	boost::shared_ptr<Piece> copy = piece;
+
+	// Other references keep their data.
+	PieceHandle handle(piece);
+	EXPECT_FALSE(piece);
+	ASSERT_TRUE(copy->data);
+	EXPECT_EQ(copy->data.get(), handle.data());
+
+	piece = handle.share();
+	EXPECT_TRUE(handle.empty());
+	EXPECT_EQ(copy->data.get(), piece->data.get());
+	EXPECT_EQ(1, piece->index);
+	EXPECT_EQ(4, piece->size);
+}
+
+TEST(PieceHandleTest, Move) {
+	int released = 0;
+	boost::shared_ptr<const ReleaseHook> hook(
+			new ReleaseHook(boost::bind(count_release, &released, _1)));
+	PieceHandle handle1 = make_handle(2, hook);
+
+	PieceHandle handle2(boost::move(handle1));
+	EXPECT_TRUE(handle1.empty());
+	EXPECT_EQ(2, handle2.index());
+
+	handle1 = make_handle(3);
+	handle1 = boost::move(handle2);
+	EXPECT_TRUE(handle2.empty());
+	EXPECT_EQ(2, handle1.index());
+	EXPECT_EQ(0, released);
+}
+
+TEST(PieceHandleTest, ReleaseHook) {
+	int released = 0;
+	boost::shared_ptr<const ReleaseHook> hook(
+			new ReleaseHook(boost::bind(count_release, &released, _1)));
+
+	{
+		PieceHandle handle = make_handle(0, hook);
+	}
+	EXPECT_EQ(1, released);
+
+	PieceHandle handle = make_handle(0, hook);
+	handle.release();
+	handle.release();
+	EXPECT_TRUE(handle.empty());
+	EXPECT_EQ(2, released);
+
+	// Shared pieces are no longer tracked by the hook.
+	handle = make_handle(0, hook);
+	boost::shared_ptr<Piece> piece = handle.share();
+	EXPECT_TRUE(piece);
+	EXPECT_TRUE(handle.empty());
+	EXPECT_EQ(2, released);
+}
+
+} /* namespace btstream */
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PiecePoolTest.cpp
+ */
+
+#include "piecepool.h"
+
+#include <gtest/gtest.h>
+
+#include "exception.h"
+
+namespace btstream {
+
+TEST(PiecePoolTest, CreateInvalid) {
+	ASSERT_THROW(PiecePool pool(0), Exception);
+	ASSERT_THROW(PiecePool pool(16, -1), Exception);
+}
+
+TEST(PiecePoolTest, BuffersAreReused) {
+	boost::shared_ptr<PiecePool> pool(new PiecePool(16, 2));
+
+	boost::shared_array<char> buffer = pool->get_buffer();
+	char* memory = buffer.get();
+	EXPECT_EQ(0, pool->num_free());
+
+	buffer.reset();
+	EXPECT_EQ(1, pool->num_free());
+
+	buffer = pool->get_buffer();
+	EXPECT_EQ(memory, buffer.get());
+	EXPECT_EQ(1, pool->num_allocated());
+}
+
+TEST(PiecePoolTest, FreeBuffersAreBounded) {
+	boost::shared_ptr<PiecePool> pool(new PiecePool(16, 2));
+
+	std::vector<boost::shared_array<char> > buffers;
+	for (int i = 0; i < 4; i++) {
+		buffers.push_back(pool->get_buffer());
+	}
+
+	buffers.clear();
+	EXPECT_EQ(2, pool->num_free());
+	EXPECT_EQ(4, pool->num_allocated());
+
+	pool->set_max_free(1);
+	EXPECT_EQ(1, pool->num_free());
+}
+
+TEST(PiecePoolTest, BufferOutlivesPool) {
+	boost::shared_ptr<PiecePool> pool(new PiecePool(16));
+
+	boost::shared_array<char> buffer = pool->get_buffer();
+	pool.reset();
+
+	buffer[15] = 1;
+	buffer.reset();
+}
+
+TEST(PiecePoolTest, MakePiece) {
+	boost::shared_array<char> data(new char[4]);
+	boost::shared_ptr<Piece> piece = make_piece(3, data, 4);
+
+	EXPECT_EQ(3, piece->index);
+	EXPECT_EQ(data.get(), piece->data.get());
+	EXPECT_EQ(4, piece->size);
+}
+
+} /* namespace btstream */
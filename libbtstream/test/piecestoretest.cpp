@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * PieceStoreTest.cpp
+ */
+
+#include "piecestore.h"
+
+#include <gtest/gtest.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include "exception.h"
+
+namespace btstream {
+
+/**
+ * Adds every wanted piece to the store until all cursors are done.
+ * Called at a producer thread for concurrency testing.
+ */
+void feed_store(boost::shared_ptr<PieceStore> store) {
+	while (store->num_cursors() > 0 && !store->unlocked()) {
+		std::vector<int> wanted = store->wanted_pieces();
+
+		for (size_t i = 0; i < wanted.size(); i++) {
+			boost::shared_array<char> data(new char[1]);
+			data[0] = wanted[i];
+			store->add_piece(wanted[i], data, 1);
+		}
+
+		boost::this_thread::yield();
+	}
+}
+
+/**
+ * Reads all pieces from a cursor and checks their values.
+ */
+void read_cursor(boost::shared_ptr<PieceCursor> cursor, int num_pieces) {
+	for (int i = 0; i < num_pieces; i++) {
+		boost::shared_ptr<Piece> piece = cursor->get_next_piece();
+
+		ASSERT_TRUE(piece);
+		EXPECT_EQ(i, piece->index);
+		EXPECT_EQ((char) i, piece->data[0]);
+	}
+
+	EXPECT_FALSE(cursor->get_next_piece());
+}
+
+void read_one_cursor_piece(boost::shared_ptr<PieceCursor> cursor) {
+	cursor->get_next_piece();
+}
+
+/**
+ * Loads pieces on demand. Used as a request callback.
+ */
+void load_piece(PieceStore* store, int* requested, int index) {
+	*requested = index;
+
+	boost::shared_array<char> data(new char[1]);
+	data[0] = index;
+	store->add_piece(index, data, 1);
+}
+
+TEST(PieceStoreTest, CreateInvalid) {
+	ASSERT_THROW(PieceStore store(0), Exception);
+	ASSERT_THROW(PieceStore store(1, 0), Exception);
+}
+
+TEST(PieceStoreTest, OnlyWantedPiecesAreStored) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(10, 2));
+	boost::shared_array<char> data(new char[1]);
+
+	// Without cursors nothing is wanted.
+	EXPECT_FALSE(store->add_piece(0, data, 1));
+
+	boost::shared_ptr<PieceCursor> cursor = store->create_cursor(3);
+
+	EXPECT_FALSE(store->wanted(2));
+	EXPECT_TRUE(store->wanted(3));
+	EXPECT_TRUE(store->wanted(4));
+	EXPECT_FALSE(store->wanted(5));
+
+	EXPECT_TRUE(store->add_piece(4, data, 1));
+	EXPECT_FALSE(store->wanted(4));
+
+	std::vector<int> wanted = store->wanted_pieces();
+	ASSERT_EQ(1u, wanted.size());
+	EXPECT_EQ(3, wanted[0]);
+}
+
+TEST(PieceStoreTest, CursorsShareMemory) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	boost::shared_ptr<PieceCursor> cursor1 = store->create_cursor();
+	boost::shared_ptr<PieceCursor> cursor2 = store->create_cursor();
+
+	boost::shared_array<char> data(new char[8]);
+	ASSERT_TRUE(store->add_piece(0, data, 8));
+
+	boost::shared_ptr<Piece> piece1 = cursor1->get_next_piece();
+	boost::shared_ptr<Piece> piece2 = cursor2->get_next_piece();
+
+	ASSERT_TRUE(piece1);
+	ASSERT_TRUE(piece2);
+	EXPECT_EQ(data.get(), piece1->data.get());
+	EXPECT_EQ(piece1.get(), piece2.get());
+}
+
+TEST(PieceStoreTest, EvictWhenAllCursorsPassed) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	boost::shared_ptr<PieceCursor> cursor1 = store->create_cursor();
+	boost::shared_ptr<PieceCursor> cursor2 = store->create_cursor();
+
+	boost::shared_array<char> data(new char[8]);
+	store->add_piece(0, data, 8);
+	store->add_piece(1, data, 8);
+	EXPECT_EQ(16, store->stored_bytes());
+
+	cursor1->get_next_piece();
+	EXPECT_EQ(16, store->stored_bytes());
+
+	cursor2->get_next_piece();
+	EXPECT_EQ(8, store->stored_bytes());
+
+	// Dropping a cursor releases its pieces.
+	cursor1->seek(4);
+	cursor2.reset();
+	EXPECT_EQ(0, store->stored_bytes());
+}
+
+TEST(PieceStoreTest, EvictWhenCapacityReached) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(10, 10, 24));
+	boost::shared_ptr<PieceCursor> cursor = store->create_cursor();
+
+	boost::shared_array<char> data(new char[8]);
+	EXPECT_TRUE(store->add_piece(1, data, 8));
+	EXPECT_TRUE(store->add_piece(5, data, 8));
+	EXPECT_TRUE(store->add_piece(2, data, 8));
+
+	// Piece 5 is the farthest from the cursor.
+	EXPECT_TRUE(store->add_piece(0, data, 8));
+	EXPECT_EQ(24, store->stored_bytes());
+	EXPECT_TRUE(store->wanted(5));
+
+	// New piece is the least urgent one.
+	EXPECT_FALSE(store->add_piece(7, data, 8));
+}
+
+TEST(PieceStoreTest, RequestCallbackOnMissingPiece) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	boost::shared_ptr<PieceCursor> cursor = store->create_cursor(2);
+
+	int requested = -1;
+	store->set_request_callback(
+			boost::bind(load_piece, store.get(), &requested, _1));
+
+	boost::shared_ptr<Piece> piece = cursor->get_next_piece();
+
+	EXPECT_EQ(2, requested);
+	ASSERT_TRUE(piece);
+	EXPECT_EQ(2, piece->index);
+}
+
+TEST(PieceStoreTest, UnlockRunningCursor) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	boost::shared_ptr<PieceCursor> cursor = store->create_cursor();
+
+	boost::thread consumer_thread(read_one_cursor_piece, cursor);
+
+	cursor->unlock();
+
+	boost::posix_time::time_duration td = boost::posix_time::seconds(1);
+	EXPECT_TRUE(consumer_thread.timed_join(td));
+
+	consumer_thread.interrupt();
+	consumer_thread.join();
+
+	EXPECT_TRUE(cursor->unlocked());
+	EXPECT_FALSE(store->unlocked());
+}
+
+TEST(PieceStoreTest, ReadConcurrent) {
+	int num_pieces = 5000;
+	boost::shared_ptr<PieceStore> store(new PieceStore(num_pieces));
+
+	boost::shared_ptr<PieceCursor> cursor1 = store->create_cursor();
+	boost::shared_ptr<PieceCursor> cursor2 = store->create_cursor();
+
+	boost::thread consumer_thread1(read_cursor, cursor1, num_pieces);
+	boost::thread consumer_thread2(read_cursor, cursor2, num_pieces);
+	boost::thread producer_thread(feed_store, store);
+
+	boost::posix_time::time_duration td = boost::posix_time::seconds(5);
+	EXPECT_TRUE(consumer_thread1.timed_join(td));
+	EXPECT_TRUE(consumer_thread2.timed_join(td));
+
+	store->unlock();
+	consumer_thread1.join();
+	consumer_thread2.join();
+	producer_thread.join();
+
+	EXPECT_EQ(0, store->stored_bytes());
+}
+
+} /* namespace btstream */
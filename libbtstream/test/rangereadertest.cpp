@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * RangeReaderTest.cpp
+ */
+
+#include "rangereader.h"
+
+#include <gtest/gtest.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include "exception.h"
+
+namespace btstream {
+
+const int READER_PIECE_LENGTH = 4;
+
+/**
+ * Returns a piece whose bytes are their own offsets in the torrent.
+ */
+boost::shared_array<char> make_piece_data(int index, int size) {
+	boost::shared_array<char> data(new char[size]);
+
+	for (int i = 0; i < size; i++) {
+		data[i] = index * READER_PIECE_LENGTH + i;
+	}
+
+	return data;
+}
+
+/**
+ * Stores the piece of a torrent with size bytes. Used as a request
+ * callback.
+ */
+void load_reader_piece(PieceStore* store, int size, int index) {
+	int piece_size = std::min(READER_PIECE_LENGTH,
+			size - index * READER_PIECE_LENGTH);
+
+	store->add_piece(index, make_piece_data(index, piece_size), piece_size);
+}
+
+/**
+ * Copies the spans to a vector, checking that bytes start at offset.
+ */
+void check_spans(const std::vector<ByteSpan>& spans, int offset, int length) {
+	std::vector<char> bytes;
+
+	for (size_t i = 0; i < spans.size(); i++) {
+		bytes.insert(bytes.end(), spans[i].data,
+				spans[i].data + spans[i].size);
+	}
+
+	ASSERT_EQ((size_t) length, bytes.size());
+
+	for (int i = 0; i < length; i++) {
+		EXPECT_EQ((char) (offset + i), bytes[i]);
+	}
+}
+
+void read_range(RangeReader* reader, int* bytes) {
+	std::vector<ByteSpan> spans;
+	*bytes = reader->read(0, 8, spans);
+}
+
+TEST(RangeReaderTest, CreateInvalid) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+
+	ASSERT_THROW(RangeReader reader(boost::shared_ptr<PieceCursor>(), 4, 16),
+			Exception);
+	ASSERT_THROW(RangeReader reader(store->create_cursor(), 0, 16),
+			Exception);
+}
+
+TEST(RangeReaderTest, ReadAcrossPieces) {
+	int size = 14;
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	store->set_request_callback(
+			boost::bind(load_reader_piece, store.get(), size, _1));
+
+	RangeReader reader(store->create_cursor(), READER_PIECE_LENGTH, size);
+	std::vector<ByteSpan> spans;
+
+	EXPECT_EQ(7, reader.read(3, 7, spans));
+	ASSERT_EQ(3u, spans.size());
+	check_spans(spans, 3, 7);
+
+	// Spans point into piece memory.
+	EXPECT_EQ(spans[1].piece->data.get(), spans[1].data);
+
+	// Ranges are clamped to the end of the torrent.
+	spans.clear();
+	EXPECT_EQ(4, reader.read(10, 8, spans));
+	check_spans(spans, 10, 4);
+
+	spans.clear();
+	EXPECT_EQ(0, reader.read(14, 8, spans));
+	EXPECT_TRUE(spans.empty());
+}
+
+TEST(RangeReaderTest, ReadBackwards) {
+	int size = 16;
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	store->set_request_callback(
+			boost::bind(load_reader_piece, store.get(), size, _1));
+
+	RangeReader reader(store->create_cursor(), READER_PIECE_LENGTH, size);
+	std::vector<ByteSpan> spans;
+
+	EXPECT_EQ(4, reader.read(12, 4, spans));
+	check_spans(spans, 12, 4);
+
+	spans.clear();
+	EXPECT_EQ(6, reader.read(1, 6, spans));
+	check_spans(spans, 1, 6);
+}
+
+TEST(RangeReaderTest, ReadVector) {
+	int size = 16;
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	store->set_request_callback(
+			boost::bind(load_reader_piece, store.get(), size, _1));
+
+	RangeReader reader(store->create_cursor(), READER_PIECE_LENGTH, size);
+
+	std::vector<ByteRange> ranges;
+	ranges.push_back(ByteRange(2, 3));
+	ranges.push_back(ByteRange(5, 2));
+
+	std::vector<ByteSpan> spans;
+	EXPECT_EQ(5, reader.readv(ranges, spans));
+	ASSERT_EQ(3u, spans.size());
+	EXPECT_EQ(2, spans[0].data[0]);
+	EXPECT_EQ(5, spans[2].data[0]);
+}
+
+TEST(RangeReaderTest, ReadSomeReturnsAvailablePieces) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	RangeReader reader(store->create_cursor(), READER_PIECE_LENGTH, 16);
+
+	store->add_piece(0, make_piece_data(0, 4), 4);
+	store->add_piece(2, make_piece_data(2, 4), 4);
+
+	std::vector<ByteSpan> spans;
+	EXPECT_EQ(2, reader.read_some(2, 10, spans));
+	check_spans(spans, 2, 2);
+
+	// The rest of the range is returned once it is available.
+	store->add_piece(1, make_piece_data(1, 4), 4);
+
+	spans.clear();
+	EXPECT_EQ(10, reader.read_some(2, 10, spans));
+	check_spans(spans, 2, 10);
+}
+
+TEST(RangeReaderTest, UnlockBlockedRead) {
+	boost::shared_ptr<PieceStore> store(new PieceStore(4));
+	RangeReader reader(store->create_cursor(), READER_PIECE_LENGTH, 16);
+
+	store->add_piece(0, make_piece_data(0, 4), 4);
+
+	std::vector<ByteSpan> spans;
+	EXPECT_EQ(4, reader.read(0, 4, spans));
+
+	int bytes = -1;
+	boost::thread consumer_thread(read_range, &reader, &bytes);
+
+	reader.unlock();
+
+	boost::posix_time::time_duration td = boost::posix_time::seconds(1);
+	EXPECT_TRUE(consumer_thread.timed_join(td));
+
+	consumer_thread.interrupt();
+	consumer_thread.join();
+
+	EXPECT_EQ(4, bytes);
+}
+
+} /* namespace btstream */
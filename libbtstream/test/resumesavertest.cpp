@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * ResumeSaverTest.cpp
+ */
+
+#include "resumesaver.h"
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include "constants.h"
+
+namespace btstream {
+
+/**
+ * Session with the test torrent, whose alerts are routed by a running
+ * dispatcher.
+ */
+struct ResumeSaverFixture {
+	ResumeSaverFixture() :
+			dispatcher(session) {
+
+		session.set_alert_mask(libtorrent::alert::storage_notification
+				| libtorrent::alert::status_notification);
+		dispatcher.start();
+
+		libtorrent::add_torrent_params params;
+		params.ti = new libtorrent::torrent_info(TEST_TORRENT1);
+		params.save_path = ".";
+		handle = session.add_torrent(params);
+	}
+
+	libtorrent::session session;
+	AlertDispatcher dispatcher;
+	libtorrent::torrent_handle handle;
+};
+
+bool file_exists(const std::string& path) {
+	return std::ifstream(path.c_str()).good();
+}
+
+TEST(ResumeSaverTest, Save) {
+	ResumeSaverFixture fixture;
+	ResumeSaver saver(fixture.dispatcher);
+
+	std::string path = "./resumesavertest.resume";
+	std::remove(path.c_str());
+
+	saver.save(fixture.handle, path);
+	EXPECT_EQ(1, saver.outstanding());
+
+	ASSERT_TRUE(saver.wait(boost::posix_time::seconds(10)));
+	EXPECT_EQ(0, saver.outstanding());
+	EXPECT_TRUE(file_exists(path));
+
+	std::remove(path.c_str());
+}
+
+TEST(ResumeSaverTest, WriteFailureFinishes) {
+	ResumeSaverFixture fixture;
+	ResumeSaver saver(fixture.dispatcher);
+
+	std::string path = "./resumesavertest-missing/resumesavertest.resume";
+
+	saver.save(fixture.handle, path);
+
+	// The background write fails, but the request is still finished.
+	ASSERT_TRUE(saver.wait(boost::posix_time::seconds(10)));
+	EXPECT_EQ(0, saver.outstanding());
+	EXPECT_FALSE(file_exists(path));
+}
+
+TEST(ResumeSaverTest, Release) {
+	ResumeSaverFixture fixture;
+	ResumeSaver saver(fixture.dispatcher);
+
+	std::string path = "./resumesavertest.resume";
+	std::remove(path.c_str());
+
+	saver.watch(fixture.handle, path);
+	EXPECT_EQ(1, saver.watched());
+
+	// The torrent is saved one last time, then forgotten.
+	saver.release(fixture.handle, path);
+	EXPECT_EQ(1, saver.outstanding(fixture.handle));
+
+	ASSERT_TRUE(saver.wait(fixture.handle, boost::posix_time::seconds(10)));
+	EXPECT_EQ(0, saver.outstanding(fixture.handle));
+	EXPECT_EQ(0, saver.watched());
+	EXPECT_TRUE(file_exists(path));
+
+	std::remove(path.c_str());
+}
+
+TEST(ResumeSaverTest, PeriodicCheckpoint) {
+	ResumeSaverFixture fixture;
+	ResumeSaver saver(fixture.dispatcher);
+	saver.set_interval(1);
+
+	std::string path = "./resumesavertest.resume";
+	std::remove(path.c_str());
+
+	saver.watch(fixture.handle, path);
+
+	for (int i = 0; i < 50 && !file_exists(path); i++) {
+		boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+	}
+
+	EXPECT_TRUE(file_exists(path));
+
+	// Finished requests don't hold back the following checkpoints.
+	ASSERT_TRUE(saver.wait(boost::posix_time::seconds(10)));
+	EXPECT_EQ(0, saver.outstanding());
+
+	std::remove(path.c_str());
+}
+
+TEST(ResumeSaverTest, ReplacesFile) {
+	ResumeSaverFixture fixture;
+	ResumeSaver saver(fixture.dispatcher);
+
+	std::string path = "./resumesavertest.resume";
+	std::ofstream(path.c_str()) << "old";
+
+	saver.save(fixture.handle, path);
+	ASSERT_TRUE(saver.wait(boost::posix_time::seconds(10)));
+
+	// The file is bencoded resume data, and the temporary file is gone.
+	std::ifstream in(path.c_str());
+	std::string content((std::istreambuf_iterator<char>(in)),
+			std::istreambuf_iterator<char>());
+
+	ASSERT_FALSE(content.empty());
+	EXPECT_EQ('d', content[0]);
+	EXPECT_FALSE(file_exists(path + ".tmp"));
+
+	std::remove(path.c_str());
+}
+
+} /* namespace btstream */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * SlackControllerTest.cpp
+ */
+
+
+#include "slackcontroller.h"
+
+#include <gtest/gtest.h>
+
+namespace btstream {
+
+TEST(SlackControllerTest, StartsUrgent) {
+	SlackController controller(10000, 60000, 5000);
+	EXPECT_EQ(URGENT_SEQUENTIAL, controller.mode());
+
+	EXPECT_FALSE(controller.update(0));
+	EXPECT_EQ(URGENT_SEQUENTIAL, controller.mode());
+}
+
+TEST(SlackControllerTest, LessUrgentPastMargin) {
+	SlackController controller(10000, 60000, 5000);
+
+	// Above the low threshold, but inside the margin.
+	EXPECT_FALSE(controller.update(12000));
+	EXPECT_EQ(URGENT_SEQUENTIAL, controller.mode());
+
+	EXPECT_TRUE(controller.update(15000));
+	EXPECT_EQ(DEADLINE_WINDOW, controller.mode());
+
+	EXPECT_FALSE(controller.update(62000));
+	EXPECT_EQ(DEADLINE_WINDOW, controller.mode());
+
+	EXPECT_TRUE(controller.update(65000));
+	EXPECT_EQ(RAREST_FIRST_WINDOW, controller.mode());
+}
+
+TEST(SlackControllerTest, MoreUrgentAtOnce) {
+	SlackController controller(10000, 60000, 5000);
+	controller.update(100000);
+	EXPECT_EQ(RAREST_FIRST_WINDOW, controller.mode());
+
+	// Hovering around the high threshold doesn't flip the mode.
+	EXPECT_TRUE(controller.update(59000));
+	EXPECT_EQ(DEADLINE_WINDOW, controller.mode());
+	EXPECT_FALSE(controller.update(61000));
+	EXPECT_FALSE(controller.update(59000));
+	EXPECT_EQ(DEADLINE_WINDOW, controller.mode());
+
+	// Straight to sequential.
+	controller.update(100000);
+	EXPECT_TRUE(controller.update(5000));
+	EXPECT_EQ(URGENT_SEQUENTIAL, controller.mode());
+}
+
+TEST(SlackControllerTest, Reset) {
+	SlackController controller;
+	controller.update(DEFAULT_HIGH_SLACK_MS + DEFAULT_SLACK_HYSTERESIS_MS);
+	EXPECT_EQ(RAREST_FIRST_WINDOW, controller.mode());
+
+	controller.reset();
+	EXPECT_EQ(URGENT_SEQUENTIAL, controller.mode());
+
+	// New thresholds apply to the next update.
+	controller.set_thresholds(1000, 2000, 0);
+	EXPECT_EQ(1000, controller.low_threshold());
+	EXPECT_TRUE(controller.update(1500));
+	EXPECT_EQ(DEADLINE_WINDOW, controller.mode());
+}
+
+} /* namespace btstream */
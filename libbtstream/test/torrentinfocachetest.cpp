@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011-2013 Gabriel Mendonça
+ *
+ * This file is part of BTStream.
+ * BTStream is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * BTStream is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with BTStream.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * TorrentInfoCacheTest.cpp
+ */
+
+#include "torrentinfocache.h"
+
+#include <gtest/gtest.h>
+
+#include "constants.h"
+
+namespace btstream {
+
+TEST(TorrentInfoCacheTest, LoadInvalid) {
+	TorrentInfoCache cache;
+
+	ASSERT_THROW(cache.load(""), Exception);
+	ASSERT_THROW(cache.load("missingfile.torrent"), Exception);
+
+	// Files that aren't torrents.
+	ASSERT_THROW(cache.load("testfile1"), Exception);
+	EXPECT_EQ(0u, cache.size());
+}
+
+TEST(TorrentInfoCacheTest, LoadCached) {
+	TorrentInfoCache cache;
+
+	boost::intrusive_ptr<libtorrent::torrent_info> first = cache.load(
+			TEST_TORRENT1);
+	boost::intrusive_ptr<libtorrent::torrent_info> second = cache.load(
+			TEST_TORRENT1);
+
+	EXPECT_EQ(1u, cache.size());
+
+	// Each caller has its own copy.
+	EXPECT_NE(first.get(), second.get());
+	EXPECT_EQ(first->info_hash(), second->info_hash());
+	EXPECT_EQ(TEST_TORRENT1_PIECES, second->num_pieces());
+}
+
+TEST(TorrentInfoCacheTest, Evict) {
+	TorrentInfoCache cache(1);
+
+	cache.load(TEST_TORRENT1);
+	cache.load(TEST_TORRENT2);
+	EXPECT_EQ(1u, cache.size());
+
+	cache.clear();
+	EXPECT_EQ(0u, cache.size());
+}
+
+} /* namespace btstream */
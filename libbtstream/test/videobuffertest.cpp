@@ -25,7 +25,10 @@
 #include "videobuffer.h"
 
 #include <gtest/gtest.h>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <algorithm>
+#include <poll.h>
 
 #include "exception.h"
 
@@ -58,6 +61,28 @@ void read_pieces(VideoBuffer* video_buffer, int num_pieces) {
 	}
 }
 
+/**
+ * Fills given buffer with pieces, reversing the order of each group of
+ * window_size() pieces. Out of order pieces are retried until there is
+ * room for them.
+ */
+void fill_buffer_out_of_order(VideoBuffer *video_buffer, int num_pieces) {
+	int window = video_buffer->window_size();
+
+	for (int first = 0; first < num_pieces; first += window) {
+		int last = std::min(first + window, num_pieces) - 1;
+
+		for (int i = last; i >= first; i--) {
+			boost::shared_array<char> data(new char[1]);
+			data[0] = i;
+
+			while (!video_buffer->add_piece(i, data, 1)) {
+				boost::this_thread::yield();
+			}
+		}
+	}
+}
+
 void read_one_piece(VideoBuffer* video_buffer, boost::shared_ptr<Piece> piece) {
 	piece = video_buffer->get_next_piece();
 }
@@ -192,6 +217,35 @@ TEST(VideoBufferTest, AddPieceConcurrent) {
 	EXPECT_EQ(size, last_piece->size);
 }
 
+TEST(VideoBufferTest, AddPieceConcurrentSpsc) {
+	int num_pieces = 50000;
+	VideoBuffer video_buffer(num_pieces, SPSC);
+
+	ASSERT_EQ(SPSC, video_buffer.mode());
+
+	// Producer thread. Will add pieces to the buffer.
+	boost::thread producer_thread(fill_buffer, &video_buffer, num_pieces);
+
+	// Consumer thread. Will read all pieces and check their values.
+	boost::thread consumer_thread(read_pieces, &video_buffer, num_pieces);
+
+	// Waiting for producer and consumer thread.
+	boost::posix_time::time_duration td = boost::posix_time::seconds(1);
+	EXPECT_TRUE(producer_thread.timed_join(td));
+	EXPECT_TRUE(consumer_thread.timed_join(td));
+
+	// Stop threads in case they are still running.
+	producer_thread.interrupt();
+	consumer_thread.interrupt();
+	producer_thread.join();
+	consumer_thread.join();
+
+	EXPECT_EQ(num_pieces, video_buffer.get_next_piece_index());
+
+	// All pieces were returned.
+	EXPECT_FALSE(video_buffer.get_next_piece());
+}
+
 TEST(VideoBufferTest, GetNextPieceOverflow) {
 	VideoBuffer video_buffer(1);
 
@@ -244,4 +298,603 @@ TEST(VideoBufferTest, UnlockRunningGetNextPiece) {
 	ASSERT_FALSE(null_piece);
 }
 
+TEST(VideoBufferTest, UnlockRunningGetNextPieceSpsc) {
+	VideoBuffer video_buffer(1, SPSC);
+
+	boost::shared_ptr<Piece> null_piece;
+
+	boost::thread consumer_thread(read_one_piece, &video_buffer, null_piece);
+
+	video_buffer.unlock();
+
+	ASSERT_TRUE(video_buffer.unlocked());
+
+	// Threads shoudn't take too long to stop.
+	boost::posix_time::time_duration td = boost::posix_time::seconds(1);
+	EXPECT_TRUE(consumer_thread.timed_join(td));
+
+	// Stop consumer thread in case it is still running.
+	consumer_thread.interrupt();
+	consumer_thread.join();
+
+	ASSERT_FALSE(null_piece);
+}
+
+void add_one_piece(VideoBuffer* video_buffer, int index, int size) {
+	boost::shared_array<char> data(new char[size]);
+	video_buffer->add_piece(index, data, size);
+}
+
+TEST(VideoBufferTest, CreateWithInvalidSettings) {
+	BufferSettings settings;
+	ASSERT_THROW(VideoBuffer video_buffer(1, settings, 0), Exception);
+
+	settings.capacity_bytes = -1;
+	ASSERT_THROW(VideoBuffer video_buffer(1, settings, 1), Exception);
+}
+
+TEST(VideoBufferTest, DefaultCapacity) {
+	int piece_length = 16;
+	VideoBuffer video_buffer(100, BufferSettings(), piece_length);
+
+	EXPECT_EQ(DEFAULT_CAPACITY_PIECES * piece_length, video_buffer.capacity());
+	EXPECT_EQ(0, video_buffer.buffered_bytes());
+}
+
+TEST(VideoBufferTest, ByteCapacityBlocksProducer) {
+	BufferSettings settings;
+	settings.capacity_bytes = 100;
+	VideoBuffer video_buffer(10, settings, 40);
+
+	add_one_piece(&video_buffer, 0, 40);
+	add_one_piece(&video_buffer, 1, 40);
+	EXPECT_EQ(80, video_buffer.buffered_bytes());
+
+	// Third piece doesn't fit.
+	boost::thread producer_thread(add_one_piece, &video_buffer, 2, 40);
+
+	boost::posix_time::time_duration td = boost::posix_time::milliseconds(200);
+	EXPECT_FALSE(producer_thread.timed_join(td));
+
+	// Reading a piece frees enough space.
+	ASSERT_TRUE(video_buffer.get_next_piece());
+
+	td = boost::posix_time::seconds(1);
+	EXPECT_TRUE(producer_thread.timed_join(td));
+	EXPECT_EQ(80, video_buffer.buffered_bytes());
+}
+
+TEST(VideoBufferTest, ByteCapacityAcceptsLargePieceWhenEmpty) {
+	BufferSettings settings;
+	settings.capacity_bytes = 10;
+	settings.mode = SPSC;
+	VideoBuffer video_buffer(1, settings, 64);
+
+	add_one_piece(&video_buffer, 0, 64);
+
+	boost::shared_ptr<Piece> piece = video_buffer.get_next_piece();
+	ASSERT_TRUE(piece);
+	EXPECT_EQ(64, piece->size);
+	EXPECT_EQ(0, video_buffer.buffered_bytes());
+}
+
+TEST(VideoBufferTest, TimeCapacity) {
+	BufferSettings settings;
+	settings.capacity_ms = 2000;
+	VideoBuffer video_buffer(100, settings, 16);
+
+	// Media rate unknown, falls back to the default capacity.
+	EXPECT_EQ(DEFAULT_CAPACITY_PIECES * 16, video_buffer.capacity());
+
+	video_buffer.set_media_rate(500);
+	EXPECT_EQ(1000, video_buffer.capacity());
+
+	// Byte capacity is a hard limit.
+	settings.capacity_bytes = 600;
+	VideoBuffer limited_buffer(100, settings, 16);
+	limited_buffer.set_media_rate(500);
+	EXPECT_EQ(600, limited_buffer.capacity());
+}
+
+TEST(VideoBufferTest, AdaptiveCapacity) {
+	BufferSettings settings;
+	settings.capacity_ms = 1000;
+	settings.capacity_bytes = 3000;
+	settings.adaptive = true;
+	VideoBuffer video_buffer(100, settings, 16);
+
+	video_buffer.set_media_rate(1000);
+	EXPECT_EQ(1000, video_buffer.capacity());
+
+	// Slow download, buffer grows up to the byte limit.
+	video_buffer.set_download_rate(500);
+	EXPECT_EQ(2000, video_buffer.capacity());
+
+	video_buffer.set_download_rate(100);
+	EXPECT_EQ(3000, video_buffer.capacity());
+
+	// Fast download, buffer shrinks.
+	video_buffer.set_download_rate(10000);
+	EXPECT_EQ(500, video_buffer.capacity());
+}
+
+TEST(VideoBufferTest, AddPieceOutOfOrder) {
+	VideoBuffer video_buffer(3);
+
+	boost::shared_array<char> data(new char[1]);
+
+	EXPECT_TRUE(video_buffer.add_piece(2, data, 1));
+	EXPECT_TRUE(video_buffer.add_piece(1, data, 1));
+	EXPECT_TRUE(video_buffer.add_piece(0, data, 1));
+
+	for (int i = 0; i < 3; i++) {
+		boost::shared_ptr<Piece> piece = video_buffer.get_next_piece();
+
+		ASSERT_TRUE(piece);
+		EXPECT_EQ(i, piece->index);
+	}
+}
+
+TEST(VideoBufferTest, AddPieceOutOfWindow) {
+	int num_pieces = 100;
+	VideoBuffer video_buffer(num_pieces);
+
+	int window = video_buffer.window_size();
+	ASSERT_LT(window, num_pieces);
+
+	boost::shared_array<char> data(new char[1]);
+
+	// Pieces ahead of the window are rejected without blocking.
+	EXPECT_FALSE(video_buffer.in_window(window));
+	EXPECT_FALSE(video_buffer.add_piece(window, data, 1));
+
+	EXPECT_TRUE(video_buffer.in_window(window - 1));
+	EXPECT_TRUE(video_buffer.add_piece(window - 1, data, 1));
+	EXPECT_FALSE(video_buffer.in_window(window - 1));
+
+	// The window moves as pieces are played.
+	EXPECT_TRUE(video_buffer.add_piece(0, data, 1));
+	ASSERT_TRUE(video_buffer.get_next_piece());
+
+	EXPECT_TRUE(video_buffer.in_window(window));
+	EXPECT_TRUE(video_buffer.add_piece(window, data, 1));
+}
+
+TEST(VideoBufferTest, AddPieceDuplicate) {
+	VideoBuffer video_buffer(3, SPSC);
+
+	boost::shared_array<char> data(new char[1]);
+
+	EXPECT_TRUE(video_buffer.add_piece(1, data, 1));
+	EXPECT_FALSE(video_buffer.add_piece(1, data, 1));
+
+	EXPECT_TRUE(video_buffer.add_piece(0, data, 1));
+	ASSERT_TRUE(video_buffer.get_next_piece());
+
+	// Piece was already played.
+	EXPECT_FALSE(video_buffer.add_piece(0, data, 1));
+}
+
+TEST(VideoBufferTest, OutOfOrderPieceDoesNotBlock) {
+	BufferSettings settings;
+	settings.capacity_bytes = 100;
+	VideoBuffer video_buffer(10, settings, 40);
+
+	boost::shared_array<char> data(new char[40]);
+
+	EXPECT_TRUE(video_buffer.add_piece(1, data, 40));
+	EXPECT_TRUE(video_buffer.add_piece(2, data, 40));
+
+	// Doesn't fit and piece 0 is missing.
+	EXPECT_FALSE(video_buffer.add_piece(3, data, 40));
+
+	// Next piece to be played is always accepted.
+	EXPECT_TRUE(video_buffer.add_piece(0, data, 40));
+	EXPECT_EQ(120, video_buffer.buffered_bytes());
+}
+
+TEST(VideoBufferTest, GetNextPiecesBatch) {
+	for (int mode = LOCKED; mode <= SPSC; mode++) {
+		VideoBuffer video_buffer(10, (BufferMode) mode);
+		boost::shared_array<char> data(new char[10]);
+
+		video_buffer.add_piece(0, data, 10);
+		video_buffer.add_piece(1, data, 10);
+		video_buffer.add_piece(2, data, 10);
+		video_buffer.add_piece(4, data, 10);
+
+		// Stops at the count limit.
+		std::vector<boost::shared_ptr<Piece> > pieces =
+				video_buffer.get_next_pieces(2);
+		ASSERT_EQ(2u, pieces.size());
+		EXPECT_EQ(0, pieces[0]->index);
+		EXPECT_EQ(1, pieces[1]->index);
+
+		// Stops at the first missing piece.
+		pieces = video_buffer.get_next_pieces(10);
+		ASSERT_EQ(1u, pieces.size());
+		EXPECT_EQ(2, pieces[0]->index);
+		EXPECT_EQ(3, video_buffer.get_next_piece_index());
+		EXPECT_EQ(10, video_buffer.buffered_bytes());
+	}
+}
+
+TEST(VideoBufferTest, GetNextPiecesByteLimit) {
+	VideoBuffer video_buffer(4, SPSC);
+	boost::shared_array<char> data(new char[10]);
+
+	for (int i = 0; i < 4; i++) {
+		video_buffer.add_piece(i, data, 10);
+	}
+
+	// The first piece is returned even if it is over the limit.
+	EXPECT_EQ(1u, video_buffer.get_next_pieces(10, 5).size());
+	EXPECT_EQ(2u, video_buffer.get_next_pieces(10, 25).size());
+	EXPECT_EQ(1u, video_buffer.get_next_pieces(10).size());
+
+	// All pieces were returned.
+	EXPECT_TRUE(video_buffer.get_next_pieces(10).empty());
+	video_buffer.unlock();
+	EXPECT_TRUE(video_buffer.get_next_pieces(10).empty());
+}
+
+void count_released_piece(int* released, const Piece&) {
+	(*released)++;
+}
+
+TEST(VideoBufferTest, GetNextHandle) {
+	int released = 0;
+	VideoBuffer video_buffer(2, SPSC);
+	video_buffer.set_release_hook(
+			boost::bind(count_released_piece, &released, _1));
+
+	boost::shared_array<char> data(new char[10]);
+	video_buffer.add_piece(0, data, 10);
+
+	PieceHandle handle = video_buffer.get_next_handle();
+	ASSERT_FALSE(handle.empty());
+	EXPECT_EQ(0, handle.index());
+	EXPECT_EQ(data.get(), handle.data());
+
+	handle.release();
+	EXPECT_EQ(1, released);
+
+	video_buffer.unlock();
+	handle = video_buffer.get_next_handle();
+	EXPECT_TRUE(handle.empty());
+}
+
+TEST(VideoBufferTest, GetNextHandles) {
+	int released = 0;
+	VideoBuffer video_buffer(4, SPSC);
+	video_buffer.set_release_hook(
+			boost::bind(count_released_piece, &released, _1));
+
+	for (int i = 0; i < 3; i++) {
+		video_buffer.add_piece(i, boost::shared_array<char>(new char[10]), 10);
+	}
+
+	{
+		PieceHandle handles[2];
+		ASSERT_EQ(2, video_buffer.get_next_handles(handles, 2));
+		EXPECT_EQ(0, handles[0].index());
+		EXPECT_EQ(1, handles[1].index());
+		EXPECT_EQ(0, released);
+	}
+	EXPECT_EQ(2, released);
+
+	PieceHandle handles[2];
+	ASSERT_EQ(1, video_buffer.get_next_handles(handles, 2));
+	EXPECT_EQ(2, handles[0].index());
+	EXPECT_TRUE(handles[1].empty());
+
+	video_buffer.unlock();
+	EXPECT_EQ(0, video_buffer.get_next_handles(handles, 2));
+}
+
+TEST(VideoBufferTest, HandleOutlivesBuffer) {
+	int released = 0;
+	PieceHandle handle;
+
+	{
+		VideoBuffer video_buffer(2, SPSC);
+		video_buffer.set_release_hook(
+				boost::bind(count_released_piece, &released, _1));
+		video_buffer.add_piece(0, boost::shared_array<char>(new char[10]), 10);
+
+		handle = video_buffer.get_next_handle();
+	}
+
+	ASSERT_FALSE(handle.empty());
+	handle.release();
+	EXPECT_EQ(1, released);
+}
+
+TEST(VideoBufferTest, TryGetNextPiece) {
+	for (int mode = LOCKED; mode <= SPSC; mode++) {
+		VideoBuffer video_buffer(2, (BufferMode) mode);
+		boost::shared_array<char> data(new char[10]);
+
+		EXPECT_FALSE(video_buffer.try_get_next_piece());
+
+		video_buffer.add_piece(0, data, 10);
+		boost::shared_ptr<Piece> piece = video_buffer.try_get_next_piece();
+		ASSERT_TRUE(piece);
+		EXPECT_EQ(0, piece->index);
+		EXPECT_EQ(1, video_buffer.get_next_piece_index());
+	}
+}
+
+TEST(VideoBufferTest, GetNextPieceForTimeout) {
+	for (int mode = LOCKED; mode <= SPSC; mode++) {
+		VideoBuffer video_buffer(2, (BufferMode) mode);
+		boost::shared_array<char> data(new char[10]);
+
+		boost::posix_time::ptime start =
+				boost::posix_time::microsec_clock::universal_time();
+		EXPECT_FALSE(video_buffer.get_next_piece_for(
+				boost::posix_time::milliseconds(50)));
+		EXPECT_GE(boost::posix_time::microsec_clock::universal_time() - start,
+				boost::posix_time::milliseconds(40));
+
+		boost::thread producer_thread(add_one_piece, &video_buffer, 0, 10);
+		EXPECT_TRUE(video_buffer.get_next_piece_for(
+				boost::posix_time::seconds(5)));
+		producer_thread.join();
+	}
+}
+
+/**
+ * Returns true if the descriptor is readable, without waiting.
+ */
+bool readable(int fd) {
+	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+TEST(VideoBufferTest, EventFd) {
+	for (int mode = LOCKED; mode <= SPSC; mode++) {
+		VideoBuffer video_buffer(3, (BufferMode) mode);
+		boost::shared_array<char> data(new char[10]);
+
+		int fd = video_buffer.get_event_fd();
+		ASSERT_GE(fd, 0);
+		EXPECT_EQ(fd, video_buffer.get_event_fd());
+		EXPECT_FALSE(readable(fd));
+
+		video_buffer.add_piece(1, data, 10);
+		EXPECT_FALSE(readable(fd));
+
+		video_buffer.add_piece(0, data, 10);
+		EXPECT_TRUE(readable(fd));
+
+		// Stays readable while pieces are ready.
+		video_buffer.get_next_piece();
+		EXPECT_TRUE(readable(fd));
+
+		video_buffer.get_next_piece();
+		EXPECT_FALSE(readable(fd));
+
+		video_buffer.unlock();
+		EXPECT_TRUE(readable(fd));
+	}
+}
+
+/**
+ * Records the pieces to load. Used as a loader.
+ */
+void record_load(std::vector<int>* loads, int index) {
+	loads->push_back(index);
+}
+
+/**
+ * Loads pieces right away. Used as a loader.
+ */
+void load_now(VideoBuffer* video_buffer, int index) {
+	boost::shared_array<char> data(new char[10]);
+	data[0] = index;
+	video_buffer->add_piece(index, data, 10);
+}
+
+TEST(VideoBufferTest, LazyLoadsNearConsumer) {
+	BufferSettings settings;
+	settings.prefetch_pieces = 2;
+	VideoBuffer video_buffer(20, settings, 10);
+
+	std::vector<int> loads;
+	video_buffer.set_loader(boost::bind(record_load, &loads, _1));
+	EXPECT_TRUE(video_buffer.lazy());
+
+	for (int i = 0; i < 10; i++) {
+		video_buffer.set_piece_ready(i);
+	}
+
+	// Only the prefetched pieces are loaded.
+	ASSERT_EQ(2u, loads.size());
+	EXPECT_EQ(0, loads[0]);
+	EXPECT_EQ(1, loads[1]);
+	EXPECT_EQ(10, video_buffer.ready_pieces());
+
+	boost::shared_array<char> data(new char[10]);
+	video_buffer.add_piece(1, data, 10);
+	video_buffer.add_piece(0, data, 10);
+	EXPECT_EQ(20, video_buffer.buffered_bytes());
+
+	// Reading a piece loads the next one.
+	video_buffer.get_next_piece();
+	ASSERT_EQ(3u, loads.size());
+	EXPECT_EQ(2, loads[2]);
+	EXPECT_EQ(9, video_buffer.ready_pieces());
+}
+
+TEST(VideoBufferTest, LazyReadAll) {
+	int num_pieces = 100;
+
+	for (int mode = LOCKED; mode <= SPSC; mode++) {
+		BufferSettings settings;
+		settings.mode = (BufferMode) mode;
+		settings.prefetch_pieces = 3;
+		VideoBuffer video_buffer(num_pieces, settings, 10);
+		video_buffer.set_loader(boost::bind(load_now, &video_buffer, _1));
+
+		for (int i = 0; i < num_pieces; i++) {
+			video_buffer.set_piece_ready(i);
+			EXPECT_LE(video_buffer.buffered_bytes(), 30);
+		}
+
+		for (int i = 0; i < num_pieces; i++) {
+			boost::shared_ptr<Piece> piece = video_buffer.get_next_piece();
+			ASSERT_TRUE(piece);
+			EXPECT_EQ((char) i, piece->data[0]);
+			EXPECT_LE(video_buffer.buffered_bytes(), 30);
+		}
+	}
+}
+
+TEST(VideoBufferTest, AddPieceOutOfOrderConcurrent) {
+	int num_pieces = 50000;
+
+	for (int mode = LOCKED; mode <= SPSC; mode++) {
+		VideoBuffer video_buffer(num_pieces, (BufferMode) mode);
+
+		boost::thread producer_thread(fill_buffer_out_of_order, &video_buffer,
+				num_pieces);
+		boost::thread consumer_thread(read_pieces, &video_buffer, num_pieces);
+
+		boost::posix_time::time_duration td = boost::posix_time::seconds(5);
+		EXPECT_TRUE(producer_thread.timed_join(td));
+		EXPECT_TRUE(consumer_thread.timed_join(td));
+
+		video_buffer.unlock();
+		producer_thread.interrupt();
+		consumer_thread.interrupt();
+		producer_thread.join();
+		consumer_thread.join();
+
+		EXPECT_EQ(num_pieces, video_buffer.get_next_piece_index());
+	}
+}
+
+/**
+ * Counts space callback calls and wakes up a waiting producer.
+ */
+struct SpaceSignal {
+	SpaceSignal() :
+			calls(0), signaled(false) {
+	}
+
+	void notify() {
+		boost::lock_guard<boost::mutex> lock(mutex);
+		calls++;
+		signaled = true;
+		condition.notify_all();
+	}
+
+	bool wait(const boost::posix_time::time_duration& timeout) {
+		boost::unique_lock<boost::mutex> lock(mutex);
+		boost::system_time deadline = boost::get_system_time() + timeout;
+
+		while (!signaled) {
+			if (!condition.timed_wait(lock, deadline)) {
+				return false;
+			}
+		}
+
+		signaled = false;
+		return true;
+	}
+
+	int calls;
+	bool signaled;
+	boost::mutex mutex;
+	boost::condition_variable condition;
+};
+
+/**
+ * Fills given buffer with try_add_piece(), waiting for the space callback
+ * when a piece is rejected. Counts waits that weren't woken up.
+ */
+void try_fill_buffer(VideoBuffer* video_buffer, SpaceSignal* signal,
+		int num_pieces, int* missed) {
+
+	for (int i = 0; i < num_pieces; i++) {
+		boost::shared_array<char> data(new char[1]);
+		data[0] = i;
+
+		while (!video_buffer->try_add_piece(i, data, 1)) {
+			if (!signal->wait(boost::posix_time::seconds(1))) {
+				(*missed)++;
+			}
+		}
+	}
+}
+
+TEST(VideoBufferTest, TryAddPieceDoesNotBlock) {
+	for (int mode = LOCKED; mode <= SPSC; mode++) {
+		BufferSettings settings;
+		settings.mode = (BufferMode) mode;
+		settings.capacity_bytes = 100;
+		VideoBuffer video_buffer(10, settings, 40);
+
+		SpaceSignal signal;
+		video_buffer.set_space_callback(
+				boost::bind(&SpaceSignal::notify, &signal));
+
+		add_one_piece(&video_buffer, 0, 40);
+		add_one_piece(&video_buffer, 1, 40);
+
+		// Next missing piece doesn't fit, but isn't waited for.
+		boost::shared_array<char> data(new char[40]);
+		EXPECT_FALSE(video_buffer.try_add_piece(2, data, 40));
+		EXPECT_EQ(0, signal.calls);
+
+		// Reading a piece calls the callback once.
+		ASSERT_TRUE(video_buffer.get_next_piece());
+		EXPECT_EQ(1, signal.calls);
+		ASSERT_TRUE(video_buffer.get_next_piece());
+		EXPECT_EQ(1, signal.calls);
+
+		EXPECT_TRUE(video_buffer.try_add_piece(2, data, 40));
+		EXPECT_EQ(40, video_buffer.buffered_bytes());
+	}
+}
+
+TEST(VideoBufferTest, TryAddPieceConcurrent) {
+	int num_pieces = 20000;
+
+	for (int mode = LOCKED; mode <= SPSC; mode++) {
+		BufferSettings settings;
+		settings.mode = (BufferMode) mode;
+		settings.capacity_bytes = 4;
+		VideoBuffer video_buffer(num_pieces, settings, 1);
+
+		SpaceSignal signal;
+		video_buffer.set_space_callback(
+				boost::bind(&SpaceSignal::notify, &signal));
+
+		int missed = 0;
+		boost::thread producer_thread(try_fill_buffer, &video_buffer, &signal,
+				num_pieces, &missed);
+		boost::thread consumer_thread(read_pieces, &video_buffer, num_pieces);
+
+		boost::posix_time::time_duration td = boost::posix_time::seconds(10);
+		EXPECT_TRUE(producer_thread.timed_join(td));
+		EXPECT_TRUE(consumer_thread.timed_join(td));
+
+		video_buffer.unlock();
+		producer_thread.interrupt();
+		consumer_thread.interrupt();
+		producer_thread.join();
+		consumer_thread.join();
+
+		// Every rejected piece was followed by a callback.
+		EXPECT_EQ(0, missed);
+		EXPECT_EQ(num_pieces, video_buffer.get_next_piece_index());
+	}
+}
+
 } /* namespace btstream */
@@ -23,6 +23,13 @@
  */
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <libtorrent/alert_types.hpp>
 
 #include "videotorrentmanager.h"
 #include "exception.h"
@@ -31,6 +38,93 @@
 
 namespace btstream {
 
+/**
+ * Tests that look at the state kept by the feeding thread.
+ */
+class VideoTorrentManagerStateTest: public testing::Test {
+protected:
+	static int reads_in_flight(VideoTorrentManager& manager) {
+		return manager.m_reads_in_flight;
+	}
+
+	static boost::dynamic_bitset<> index_have(VideoTorrentManager& manager) {
+		boost::lock_guard<boost::mutex> lock(manager.m_index_mutex);
+		return manager.m_index_have;
+	}
+
+	/**
+	 * Returns true if the feeding thread's copy of the downloaded pieces
+	 * matches the index thread's. Only reliable while the feeding thread
+	 * is idle.
+	 */
+	static bool have_in_sync(VideoTorrentManager& manager) {
+		boost::lock_guard<boost::mutex> lock(manager.m_index_mutex);
+		return manager.m_have == manager.m_index_have;
+	}
+
+	/**
+	 * Hands an alert about the current torrent to the feeding thread.
+	 */
+	template<class Alert>
+	static void post_alert(VideoTorrentManager& manager, int piece) {
+		manager.m_alert_queue->push(
+				boost::shared_ptr<libtorrent::alert>(
+						new Alert(manager.m_torrent_handle, piece)));
+	}
+
+	/**
+	 * Waits until the index thread's copy of a piece's state is have.
+	 */
+	static bool wait_for_have(VideoTorrentManager& manager, int piece,
+			bool have) {
+
+		for (int i = 0; i < 3000; i++) {
+			if (index_have(manager)[piece] == have) {
+				return true;
+			}
+
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		}
+
+		return false;
+	}
+
+	/**
+	 * Maps the files of TEST_TORRENT1 stored in save_path, as the feeding
+	 * thread does once the torrent is complete.
+	 */
+	static void map_files(VideoTorrentManager& manager,
+			const std::string& save_path) {
+
+		manager.m_torrent_info = TorrentInfoCache::instance().load(
+				TEST_TORRENT1);
+		manager.m_save_path = save_path;
+		manager.m_unverified = boost::dynamic_bitset<>(TEST_TORRENT1_PIECES);
+		manager.map_files();
+	}
+
+	static bool map_view(VideoTorrentManager& manager, int index,
+			boost::shared_array<char>& data, int& size) {
+
+		return manager.map_view(index, data, size);
+	}
+
+	/**
+	 * Leaves resume data that trusts every piece of TEST_TORRENT1, so
+	 * that a FAST_START add reads them instead of serving the mapped
+	 * file.
+	 */
+	static void save_trusted_resume_data() {
+		VideoTorrentManager video_torrent_manager;
+		boost::shared_ptr<VideoBuffer> video_buffer =
+				video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+
+		// The torrent was checked.
+		ASSERT_TRUE(video_buffer->get_next_piece_for(
+				boost::posix_time::seconds(30)));
+	}
+};
+
 TEST(VideoTorrentManagerTest, AddTorrentInvalid) {
 	VideoTorrentManager video_torrent_manager;
 
@@ -64,4 +158,232 @@ TEST(VideoTorrentManagerTest, AddTwoTorrents) {
 	EXPECT_TRUE(video_buffer);
 }
 
+TEST(VideoTorrentManagerTest, SwitchTorrent) {
+	VideoTorrentManager video_torrent_manager;
+
+	boost::shared_ptr<VideoBuffer> first_buffer =
+			video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+
+	boost::shared_ptr<VideoBuffer> second_buffer;
+	ASSERT_NO_THROW(second_buffer =
+			video_torrent_manager.switch_torrent(TEST_TORRENT2, 0, "."));
+
+	EXPECT_TRUE(second_buffer);
+	EXPECT_NE(first_buffer, second_buffer);
+
+	// Readers of the previous torrent don't block.
+	EXPECT_TRUE(first_buffer->unlocked());
+
+	EXPECT_LT(video_torrent_manager.last_switch_duration(),
+			boost::posix_time::seconds(1));
+}
+
+TEST(VideoTorrentManagerTest, FullBufferResumesOnSpace) {
+	VideoTorrentManager video_torrent_manager;
+
+	// Holds a single piece, so every following one is deferred until
+	// the previous one is read.
+	BufferSettings settings;
+	settings.capacity_bytes = TEST_TORRENT1_PIECE_LENGTH;
+	video_torrent_manager.set_buffer_settings(settings);
+
+	boost::shared_ptr<VideoBuffer> video_buffer =
+			video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+
+	boost::shared_ptr<Piece> piece = video_buffer->get_next_piece_for(
+			boost::posix_time::seconds(30));
+	ASSERT_TRUE(piece);
+	EXPECT_EQ(0, piece->index);
+
+	// Well below the time the feeding thread waits for alerts.
+	for (int i = 1; i < TEST_TORRENT1_PIECES; i++) {
+		piece = video_buffer->get_next_piece_for(
+				boost::posix_time::seconds(2));
+		ASSERT_TRUE(piece);
+		EXPECT_EQ(i, piece->index);
+	}
+}
+
+TEST(VideoTorrentManagerTest, SwitchBack) {
+	VideoTorrentManager video_torrent_manager;
+	video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+
+	ASSERT_NO_THROW(video_torrent_manager.switch_torrent(TEST_TORRENT2, 0, "."));
+
+	// The first torrent is still in the session.
+	boost::shared_ptr<VideoBuffer> video_buffer;
+	ASSERT_NO_THROW(video_buffer =
+			video_torrent_manager.switch_torrent(TEST_TORRENT1, 0, "."));
+
+	boost::shared_ptr<Piece> piece = video_buffer->get_next_piece_for(
+			boost::posix_time::seconds(30));
+	ASSERT_TRUE(piece);
+	EXPECT_EQ(0, piece->index);
+}
+
+TEST(VideoTorrentManagerTest, SwitchBackWaitsForResumeData) {
+	std::string resume_file = "./testfile1.resume";
+
+	VideoTorrentManager video_torrent_manager;
+	boost::shared_ptr<VideoBuffer> video_buffer =
+			video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+	ASSERT_TRUE(video_buffer->get_next_piece_for(
+			boost::posix_time::seconds(30)));
+
+	std::remove(resume_file.c_str());
+
+	// The data saved when switching away is written before it is loaded
+	// again.
+	video_torrent_manager.switch_torrent(TEST_TORRENT2, 0, ".");
+	video_torrent_manager.switch_torrent(TEST_TORRENT1, 0, ".");
+
+	EXPECT_TRUE(std::ifstream(resume_file.c_str()).good());
+}
+
+TEST(VideoTorrentManagerTest, DestroyIsBounded) {
+	std::string resume_file = "./testfile1.resume";
+	std::remove(resume_file.c_str());
+
+	boost::posix_time::ptime start;
+
+	{
+		VideoTorrentManager video_torrent_manager;
+		boost::shared_ptr<VideoBuffer> video_buffer =
+				video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+
+		// The torrent was checked.
+		ASSERT_TRUE(video_buffer->get_next_piece_for(
+				boost::posix_time::seconds(30)));
+
+		start = boost::posix_time::microsec_clock::universal_time();
+	}
+
+	// The resume data was written, without waiting for the timeout.
+	EXPECT_LT(boost::posix_time::microsec_clock::universal_time() - start,
+			boost::posix_time::milliseconds(RESUME_DATA_TIMEOUT_MS));
+	EXPECT_TRUE(std::ifstream(resume_file.c_str()).good());
+}
+
+TEST_F(VideoTorrentManagerStateTest, ReadAheadBoundsReads) {
+	save_trusted_resume_data();
+
+	VideoTorrentManager video_torrent_manager;
+	video_torrent_manager.set_startup_mode(FAST_START);
+	video_torrent_manager.set_read_ahead(2);
+
+	boost::shared_ptr<VideoBuffer> video_buffer =
+			video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+
+	boost::posix_time::ptime timeout =
+			boost::posix_time::microsec_clock::universal_time()
+					+ boost::posix_time::seconds(30);
+	int max_reads = 0;
+	int read = 0;
+
+	// Reads are sampled while every piece is requested.
+	while (read < TEST_TORRENT1_PIECES
+			&& boost::posix_time::microsec_clock::universal_time() < timeout) {
+		max_reads = std::max(max_reads, reads_in_flight(video_torrent_manager));
+
+		if (video_buffer->get_next_piece_for(
+				boost::posix_time::milliseconds(1))) {
+			read++;
+		}
+	}
+
+	EXPECT_EQ(TEST_TORRENT1_PIECES, read);
+	EXPECT_GT(max_reads, 0);
+	EXPECT_LE(max_reads, 2);
+}
+
+TEST_F(VideoTorrentManagerStateTest, HavePiecesInSync) {
+	VideoTorrentManager video_torrent_manager;
+	boost::shared_ptr<VideoBuffer> video_buffer =
+			video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+
+	ASSERT_TRUE(video_buffer->get_next_piece_for(
+			boost::posix_time::seconds(30)));
+
+	// Every piece of the complete torrent was loaded from libtorrent.
+	EXPECT_EQ(TEST_TORRENT1_PIECES,
+			(int) index_have(video_torrent_manager).count());
+	EXPECT_TRUE(have_in_sync(video_torrent_manager));
+
+	// A piece that fails its check is forgotten by both copies.
+	post_alert<libtorrent::hash_failed_alert>(video_torrent_manager, 3);
+	ASSERT_TRUE(wait_for_have(video_torrent_manager, 3, false));
+	EXPECT_TRUE(have_in_sync(video_torrent_manager));
+
+	// Until it is downloaded again.
+	post_alert<libtorrent::piece_finished_alert>(video_torrent_manager, 3);
+	ASSERT_TRUE(wait_for_have(video_torrent_manager, 3, true));
+	EXPECT_TRUE(have_in_sync(video_torrent_manager));
+}
+
+TEST_F(VideoTorrentManagerStateTest, CompleteTorrentIsMapped) {
+	VideoTorrentManager video_torrent_manager;
+	boost::shared_ptr<VideoBuffer> video_buffer =
+			video_torrent_manager.add_torrent(TEST_TORRENT1, 0, ".");
+
+	char expected[8192];
+	std::ifstream stream("testfile1", std::ios::in | std::ios::binary);
+	stream.read(expected, sizeof(expected));
+
+	// Pieces are views of a single mapping of the file.
+	boost::shared_ptr<Piece> first;
+
+	for (int i = 0; i < TEST_TORRENT1_PIECES; i++) {
+		boost::shared_ptr<Piece> piece = video_buffer->get_next_piece_for(
+				boost::posix_time::seconds(30));
+		ASSERT_TRUE(piece);
+		ASSERT_EQ(TEST_TORRENT1_PIECE_LENGTH, piece->size);
+
+		if (!first) {
+			first = piece;
+		}
+
+		EXPECT_EQ(first->data.get() + i * TEST_TORRENT1_PIECE_LENGTH,
+				piece->data.get());
+		EXPECT_EQ(0, memcmp(expected + i * TEST_TORRENT1_PIECE_LENGTH,
+				piece->data.get(), piece->size));
+	}
+}
+
+TEST_F(VideoTorrentManagerStateTest, ShortFileIsRead) {
+	std::string save_path = "shortfile";
+	std::string path = save_path + "/testfile1";
+	mkdir(save_path.c_str(), 0755);
+
+	char data[8192];
+	std::ifstream("testfile1", std::ios::in | std::ios::binary).read(data,
+			sizeof(data));
+
+	VideoTorrentManager video_torrent_manager;
+	boost::shared_array<char> view;
+	int size = 0;
+
+	// A complete copy is mapped.
+	std::ofstream(path.c_str(), std::ios::out | std::ios::binary).write(data,
+			sizeof(data));
+	map_files(video_torrent_manager, save_path);
+
+	ASSERT_TRUE(map_view(video_torrent_manager, 7, view, size));
+	EXPECT_EQ(TEST_TORRENT1_PIECE_LENGTH, size);
+	EXPECT_EQ(0, memcmp(data + 7 * TEST_TORRENT1_PIECE_LENGTH, view.get(),
+			size));
+
+	// A file shorter than the torrent says isn't, so its pieces are read.
+	view.reset();
+	VideoTorrentManager short_manager;
+	std::ofstream(path.c_str(), std::ios::out | std::ios::binary).write(data,
+			sizeof(data) / 2);
+	map_files(short_manager, save_path);
+
+	EXPECT_FALSE(map_view(short_manager, 0, view, size));
+	EXPECT_FALSE(map_view(short_manager, 7, view, size));
+
+	std::remove(path.c_str());
+	rmdir(save_path.c_str());
+}
+
 } /* namespace btstream */